@@ -0,0 +1,128 @@
+/* tuna.lv2 minimal plugin host, for tools in bench/
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* include after ../src/tuna.c */
+#ifndef TUNA_HOST_H
+#define TUNA_HOST_H
+
+#include <time.h>
+
+#define HOST_MAX_BLOCK (4096)
+
+/* minimal URID map */
+static char*    uri_table[128];
+static uint32_t uri_count = 0;
+
+static LV2_URID
+uri_to_id (LV2_URID_Map_Handle handle, const char* uri)
+{
+	for (uint32_t i = 0; i < uri_count; ++i) {
+		if (!strcmp (uri_table[i], uri)) {
+			return i + 1;
+		}
+	}
+	assert (uri_count < 128);
+	uri_table[uri_count++] = strdup (uri);
+	return uri_count;
+}
+
+static void
+uri_free (void)
+{
+	for (uint32_t i = 0; i < uri_count; ++i) {
+		free (uri_table[i]);
+	}
+	uri_count = 0;
+}
+
+static double
+now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+typedef struct {
+	LV2_Handle handle;
+	uint32_t   rate;
+	float      ports[TUNA_TARGET + 1];
+	float      out[HOST_MAX_BLOCK];
+	uint32_t   control[4];
+	uint8_t    notify[8192] __attribute__ ((aligned (8)));
+} TunaHost;
+
+/* instantiate the plugin, connect all ports, default settings */
+static bool
+host_open (TunaHost* h, uint32_t rate)
+{
+	static LV2_URID_Map       map     = { NULL, uri_to_id };
+	static const LV2_Feature  map_ftr = { LV2_URID__map, &map };
+	static const LV2_Feature* features[] = { &map_ftr, NULL };
+
+	h->rate = rate;
+	h->handle = instantiate (&descriptor0, rate, ".", features);
+	if (!h->handle) {
+		fprintf (stderr, "instantiation failed\n");
+		return false;
+	}
+
+	memset (h->ports, 0, sizeof (h->ports));
+	h->ports[TUNA_TUNING] = 440;
+	h->ports[TUNA_T_RMS]  = -75;
+	h->ports[TUNA_T_FLT]  = -45;
+	h->ports[TUNA_T_FFT]  = -40;
+	h->ports[TUNA_T_OVR]  = 20;
+	h->ports[TUNA_T_FUN]  = 5;
+	h->ports[TUNA_T_OCT]  = -30;
+	h->ports[TUNA_T_OVT]  = -15;
+	h->ports[TUNA_FMIN]   = 20;
+	h->ports[TUNA_FMAX]   = 10000;
+
+	h->control[0] = 8; // empty sequence
+	connect_port_tuna (h->handle, TUNA_CONTROL, h->control);
+	connect_port_tuna (h->handle, TUNA_NOTIFY, h->notify);
+	connect_port_tuna (h->handle, TUNA_AOUT, h->out);
+	for (uint32_t p = TUNA_MODE; p <= TUNA_TARGET; ++p) {
+		connect_port_tuna (h->handle, p, &h->ports[p]);
+	}
+	return true;
+}
+
+/* process one block, return the time spent in run() [sec] */
+static double
+host_run (TunaHost* h, const float* in, uint32_t n_samples)
+{
+	assert (n_samples <= HOST_MAX_BLOCK);
+	LV2_Atom_Sequence* notify = (LV2_Atom_Sequence*)h->notify;
+	notify->atom.size = sizeof (h->notify) - sizeof (LV2_Atom);
+	connect_port_tuna (h->handle, TUNA_AIN, (void*)in);
+	const double t0 = now ();
+	run (h->handle, n_samples);
+	return now () - t0;
+}
+
+static void
+host_close (TunaHost* h)
+{
+	cleanup (h->handle);
+	h->handle = NULL;
+}
+
+#endif
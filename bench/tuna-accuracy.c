@@ -0,0 +1,305 @@
+/* tuna.lv2 detection quality report
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* host-less lock-time and accuracy measurement, `make accuracy`
+ *
+ * usage: tuna-accuracy [sample-rate [block-size]] > report.json
+ *
+ * Deterministic test-signals are fed to run() in auto-detect mode,
+ * the output ports are compared to the known frequency of the signal.
+ * For every segment (a note, glissando, ..) the report contains:
+ *
+ *  t_valid    time until the correct note is reported [ms]
+ *  t_lock     time until the frequency is within +-1 cent [ms]
+ *  rms_cent   error during the 2nd half of the segment [cent]
+ *  coverage   fraction of cycles with valid output, 2nd half
+ *  octave     fraction of valid cycles off by one or more octaves
+ *             (within +-100 cent), after t_valid
+ *  gross      fraction of valid cycles off by more than a semitone
+ *             that are not octave errors (e.g. a fifth), after t_valid
+ *
+ * Times are null if the condition was never met. A short summary
+ * is printed to stderr.
+ */
+#include "../src/tuna.c"
+#include "host.h"
+
+#define ACC_RATE  (48000)
+#define ACC_BLOCK (256)
+
+typedef struct {
+	float f0;       // [Hz] fundamental at the start
+	float f1;       // [Hz] at the end, exponential glissando (0: constant)
+	float vib_cent; // vibrato depth
+	float vib_rate; // [Hz]
+	float inharm;   // inharmonicity coefficient of partials
+	int   partials;
+	float seconds;
+} Segment;
+
+typedef struct {
+	const char*    name;
+	const Segment* seg;
+	int            n_seg;
+} TestCase;
+
+#define NOTE(F, P, T)   { F, 0, 0, 0, 0, P, T }
+
+static const Segment seg_steps[] = {
+	NOTE ( 82.41, 3, 1.5), NOTE (110.00, 3, 1.5), NOTE (146.83, 3, 1.5),
+	NOTE (196.00, 3, 1.5), NOTE (246.94, 3, 1.5), NOTE (329.63, 3, 1.5),
+	NOTE (440.00, 3, 1.5), NOTE (880.00, 3, 1.5), NOTE (1760.0, 3, 1.5),
+};
+
+static const Segment seg_glissando[] = {
+	{ 110, 440, 0, 0, 0, 3, 4 },
+	{ 440, 110, 0, 0, 0, 3, 4 },
+};
+
+static const Segment seg_vibrato[] = {
+	{ 440, 0, 20, 5.5, 0, 3, 4 },
+	{ 196, 0, 50, 6.0, 0, 3, 4 },
+};
+
+static const Segment seg_detuned[] = {
+	{  55, 0, 0, 0, .0005, 8, 3 },
+	{ 220, 0, 0, 0, .0002, 8, 3 },
+	{ 880, 0, 0, 0, .0001, 4, 3 },
+};
+
+static const Segment seg_low[] = {
+	NOTE (25.00, 4, 3), NOTE (27.50, 4, 3), NOTE (30.87, 4, 3),
+	NOTE (36.71, 4, 3), NOTE (41.20, 4, 3), NOTE (49.00, 4, 3),
+};
+
+#define TESTCASE(NAME, SEG) { NAME, SEG, sizeof (SEG) / sizeof (Segment) }
+
+static const TestCase testcases[] = {
+	TESTCASE ("steps",     seg_steps),
+	TESTCASE ("glissando", seg_glissando),
+	TESTCASE ("vibrato",   seg_vibrato),
+	TESTCASE ("detuned",   seg_detuned),
+	TESTCASE ("low",       seg_low),
+};
+
+/* frequency of the fundamental at time t [sec] into the segment */
+static double
+seg_freq (const Segment* s, double t)
+{
+	double f = s->f0;
+	if (s->f1 > 0) {
+		f *= pow (s->f1 / s->f0, t / s->seconds);
+	}
+	if (s->vib_cent > 0) {
+		f *= pow (2, s->vib_cent / 1200. * sin (2. * M_PI * s->vib_rate * t));
+	}
+	return f;
+}
+
+/* stretch factor of the k-th partial */
+static double
+seg_stretch (const Segment* s, int k)
+{
+	return sqrt (1. + s->inharm * k * k);
+}
+
+typedef struct {
+	double t_valid;
+	double t_lock;
+	double err2;
+	int    n_err;
+	int    n_half;
+	int    n_valid;
+	int    n_octave;
+	int    n_gross;
+} SegResult;
+
+static void
+json_ms (const char* key, double t, const char* sep)
+{
+	if (t < 0) {
+		printf ("\"%s\": null%s", key, sep);
+	} else {
+		printf ("\"%s\": %.1f%s", key, t * 1000., sep);
+	}
+}
+
+/* run one test-case, print its JSON object */
+static bool
+run_testcase (const TestCase* tc, uint32_t rate, uint32_t block, bool last)
+{
+	TunaHost h;
+	if (!host_open (&h, rate)) {
+		return false;
+	}
+	h.ports[TUNA_MODE] = 0; // auto-detect
+
+	float in[HOST_MAX_BLOCK];
+	double t_run = 0;
+	uint64_t n_total = 0;
+	double case_err2 = 0, case_lock = 0;
+	int case_err = 0, case_valid = 0, case_octave = 0, case_gross = 0, case_unlocked = 0;
+
+	printf ("    {\n      \"name\": \"%s\",\n      \"segments\": [\n", tc->name);
+
+	for (int si = 0; si < tc->n_seg; ++si) {
+		const Segment* s = &tc->seg[si];
+		const uint32_t len = s->seconds * rate;
+		double phase[16] = { 0 };
+		SegResult r = { -1, -1, 0, 0, 0, 0, 0, 0 };
+
+		for (uint32_t n0 = 0; n0 < len; n0 += block) {
+			const uint32_t ns = MIN (block, len - n0);
+
+			/* generate signal */
+			for (uint32_t i = 0; i < ns; ++i) {
+				const double f = seg_freq (s, (n0 + i) / (double)rate);
+				double v = 0;
+				for (int k = 1; k <= s->partials && k <= 16; ++k) {
+					const double fk = k * f * seg_stretch (s, k);
+					if (fk >= rate / 2) {
+						break;
+					}
+					v += .3 / k * sin (phase[k - 1]);
+					phase[k - 1] = fmod (phase[k - 1] + 2. * M_PI * fk / rate, 2. * M_PI);
+				}
+				in[i] = v;
+			}
+
+			t_run += host_run (&h, in, ns);
+			n_total += ns;
+
+			/* evaluate, reference is the fundamental at the center of the block */
+			const double t   = (n0 + ns * .5) / rate;
+			const double ref = seg_freq (s, t) * seg_stretch (s, 1);
+			const float  fo  = h.ports[TUNA_FREQ_OUT];
+			const bool   half = n0 >= len / 2;
+			if (half) {
+				++r.n_half;
+			}
+			if (fo <= 0) {
+				continue;
+			}
+			const double cent = 1200. * log2 (fo / ref);
+			const int note_ref = lrint (12. * log2 (ref / 440.)) + 69;
+			const int note_out = (h.ports[TUNA_OCTAVE] + 1) * 12 + h.ports[TUNA_NOTE];
+
+			if (r.t_valid < 0 && note_out == note_ref) {
+				r.t_valid = (n0 + ns) / (double)rate;
+			}
+			if (r.t_lock < 0 && fabs (cent) < 1) {
+				r.t_lock = (n0 + ns) / (double)rate;
+			}
+			if (r.t_valid >= 0) {
+				++r.n_valid;
+				const long oct = lrint (cent / 1200.);
+				if (fabs (cent - 1200. * oct) > 100) {
+					++r.n_gross;
+				} else if (oct != 0) {
+					++r.n_octave;
+				}
+			}
+			if (half) {
+				r.err2 += cent * cent;
+				++r.n_err;
+			}
+		}
+
+		const double rms = r.n_err > 0 ? sqrt (r.err2 / r.n_err) : -1;
+		printf ("        { \"f0\": %.2f, ", s->f0);
+		if (s->f1 > 0) {
+			printf ("\"f1\": %.2f, ", s->f1);
+		}
+		if (s->vib_cent > 0) {
+			printf ("\"vibrato_cent\": %.1f, \"vibrato_hz\": %.1f, ", s->vib_cent, s->vib_rate);
+		}
+		if (s->inharm > 0) {
+			printf ("\"inharmonicity\": %g, ", s->inharm);
+		}
+		json_ms ("t_valid", r.t_valid, ", ");
+		json_ms ("t_lock", r.t_lock, ", ");
+		if (rms < 0) {
+			printf ("\"rms_cent\": null, ");
+		} else {
+			printf ("\"rms_cent\": %.3f, ", rms);
+		}
+		printf ("\"coverage\": %.3f, ", r.n_half > 0 ? r.n_err / (double)r.n_half : 0);
+		printf ("\"octave\": %.4f, ", r.n_valid > 0 ? r.n_octave / (double)r.n_valid : 0);
+		printf ("\"gross\": %.4f }%s\n", r.n_valid > 0 ? r.n_gross / (double)r.n_valid : 0,
+				si + 1 < tc->n_seg ? "," : "");
+
+		if (r.t_lock < 0) {
+			++case_unlocked;
+		} else {
+			case_lock = MAX (case_lock, r.t_lock);
+		}
+		case_err2 += r.err2;
+		case_err  += r.n_err;
+		case_valid += r.n_valid;
+		case_octave += r.n_octave;
+		case_gross += r.n_gross;
+	}
+
+	const double ns_per_sample = 1e9 * t_run / n_total;
+	const double case_rms = case_err > 0 ? sqrt (case_err2 / case_err) : -1;
+	const double case_oct = case_valid > 0 ? case_octave / (double)case_valid : 0;
+	const double case_grs = case_valid > 0 ? case_gross / (double)case_valid : 0;
+
+	printf ("      ],\n      \"summary\": { ");
+	json_ms ("t_lock_max", case_unlocked ? -1 : case_lock, ", ");
+	printf ("\"unlocked\": %d, ", case_unlocked);
+	if (case_rms < 0) {
+		printf ("\"rms_cent\": null, ");
+	} else {
+		printf ("\"rms_cent\": %.3f, ", case_rms);
+	}
+	printf ("\"octave\": %.4f, \"gross\": %.4f, \"ns_per_sample\": %.2f }\n", case_oct, case_grs, ns_per_sample);
+	printf ("    }%s\n", last ? "" : ",");
+
+	fprintf (stderr, "%-10s lock max %7.1f ms, unlocked %d, rms %7.3f cent, octave %.4f, gross %.4f, %7.2f ns/sample\n",
+			tc->name, case_lock * 1000., case_unlocked, case_rms, case_oct, case_grs, ns_per_sample);
+
+	host_close (&h);
+	return true;
+}
+
+int
+main (int argc, char** argv)
+{
+	const uint32_t rate  = argc > 1 ? atoi (argv[1]) : ACC_RATE;
+	const uint32_t block = argc > 2 ? atoi (argv[2]) : ACC_BLOCK;
+
+	if (rate < 8000 || block < 1 || block > HOST_MAX_BLOCK) {
+		fprintf (stderr, "usage: tuna-accuracy [sample-rate [block-size]]\n");
+		return 1;
+	}
+
+	const int n_cases = sizeof (testcases) / sizeof (TestCase);
+
+	printf ("{\n  \"rate\": %d,\n  \"block\": %d,\n  \"testcases\": [\n", rate, block);
+	for (int i = 0; i < n_cases; ++i) {
+		if (!run_testcase (&testcases[i], rate, block, i + 1 == n_cases)) {
+			return 1;
+		}
+	}
+	printf ("  ]\n}\n");
+
+	uri_free ();
+	return 0;
+}
@@ -0,0 +1,637 @@
+/* tuna.lv2 DSP benchmark
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* host-less benchmark, build and run with `make bench`
+ *
+ * The plugin is compiled into this program, so that the LV2 wrapper
+ * can be compared to calling libtuna directly (as can N engines to
+ * the multi-channel engine, and polyphonic to monophonic detection),
+ * the cost of the partial analysis and of the constant-Q spectrum
+ * is measured.
+ *
+ * Built with TUNA_PROFILE (tuna-bench-prof) it only runs the
+ * signal x rate x block-size matrix and adds the per-stage counters,
+ * as "stage" records. Those timings include the overhead of the
+ * instrumentation (a few timestamps per cycle and one pair per
+ * zero-crossing) and are not comparable to the "run" records.
+ *
+ * usage: tuna-bench [seconds per configuration]
+ *
+ * The output is one record per line, whitespace separated, the first
+ * column names the record type. Lines starting with '#' are comments
+ * and column headers.
+ */
+#include "../src/tuna.c"
+#include "host.h"
+
+#define BENCH_RATE      (48000) // operating mode and API overhead
+#define BENCH_BLOCK     (512)
+#define BENCH_SECONDS   (4)     // per round
+#define BENCH_ROUNDS    (5)     // report the fastest round
+#define BENCH_SETTLE    (.25)   // seconds, before each measurement
+
+static const uint32_t bench_rates[]  = { 44100, 48000, 96000, 192000 };
+static const uint32_t bench_blocks[] = { 16, 64, 256, 1024, 4096 };
+
+typedef enum {
+	SIG_SINE = 0,
+	SIG_SAW,
+	SIG_NOFUND,
+	SIG_NOISE,
+	SIG_SILENCE,
+	SIG_LAST
+} BenchSignal;
+
+static const char* signal_names[SIG_LAST] = {
+	"sine",    // 440Hz
+	"saw",     // 110Hz, band-limited
+	"nofund",  // 110Hz, harmonics 2..8, no fundamental
+	"noise",   // white
+	"silence"
+};
+
+typedef struct {
+	TunaHost h;
+	float*   signal;
+	uint32_t signal_len;
+	uint32_t offset;
+	float    in[HOST_MAX_BLOCK];
+} Bench;
+
+/* one second of a periodic test-signal */
+static void
+gen_signal (Bench* b, BenchSignal sig)
+{
+	const double rate = b->h.rate;
+	b->signal_len = b->h.rate;
+	b->offset = 0;
+	b->signal = (float*)realloc (b->signal, b->signal_len * sizeof (float));
+	srand (42);
+
+	for (uint32_t i = 0; i < b->signal_len; ++i) {
+		double v = 0;
+		switch (sig) {
+			case SIG_SINE:
+				v = .3 * sin (2. * M_PI * 440. * i / rate);
+				break;
+			case SIG_SAW:
+				for (int k = 1; k * 110. < rate / 2 && k <= 100; ++k) {
+					v += ((k & 1) ? .2 : -.2) * sin (2. * M_PI * k * 110. * i / rate) / k;
+				}
+				break;
+			case SIG_NOFUND:
+				for (int k = 2; k <= 8; ++k) {
+					v += .3 * sin (2. * M_PI * k * 110. * i / rate) / k;
+				}
+				break;
+			case SIG_NOISE:
+				v = .6 * (rand () / (double)RAND_MAX - .5);
+				break;
+			default:
+				break;
+		}
+		b->signal[i] = v;
+	}
+}
+
+/* next block of the test-signal */
+static const float*
+next_block (Bench* b, uint32_t n_samples)
+{
+	for (uint32_t i = 0; i < n_samples; ++i) {
+		b->in[i] = b->signal[b->offset];
+		b->offset = (b->offset + 1) % b->signal_len;
+	}
+	return b->in;
+}
+
+/* process one block, return the time spent in run() [sec] */
+static double
+bench_run (Bench* b, uint32_t n_samples)
+{
+#ifdef TUNA_PROFILE
+	/* keep statistics accumulating, they're never sent */
+	((Tuna*)b->h.handle)->prof_time = 0;
+#endif
+	return host_run (&b->h, next_block (b, n_samples), n_samples);
+}
+
+/* time run() in a given operating mode, return ns/sample */
+static double
+bench_mode (Bench* b, const float mode)
+{
+	b->h.ports[TUNA_MODE] = mode;
+	/* settle, get a lock */
+	for (uint32_t i = 0; i < b->h.rate / BENCH_BLOCK; ++i) {
+		bench_run (b, BENCH_BLOCK);
+	}
+	const int iter = BENCH_SECONDS * b->h.rate / BENCH_BLOCK;
+	double t_min = HUGE_VAL;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double t = 0;
+		for (int i = 0; i < iter; ++i) {
+			t += bench_run (b, BENCH_BLOCK);
+		}
+		t_min = MIN (t_min, t);
+	}
+	return 1e9 * t_min / ((double)iter * BENCH_BLOCK);
+}
+
+/* time run() for the current signal and given block-size,
+ * auto-detect mode. print one record, with TUNA_PROFILE
+ * including the per-stage breakdown.
+ */
+static void
+bench_config (Bench* b, BenchSignal sig, uint32_t block, double seconds)
+{
+	b->h.ports[TUNA_MODE] = 0;
+
+	for (uint32_t n = 0; n < BENCH_SETTLE * b->h.rate; n += block) {
+		bench_run (b, block);
+	}
+#ifdef TUNA_PROFILE
+	LibTuna* self = ((Tuna*)b->h.handle)->engine;
+	for (int i = 0; i < TP_LAST; ++i) {
+		tuna_prof_reset (&self->prof[i]);
+	}
+#endif
+
+	const uint32_t iter = MAX (1, seconds * b->h.rate / block);
+	double t_total = 0;
+	double t_worst = 0;
+	for (uint32_t i = 0; i < iter; ++i) {
+		const double t = bench_run (b, block);
+		t_total += t;
+		t_worst = MAX (t_worst, t);
+	}
+
+	const double n_total = (double)iter * block;
+#ifdef TUNA_PROFILE
+	printf ("stage %-7s %6d %4d %8.2f %9.2f %9.2f %9.2f %9.2f\n",
+			signal_names[sig], b->h.rate, block,
+			1e9 * t_total / n_total,
+			1e6 * t_worst,
+			self->prof[TP_FFT].sum / n_total,
+			self->prof[TP_NOTE].sum / n_total,
+			(self->prof[TP_FILTER].sum + self->prof[TP_DLL].sum) / n_total);
+#else
+	printf ("run  %-7s %6d %4d %8.2f %9.2f\n",
+			signal_names[sig], b->h.rate, block,
+			1e9 * t_total / n_total,
+			1e6 * t_worst);
+#endif
+	fflush (stdout);
+}
+
+/* compare run() of the LV2 plugin with calling the engine directly,
+ * same signal. Fixed-frequency mode: the FFT would dominate and is
+ * identical for both. print one record.
+ */
+static void
+bench_api (Bench* b, uint32_t block)
+{
+	LibTuna* tuna = libtuna_alloc (b->h.rate);
+	libtuna_set_mode (tuna, 440);
+	b->h.ports[TUNA_MODE] = 440;
+
+	const int iter = BENCH_SECONDS * b->h.rate / block;
+	double t_lv2 = HUGE_VAL;
+	double t_lib = HUGE_VAL;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double t = 0;
+		for (int i = 0; i < iter; ++i) {
+			t += bench_run (b, block);
+		}
+		t_lv2 = MIN (t_lv2, t);
+
+		t = 0;
+		for (int i = 0; i < iter; ++i) {
+			const float* in = next_block (b, block);
+			const double t0 = now ();
+			libtuna_process (tuna, in, block);
+			t += now () - t0;
+		}
+		t_lib = MIN (t_lib, t);
+	}
+
+	const double n_total = (double)iter * block;
+	printf ("api  %4d %8.2f %8.2f %8.1f\n", block,
+			1e9 * t_lv2 / n_total, 1e9 * t_lib / n_total, 1e9 * (t_lv2 - t_lib) / iter);
+	fflush (stdout);
+	libtuna_free (tuna);
+}
+
+/* compare N independent engines with one multi-channel engine,
+ * six strings of a guitar. Fixed mode (all channels track A2)
+ * skips the FFT and times the sample-loop. In auto mode both use the
+ * analysis for the range (instrument). print one record, time per
+ * sample and channel, the gain per channel, and the number of channels
+ * that track their string at the end.
+ */
+static void
+bench_multi (uint32_t rate, uint32_t block, const float mode, LibTunaInstrument instrument)
+{
+	static const float strings[] = { 82.41, 110.0, 146.83, 196.0, 246.94, 329.63 };
+	static const char* names[LIBTUNA_INSTRUMENT_LAST] = { "generic", "bass", "guitar", "violin", "voice", "piano" };
+	const uint32_t n_ch = sizeof (strings) / sizeof (strings[0]);
+	const LibTunaRange range = { instrument, 0, INFINITY, 0 };
+
+	float*       sig[n_ch];
+	const float* in[n_ch];
+	LibTuna*     single[n_ch];
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		sig[c] = (float*)malloc (rate * sizeof (float));
+		for (uint32_t i = 0; i < rate; ++i) {
+			const double p = 2. * M_PI * strings[c] * i / rate;
+			sig[c][i] = .2 * sin (p) + .1 * sin (2 * p) + .05 * sin (3 * p);
+		}
+		single[c] = libtuna_alloc (rate);
+		libtuna_set_mode (single[c], mode);
+		libtuna_set_range (single[c], &range);
+		libtuna_analysis_free (libtuna_swap_analysis (single[c], libtuna_analysis_alloc (rate, &range)));
+	}
+	LibTunaMulti* multi = libtuna_multi_alloc (rate, n_ch, &range);
+	libtuna_multi_set_mode (multi, mode);
+
+	const int iter = BENCH_SECONDS * rate / block;
+	double t_single = HUGE_VAL;
+	double t_multi  = HUGE_VAL;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double ts = 0;
+		double tm = 0;
+		uint32_t off = 0;
+		for (int i = 0; i < iter; ++i) {
+			if (off + block > rate) {
+				off = 0;
+			}
+			for (uint32_t c = 0; c < n_ch; ++c) {
+				in[c] = &sig[c][off];
+			}
+			double t0 = now ();
+			for (uint32_t c = 0; c < n_ch; ++c) {
+				libtuna_process (single[c], in[c], block);
+			}
+			ts += now () - t0;
+
+			t0 = now ();
+			libtuna_multi_process (multi, in, block);
+			tm += now () - t0;
+			off += block;
+		}
+		t_single = MIN (t_single, ts);
+		t_multi  = MIN (t_multi, tm);
+	}
+
+	int found_single = 0;
+	int found_multi  = 0;
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		const float target = mode > 0 ? mode : strings[c];
+		found_single += fabsf (libtuna_result (single[c])->freq / target - 1.f) < .01f;
+		found_multi  += fabsf (libtuna_multi_result (multi, c)->freq / target - 1.f) < .01f;
+	}
+
+	const double n_total = (double)iter * block * n_ch;
+	printf ("multi %-5s %-7s %4d %d %8.2f %8.2f %6.2f %d %d\n", mode == 0 ? "auto" : "fixed", names[instrument], block, n_ch,
+			1e9 * t_single / n_total, 1e9 * t_multi / n_total, t_single / t_multi, found_single, found_multi);
+	fflush (stdout);
+
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		libtuna_free (single[c]);
+		free (sig[c]);
+	}
+	libtuna_multi_free (multi);
+}
+
+/* polyphonic detection of a six-note chord, compared to the
+ * monophonic tracker on the same signal. print one record:
+ * time per sample, worst-case call with polyphony and the number
+ * of notes that are reported at the end.
+ */
+static void
+bench_poly (uint32_t rate, uint32_t block, uint32_t n_notes)
+{
+	static const float chord[] = { 82.41, 123.47, 164.81, 207.65, 246.94, 329.63 };
+	const uint32_t n_ch = sizeof (chord) / sizeof (chord[0]);
+
+	float* sig = (float*)calloc (rate, sizeof (float));
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		for (uint32_t i = 0; i < rate; ++i) {
+			const double p = 2. * M_PI * chord[c] * i / rate;
+			sig[i] += .05 * sin (p) + .1 * sin (2 * p) + .05 * sin (3 * p) + .02 * sin (4 * p);
+		}
+	}
+
+	LibTuna* mono = libtuna_alloc (rate);
+	LibTuna* poly = libtuna_alloc (rate);
+	libtuna_set_polyphony (poly, n_notes);
+
+	const int iter = BENCH_SECONDS * rate / block;
+	double t_mono = HUGE_VAL;
+	double t_poly = HUGE_VAL;
+	double t_worst = 0;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double tm = 0;
+		double tp = 0;
+		uint32_t off = 0;
+		for (int i = 0; i < iter; ++i) {
+			if (off + block > rate) {
+				off = 0;
+			}
+			double t0 = now ();
+			libtuna_process (mono, &sig[off], block);
+			tm += now () - t0;
+
+			t0 = now ();
+			libtuna_process (poly, &sig[off], block);
+			const double dt = now () - t0;
+			tp += dt;
+			if (r > 0) {
+				t_worst = MAX (t_worst, dt);
+			}
+			off += block;
+		}
+		t_mono = MIN (t_mono, tm);
+		t_poly = MIN (t_poly, tp);
+	}
+
+	uint32_t n_found = 0;
+	const LibTunaPolyResult* pr = libtuna_poly_result (poly);
+	for (uint32_t k = 0; k < pr->n_notes; ++k) {
+		if (pr->note[k].freq > 0) {
+			++n_found;
+		}
+	}
+
+	const double n_total = (double)iter * block;
+	printf ("poly %4d %d %8.2f %8.2f %8.2f %d\n", block, n_notes,
+			1e9 * t_mono / n_total, 1e9 * t_poly / n_total, 1e6 * t_worst, n_found);
+	fflush (stdout);
+
+	libtuna_free (mono);
+	libtuna_free (poly);
+	free (sig);
+}
+
+/* partial analysis of a stiff string (A2, B = 4e-4), fixed mode.
+ * print one record: time per sample for the given number of partials,
+ * and the number of partials that are locked at the end.
+ */
+static void
+bench_partials (uint32_t rate, uint32_t block, uint32_t n_partials)
+{
+	const double f0 = 110;
+	const double B  = 4e-4;
+
+	float* sig = (float*)calloc (rate, sizeof (float));
+	for (uint32_t h = 1; h <= 20; ++h) {
+		const double fh = h * f0 * sqrt (1 + B * h * h);
+		for (uint32_t i = 0; i < rate; ++i) {
+			sig[i] += .2 / h * sin (2. * M_PI * fh * i / rate);
+		}
+	}
+
+	LibTuna* tuna = libtuna_alloc (rate);
+	libtuna_set_mode (tuna, f0);
+	libtuna_set_partials (tuna, n_partials);
+
+	const int iter = BENCH_SECONDS * rate / block;
+	double t_best = HUGE_VAL;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double t = 0;
+		uint32_t off = 0;
+		for (int i = 0; i < iter; ++i) {
+			if (off + block > rate) {
+				off = 0;
+			}
+			const double t0 = now ();
+			libtuna_process (tuna, &sig[off], block);
+			t += now () - t0;
+			off += block;
+		}
+		t_best = MIN (t_best, t);
+	}
+
+	uint32_t n_locked = 0;
+	const LibTunaPartials* pr = libtuna_partials_result (tuna);
+	for (uint32_t k = 0; k < pr->n_partials; ++k) {
+		if (pr->freq[k] > 0) {
+			++n_locked;
+		}
+	}
+
+	printf ("partials %2d %8.2f %d\n", n_partials, 1e9 * t_best / ((double)iter * block), n_locked);
+	fflush (stdout);
+
+	libtuna_free (tuna);
+	free (sig);
+}
+
+/* spectrum display in fixed mode: the full-band FFT, or the zoomed
+ * spectrum around the note (zoom: true). The signal is 3.2 cent sharp.
+ */
+static void
+bench_zoom (uint32_t rate, uint32_t block, float freq, bool zoom)
+{
+	/* continuous phase, a looped buffer would add sidebands */
+	float* sig = (float*)calloc (block, sizeof (float));
+	const double w = 2. * M_PI * freq * pow (2., 3.2 / 1200.) / rate;
+	double phase = 0;
+
+	LibTuna* tuna = libtuna_alloc (rate);
+	libtuna_set_mode (tuna, freq);
+	libtuna_set_spectrum (tuna, !zoom);
+	libtuna_set_zoom (tuna, zoom);
+
+	const int iter = BENCH_SECONDS * rate / block;
+	double t_best = HUGE_VAL;
+	for (int r = 0; r < BENCH_ROUNDS; ++r) {
+		double t = 0;
+		for (int i = 0; i < iter; ++i) {
+			for (uint32_t k = 0; k < block; ++k) {
+				sig[k] = .3 * sin (phase);
+				phase = fmod (phase + w, 2. * M_PI);
+			}
+			const double t0 = now ();
+			libtuna_process (tuna, sig, block);
+			t += now () - t0;
+		}
+		t_best = MIN (t_best, t);
+	}
+
+	const LibTunaZoom* zr = libtuna_zoom_result (tuna);
+	printf ("spectrum %-4s %7.1f %8.2f %+7.3f\n", zoom ? "zoom" : "full", freq,
+			1e9 * t_best / ((double)iter * block), zoom && zr->n_bins > 0 ? zr->peak : 0);
+	fflush (stdout);
+
+	libtuna_free (tuna);
+	free (sig);
+}
+
+/* constant-Q spectrum: size of the sparse kernel, time to build it,
+ * and per FFT frame the cost of the FFT, the constant-Q bins, and
+ * of note-finding on either, default thresholds (sawtooth, A2 .. A6).
+ */
+static void
+bench_constq (uint32_t rate)
+{
+	LibTuna* tuna = libtuna_alloc (rate);
+	struct FFTAnalysis* ft = tuna->an->fftx;
+	const ConstQ* cq = tuna->an->cq;
+	const uint32_t N = ft->window_size;
+
+	/* libtuna_alloc() built one already, time another */
+	const double t0 = now ();
+	cq_free (cq_alloc (ft));
+	const double t_build = now () - t0;
+
+	float* sig = (float*)malloc (N * sizeof (float));
+	const int iter = 200;
+	double t_fft = 0, t_cq = 0, t_lin = 0, t_note = 0;
+	uint32_t n_ok_lin = 0, n_ok_cq = 0, n_notes = 0;
+
+	for (float freq = 110; freq <= 1760; freq *= 2, ++n_notes) {
+		double rms = 0;
+		for (uint32_t i = 0; i < N; ++i) {
+			const double p = freq * i / rate;
+			sig[i] = .3 * (2. * (p - floor (p)) - 1.);
+			rms += sig[i] * sig[i];
+		}
+		const float threshold = rms / N * tuna->v_fft;
+		float f_lin = 0, f_cq = 0;
+		for (int i = 0; i < iter; ++i) {
+			const double t1 = now ();
+			fftx_run (ft, N, sig);
+			const double t2 = now ();
+			cq_analyze (tuna->an->cq, ft);
+			const double t3 = now ();
+			f_lin = tuna_find_note (tuna, false, threshold);
+			const double t4 = now ();
+			f_cq = tuna_find_note (tuna, true, threshold);
+			t_fft  += t2 - t1;
+			t_cq   += t3 - t2;
+			t_lin  += t4 - t3;
+			t_note += now () - t4;
+		}
+		/* the right note; frames do not overlap, no phase-vocoder refinement */
+		n_ok_lin += f_lin > 0 && fabsf (1200.f * log2f (f_lin / freq)) < 50;
+		n_ok_cq  += f_cq > 0 && fabsf (1200.f * log2f (f_cq / freq)) < 50;
+	}
+
+	const double n_frames = (double)iter * n_notes;
+	printf ("constq %6d %5d %4d %5d %7.2f %8.1f %8.1f %8.1f %8.1f %d/%d %d/%d\n",
+			rate, N, cq->n_bins, cq->offset[cq->n_bins], 1e3 * t_build,
+			1e9 * t_fft / n_frames, 1e9 * t_cq / n_frames,
+			1e9 * t_lin / n_frames, 1e9 * t_note / n_frames,
+			n_ok_lin, n_notes, n_ok_cq, n_notes);
+	fflush (stdout);
+
+	libtuna_free (tuna);
+	free (sig);
+}
+
+int
+main (int argc, char** argv)
+{
+	const double seconds = argc > 1 ? atof (argv[1]) : 2;
+	if (seconds <= 0) {
+		fprintf (stderr, "usage: tuna-bench [seconds per configuration]\n");
+		return 1;
+	}
+
+	Bench b;
+	memset (&b, 0, sizeof (b));
+
+	/* signals x sample-rates x block-sizes */
+#ifdef TUNA_PROFILE
+	printf ("# tuna-bench, instrumented (TUNA_PROFILE), per-stage unit: %s\n", TUNA_PROF_UNIT ? "cycles" : "ns");
+	printf ("# %.2f sec audio per configuration, auto-detect mode\n", seconds);
+	printf ("# stage signal rate block ns/sample(instrumented) worst-call[us] fft/sample note/sample loop/sample\n");
+#else
+	printf ("# tuna-bench\n");
+	printf ("# %.2f sec audio per configuration, auto-detect mode\n", seconds);
+	printf ("# run  signal rate block ns/sample worst-call[us]\n");
+#endif
+	for (size_t r = 0; r < sizeof (bench_rates) / sizeof (bench_rates[0]); ++r) {
+		for (int sig = 0; sig < SIG_LAST; ++sig) {
+			if (!host_open (&b.h, bench_rates[r])) {
+				return 1;
+			}
+			gen_signal (&b, sig);
+			for (size_t k = 0; k < sizeof (bench_blocks) / sizeof (bench_blocks[0]); ++k) {
+				bench_config (&b, sig, bench_blocks[k], seconds);
+			}
+			host_close (&b.h);
+		}
+	}
+#ifdef TUNA_PROFILE
+	free (b.signal);
+	uri_free ();
+	return 0;
+#endif
+
+	if (!host_open (&b.h, BENCH_RATE)) {
+		return 1;
+	}
+	gen_signal (&b, SIG_SINE);
+
+	printf ("# rate: %d, block-size: %d, best of %d x %d sec audio\n", BENCH_RATE, BENCH_BLOCK, BENCH_ROUNDS, BENCH_SECONDS);
+	printf ("# mode name ns/sample\n");
+	printf ("mode auto  %8.2f\n", bench_mode (&b, 0));
+	printf ("mode fixed %8.2f\n", bench_mode (&b, 440));
+	printf ("mode midi  %8.2f\n", bench_mode (&b, -70));
+
+	printf ("# api block lv2-run[ns/sample] libtuna[ns/sample] overhead[ns/call], fixed mode\n");
+	bench_api (&b, 16);
+	bench_api (&b, 64);
+	bench_api (&b, BENCH_BLOCK);
+
+	printf ("# multi mode range block channels single[ns/sample/channel] multi[ns/sample/channel] gain found-single found-multi\n");
+	bench_multi (BENCH_RATE, 64, 0, LIBTUNA_INSTRUMENT_GENERIC);
+	bench_multi (BENCH_RATE, BENCH_BLOCK, 0, LIBTUNA_INSTRUMENT_GENERIC);
+	bench_multi (BENCH_RATE, 64, 0, LIBTUNA_INSTRUMENT_GUITAR);
+	bench_multi (BENCH_RATE, BENCH_BLOCK, 0, LIBTUNA_INSTRUMENT_GUITAR);
+	bench_multi (BENCH_RATE, 64, 110, LIBTUNA_INSTRUMENT_GENERIC);
+	bench_multi (BENCH_RATE, BENCH_BLOCK, 110, LIBTUNA_INSTRUMENT_GENERIC);
+
+	printf ("# poly block notes mono[ns/sample] poly[ns/sample] worst-call[us] notes-found\n");
+	bench_poly (BENCH_RATE, 64, 6);
+	bench_poly (BENCH_RATE, BENCH_BLOCK, 6);
+	bench_poly (BENCH_RATE, BENCH_BLOCK, LIBTUNA_POLY_MAX);
+
+	printf ("# partials count ns/sample locked, fixed mode, block-size %d\n", BENCH_BLOCK);
+	bench_partials (BENCH_RATE, BENCH_BLOCK, 0);
+	bench_partials (BENCH_RATE, BENCH_BLOCK, 8);
+	bench_partials (BENCH_RATE, BENCH_BLOCK, LIBTUNA_PARTIALS_MAX);
+
+	printf ("# spectrum display freq ns/sample peak[cent], fixed mode, block-size %d\n", BENCH_BLOCK);
+	bench_zoom (BENCH_RATE, BENCH_BLOCK, 440, false);
+	bench_zoom (BENCH_RATE, BENCH_BLOCK, 110, true);
+	bench_zoom (BENCH_RATE, BENCH_BLOCK, 440, true);
+	bench_zoom (BENCH_RATE, BENCH_BLOCK, 1760, true);
+
+	printf ("# constq rate fft-size bins coefficients build[ms] fft[ns/frame] constq[ns/frame] note-fft[ns/frame] note-constq[ns/frame] found-fft found-constq\n");
+	for (uint32_t r = 0; r < sizeof (bench_rates) / sizeof (bench_rates[0]); ++r) {
+		bench_constq (bench_rates[r]);
+	}
+
+	host_close (&b.h);
+	free (b.signal);
+	uri_free ();
+	return 0;
+}
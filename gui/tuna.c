@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 
 #ifdef HAVE_LV2_1_18_6
 #include <lv2/ui/ui.h>
@@ -42,6 +43,15 @@
 #define DAWIDTH  (400.)
 #define DAHEIGHT (300.)
 
+/* constant-Q spectrum, log-frequency axis: 7 octaves from A0 */
+#define SPEC_LOG_FMIN (27.5)
+#define SPEC_LOG_OCT  (7.)
+
+/* waterfall: one row per spectrum message (TUNA_SPEC_FPS),
+ * the plot area holds about 11 seconds */
+#define WF_W    ((int)DAWIDTH - 20)
+#define WF_ROWS ((int)DAHEIGHT - 20)
+
 /* pixel layout */
 #define L_BAR_X (20)
 #define L_BAR_W (DAWIDTH - 40)
@@ -70,6 +80,51 @@
 #define L_FOO_XC (DAWIDTH / 2)
 #define L_FOO_YB (DAHEIGHT - 20)
 
+/* display update rate, smoothing time-constants [sec] */
+#define UI_FPS    (60.f)
+#define TAU_CENT  (.08f)
+#define TAU_RMS   (.11f)
+#define TAU_ERROR (1.3f)
+
+/* areas that are redrawn individually, see update_display() */
+enum {
+	D_NOTE = 0,
+	D_CENT,
+	D_TUNE,
+	D_FOOT,
+	D_CNTBAR,
+	D_STROBE,
+	D_LEVEL,
+	D_ERROR,
+	D_LAST
+};
+
+/* accuracy bar, color classes */
+enum {
+	E_NONE = 0,
+	E_LOCKED, // green, with a blue bar above 2 ct
+	E_CLOSE,  // blue
+	E_NEAR,   // yellow
+	E_PHASE,  // out of phase, red
+	E_RANGE,  // off, red
+};
+
+/* what is on screen, expose_event() only draws this */
+typedef struct {
+	char  note[16];
+	char  cent[16];
+	char  tune[32];
+	char  foot[32];
+	bool  signal;
+	bool  cent_ok;
+	float cent_w;
+	float level_w;
+	int   err_cls;
+	float err_w;
+	float strobe_phase;
+	bool  strobe_hl;
+} TunaDisplay;
+
 typedef struct {
 	LV2UI_Write_Function write;
 	LV2UI_Controller controller;
@@ -83,6 +138,9 @@ typedef struct {
 
 	RobWidget *btnbox;
 	RobTkRBtn *disp[2];
+	RobTkCBtn *btn_zoom;
+	RobTkCBtn *btn_constq;
+	RobTkCBtn *btn_waterfall;
 	RobTkSep  *sep[3];
 	RobTkLbl  *label[4];
 	RobTkSpin *spb_tuning;
@@ -93,6 +151,9 @@ typedef struct {
 
 	RobTkLbl  *lbl_debug[7];
 	RobTkSpin *spb_debug[7];
+#ifdef TUNA_PROFILE
+	RobTkLbl  *lbl_prof;
+#endif
 
 	PangoFontDescription *font[4];
 	cairo_surface_t *frontface;
@@ -104,6 +165,7 @@ typedef struct {
 	float p_octave;
 	float p_note;
 	float p_cent;
+	float p_target;
 	float p_error;
 
 	/* smoothed values for display */
@@ -114,6 +176,34 @@ typedef struct {
 	float strobe_tme;
 	float strobe_dpy;
 	float strobe_phase;
+	bool  strobe_hl;
+	double tick_tme;
+	double flush_tme;
+
+	TunaDisplay dpy;
+	cairo_rectangle_t d_area[D_LAST]; // see layout_areas()
+
+	/* zoomed spectrum */
+	bool  zoom;
+	float zoom_fc;
+	float zoom_peak;
+	float zoom_level;
+
+	bool  constq; // log-frequency axis
+
+	/* spectrum as received, see TUNA_SPEC_BINS */
+	uint8_t  spec_q[TUNA_SPEC_BINS];
+	uint32_t spec_bins;
+	float    spec_f0, spec_df;
+	int32_t  spec_bpo;
+
+	/* waterfall, ring-buffer of rows in an image surface */
+	bool             waterfall;
+	cairo_surface_t* wf_surf;
+	uint32_t         wf_row;      // newest row
+	uint32_t         wf_lut[256]; // color of a quantized bin
+	uint16_t         wf_b0[WF_W]; // bins [b0, b1) of a pixel column
+	uint16_t         wf_b1[WF_W];
 
 	bool disable_signals;
 	bool spectr_enable;
@@ -169,11 +259,81 @@ static int deflect(float val) {
 	return lvl;
 }
 
+/* x-axis value of a frequency, in the units of the spectrum's points */
+static float spectrum_xval(TunaUI* ui, const float f) {
+	if (ui->constq) {
+		return log2f(f / SPEC_LOG_FMIN);
+	}
+	return f;
+}
+
+/* relative position of a frequency on the x-axis, 0..1 */
+static float spectrum_x(TunaUI* ui, const float f) {
+	if (ui->constq) {
+		return spectrum_xval(ui, f) / SPEC_LOG_OCT;
+	}
+	return f / 1500.;
+}
+
+static void set_spectrum_mapping(TunaUI* ui) {
+	if (ui->zoom) {
+		robtk_xydraw_set_mapping(ui->xyp, 1./200., .5, 1./92., 1.0);
+	} else if (ui->constq) {
+		robtk_xydraw_set_mapping(ui->xyp, 1./SPEC_LOG_OCT, 0, 1./92., 1.0);
+	} else {
+		robtk_xydraw_set_mapping(ui->xyp, 1./1500., 0, 1./92., 1.0);
+	}
+}
+
+/* zoomed spectrum: detected frequency and the strongest peak */
+static void xy_clip_zoom(cairo_t *cr, TunaUI* ui) {
+	if (ui->zoom_fc <= 0) {
+		return;
+	}
+	if (ui->p_freq > 0) {
+		const float ct = 1200.f * log2f(ui->p_freq / ui->zoom_fc);
+		if (fabsf(ct) < 100) {
+			const float x = 10 + (DAWIDTH - 20.) * (ct + 100.f) / 200.f;
+			cairo_set_source_rgba (cr, .0, .9, .0, .6);
+			cairo_set_line_width(cr, 3.5);
+			cairo_move_to(cr, rintf(x) - .5, 10);
+			cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
+			cairo_stroke(cr);
+		}
+	}
+	if (ui->zoom_level > -92) {
+		char tmp[64];
+		sprintf(tmp, "%.1fHz, peak: %+.2fct", ui->zoom_fc, ui->zoom_peak);
+		write_text_full(cr, tmp, ui->font[F_M_SMALL],
+				20, DAHEIGHT - 20, 0, 3, c_g60);
+	}
+}
+
+/* copy `n` rows of the waterfall, starting at `row`, to `y` */
+static void wf_blit(cairo_t *cr, TunaUI* ui, int y, int row, int n) {
+	if (n <= 0) {
+		return;
+	}
+	cairo_save(cr);
+	cairo_rectangle (cr, 10, y, WF_W, n);
+	cairo_clip(cr);
+	cairo_set_source_surface(cr, ui->wf_surf, 10, y - row);
+	cairo_paint_with_alpha(cr, .85);
+	cairo_restore(cr);
+}
+
 static void xy_clip_fn(cairo_t *cr, void *data) {
 	TunaUI* ui = (TunaUI*) data;
 	rounded_rectangle (cr, 10, 10, DAWIDTH - 20, DAHEIGHT - 20, 10);
 	cairo_clip(cr);
 
+	if (ui->waterfall && !ui->zoom && ui->wf_surf) {
+		/* newest row at the top: rows wf_row.. then 0..wf_row-1 */
+		const int top = WF_ROWS - ui->wf_row;
+		wf_blit(cr, ui, 10, ui->wf_row, top);
+		wf_blit(cr, ui, 10 + top, 0, ui->wf_row);
+	}
+
 	/* global abs. threshold */
 	{
 		float y0 = 10 + (DAHEIGHT - 20.) * robtk_spin_get_value(ui->spb_debug[0]) / -92.;
@@ -183,13 +343,18 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 		cairo_fill(cr);
 	}
 
+	if (ui->zoom) {
+		xy_clip_zoom(cr, ui);
+		return;
+	}
+
 	cairo_save(cr);
 	if (ui->p_freq > 0) {
 		/* note detected */
 
 		if (ui->s_rms > -90) {
 		/* RMS value and post-filter threshold */
-			float xf = 10 + (DAWIDTH - 20.) * ui->p_freq / 1500.;
+			float xf = 10 + (DAWIDTH - 20.) * spectrum_x(ui, ui->p_freq);
 			const float y0 = 10 + (DAHEIGHT - 20.) * (-ui->s_rms) / 92.;
 			const float y1 = 10 + (DAHEIGHT - 20.) * (-ui->s_rms - robtk_spin_get_value(ui->spb_debug[1])) / 92.;
 			const float y2 = 10 + (DAHEIGHT - 20.) * (-ui->s_rms - robtk_spin_get_value(ui->spb_debug[2])) / 92.;
@@ -212,8 +377,10 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 
 		if (robtk_rbtn_get_active(ui->disp[1])) {
 			float pp = -100;
+			const float px = spectrum_xval(ui, ui->p_freq);
+			const float dx = ui->constq ? 1.f / 12.f : 10.f; // a semitone, 10Hz
 			for (uint32_t d=0; d < ui->xyp->n_points; ++d) {
-				if (fabsf(ui->xyp->points_x[d] - ui->p_freq) < 10 && ui->xyp->points_y[d] > pp
+				if (fabsf(ui->xyp->points_x[d] - px) < dx && ui->xyp->points_y[d] > pp
 						) pp = ui->xyp->points_y[d];
 			}
 			if (pp > -85) {
@@ -222,8 +389,9 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 				const float y2 = 10 - (DAHEIGHT - 20.) * (pp + robtk_spin_get_value(ui->spb_debug[3]) + robtk_spin_get_value(ui->spb_debug[4])) / 92.;
 				const float y3 = 10 - (DAHEIGHT - 20.) * (pp + robtk_spin_get_value(ui->spb_debug[5])) / 92.;
 				const float y4 =  0 - (DAHEIGHT - 20.) * (robtk_spin_get_value(ui->spb_debug[6])) / 92.;
-				float x = (DAWIDTH - 20.) * ui->p_freq / 1500.;
-				float x0 = 10 + x;
+				float x0 = 10 + (DAWIDTH - 20.) * spectrum_x(ui, ui->p_freq);
+				float x1 = 10 + (DAWIDTH - 20.) * spectrum_x(ui, 2.f * ui->p_freq) - x0; // 1st octave
+				float x3 = 10 + (DAWIDTH - 20.) * spectrum_x(ui, 4.f * ui->p_freq) - x0; // 2nd octave
 
 				cairo_set_source_rgba(cr, 0.5, 0.1, 0.1, 0.3);
 				cairo_rectangle (cr, x0, y0, DAWIDTH-x0, y1-y0);
@@ -232,13 +400,13 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 				cairo_rectangle (cr, x0, y0, DAWIDTH-x0, y2-y0);
 				cairo_fill(cr);
 				cairo_set_source_rgba(cr, 0.1, 0.1, 0.6, 0.4);
-				cairo_rectangle (cr, x0, y0, x, y3-y0);
+				cairo_rectangle (cr, x0, y0, x1, y3-y0);
 				cairo_fill(cr);
 				cairo_set_source_rgba(cr, 0.2, 0.1, 0.6, 0.3);
-				cairo_rectangle (cr, x0+x, y0, DAWIDTH-x0-x, y4+y3-y0);
+				cairo_rectangle (cr, x0+x1, y0, DAWIDTH-x0-x1, y4+y3-y0);
 				cairo_fill(cr);
 				cairo_set_source_rgba(cr, 0.2, 0.1, 0.6, 0.3);
-				cairo_rectangle (cr, x0+3.f*x, y0, DAWIDTH-x0-3*x, 2.f*y4+y3-y0);
+				cairo_rectangle (cr, x0+x3, y0, DAWIDTH-x0-x3, 2.f*y4+y3-y0);
 				cairo_fill(cr);
 
 				/* draw cross */
@@ -256,7 +424,7 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 		/* octave lines */
 		cairo_set_source_rgba (cr, .0, .9, .0, .6);
 		cairo_set_line_width(cr, 3.5);
-		float x = 10 + (DAWIDTH - 20.) * ui->p_freq / 1500.;
+		float x = 10 + (DAWIDTH - 20.) * spectrum_x(ui, ui->p_freq);
 		cairo_move_to(cr, rintf(x) - .5, 10);
 		cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
 		cairo_stroke(cr);
@@ -265,17 +433,17 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 		cairo_set_dash(cr, dash, 1, 0);
 		cairo_set_line_width(cr, 4.0);
 		cairo_set_source_rgba (cr, .2, .8, .0, .6);
-		x = 10 + (DAWIDTH - 20.) * 2.0 * ui->p_freq / 1500.;
+		x = 10 + (DAWIDTH - 20.) * spectrum_x(ui, 2.0 * ui->p_freq);
 		cairo_move_to(cr, rintf(x) - .0, 10);
 		cairo_line_to(cr, rintf(x) - .0, DAHEIGHT - 10);
 		cairo_stroke(cr);
 
-		x = 10 + (DAWIDTH - 20.) * 4.0 * ui->p_freq / 1500.;
+		x = 10 + (DAWIDTH - 20.) * spectrum_x(ui, 4.0 * ui->p_freq);
 		cairo_move_to(cr, rintf(x) - .0, 10);
 		cairo_line_to(cr, rintf(x) - .0, DAHEIGHT - 10);
 		cairo_stroke(cr);
 
-		x = 10 + (DAWIDTH - 20.) * 8.0 * ui->p_freq / 1500.;
+		x = 10 + (DAWIDTH - 20.) * spectrum_x(ui, 8.0 * ui->p_freq);
 		cairo_move_to(cr, rintf(x) - .0, 10);
 		cairo_line_to(cr, rintf(x) - .0, DAHEIGHT - 10);
 		cairo_stroke(cr);
@@ -300,6 +468,133 @@ static void xy_clip_fn(cairo_t *cr, void *data) {
 	cairo_restore(cr);
 }
 
+/* spectrum background: dB and frequency grid (linear, or logarithmic
+ * for the constant-Q spectrum), or cent grid when zoomed */
+static void render_spectrum_faceplate(TunaUI* ui) {
+	robtk_xydraw_set_surface(ui->xyp, NULL);
+	if (ui->spect_ann) {
+		cairo_surface_destroy (ui->spect_ann);
+	}
+	ui->spect_ann = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, DAWIDTH, DAWIDTH);
+	cairo_t* cr = cairo_create (ui->spect_ann);
+
+	CairoSetSouerceRGBA(c_bg);
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle (cr, 0, 0, DAWIDTH, DAHEIGHT);
+	cairo_fill (cr);
+
+	cairo_save(cr);
+	rounded_rectangle (cr, 10, 10, DAWIDTH - 20, DAHEIGHT - 20, 10);
+	CairoSetSouerceRGBA(c_blk);
+	cairo_fill_preserve(cr);
+	cairo_clip(cr);
+	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+#if 0
+	{
+		float y0 = 10 + (DAHEIGHT - 20.) * 70 / 92.;
+		float y1 = 10 + (DAHEIGHT - 20.) * 92 / 92.;
+		cairo_set_source_rgba(cr, 0.2, 0.2, 0.4, 0.5);
+		cairo_rectangle (cr, 0, y0, DAWIDTH, y1-y0);
+		cairo_fill(cr);
+	}
+#endif
+
+	cairo_set_line_width (cr, 1.0);
+	cairo_set_source_rgba(cr, 0.2, 0.2, 0.2, 1.0);
+	for (float dB = 6; dB < 92; dB += 6) {
+		char tmp[16];
+		const double dash[] = {3.0, 1.5};
+		cairo_set_dash(cr, dash, 2, 0);
+		sprintf(tmp, "%+0.0fdB", -dB);
+		float y = 10 + (DAHEIGHT - 20.) * dB / 92.;
+		cairo_move_to(cr, 10, rintf(y) + .5);
+		cairo_line_to(cr, DAWIDTH - 10, rintf(y) + .5);
+		cairo_stroke(cr);
+		write_text_full(cr, tmp, ui->font[F_M_SMALL],
+				DAWIDTH - 15, y, 0, 1, c_g60);
+	}
+
+	if (ui->zoom) {
+		/* +-100 cent around the note */
+		for (int ct = -90; ct < 100; ct += 10) {
+			float x = 10 + (DAWIDTH - 20.) * (ct + 100) / 200.;
+			const double dash[] = {1.5};
+			if (ct % 50) {
+				cairo_set_dash(cr, dash, 1, 0);
+			} else {
+				cairo_set_dash(cr, NULL, 0, 0);
+			}
+
+			cairo_move_to(cr, rintf(x) - .5, 10);
+			cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
+			cairo_stroke(cr);
+
+			if (ct % 50 == 0) {
+				char tmp[16];
+				sprintf(tmp, "%+dct", ct);
+				write_text_full(cr, tmp, ui->font[F_M_SMALL],
+						x, 10, 1.5 * M_PI, 1, c_g60);
+			}
+		}
+	} else if (ui->constq) {
+		/* solid lines at A, dashed every 3 semitones */
+		for (int st = 3; st < 12 * SPEC_LOG_OCT; st += 3) {
+			const float fq = SPEC_LOG_FMIN * exp2f(st / 12.f);
+			float x = 10 + (DAWIDTH - 20.) * spectrum_x(ui, fq);
+			const double dash[] = {1.5};
+			if (st % 12) {
+				cairo_set_dash(cr, dash, 1, 0);
+			} else {
+				cairo_set_dash(cr, NULL, 0, 0);
+			}
+
+			cairo_move_to(cr, rintf(x) - .5, 10);
+			cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
+			cairo_stroke(cr);
+
+			if (st % 12 == 0) {
+				char tmp[16];
+				if (fq < 1000.0) {
+					sprintf(tmp, "%.0fHz", fq);
+				} else {
+					sprintf(tmp, "%0.1fkHz", fq/1000.0);
+				}
+				write_text_full(cr, tmp, ui->font[F_M_SMALL],
+						x, 10, 1.5 * M_PI, 1, c_g60);
+			}
+		}
+	} else {
+		for (int fq = 50; fq < 1500; fq += 50) {
+			float x = 10 + (DAWIDTH - 20.) * fq / 1500.;
+			const double dash[] = {1.5};
+			if (fq%100) {
+				cairo_set_dash(cr, dash, 1, 0);
+			} else {
+				cairo_set_dash(cr, NULL, 0, 0);
+			}
+
+			cairo_move_to(cr, rintf(x) - .5, 10);
+			cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
+			cairo_stroke(cr);
+
+			if (fq%100 == 0 && fq <= 1300) {
+				char tmp[16];
+				if (fq < 1000.0) {
+					sprintf(tmp, "%dHz", fq);
+				} else {
+					sprintf(tmp, "%0.1fkHz", fq/1000.0);
+				}
+				write_text_full(cr, tmp, ui->font[F_M_SMALL],
+						x, 10, 1.5 * M_PI, 1, c_g60);
+			}
+		}
+	}
+	cairo_restore(cr);
+	cairo_destroy(cr);
+	robtk_xydraw_set_surface(ui->xyp, ui->spect_ann);
+}
+
 static void render_frontface(TunaUI* ui) {
 	cairo_t *cr;
 	if (!ui->frontface) {
@@ -410,79 +705,7 @@ static void render_frontface(TunaUI* ui) {
 
 	cairo_destroy(cr);
 
-	/* draw spectrogram faceplate */
-
-	robtk_xydraw_set_surface(ui->xyp, NULL);
-	if (ui->spect_ann) {
-		cairo_surface_destroy (ui->spect_ann);
-	}
-	ui->spect_ann = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, DAWIDTH, DAWIDTH);
-	cr = cairo_create (ui->spect_ann);
-
-	CairoSetSouerceRGBA(c_bg);
-	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-	cairo_rectangle (cr, 0, 0, DAWIDTH, DAHEIGHT);
-	cairo_fill (cr);
-
-	cairo_save(cr);
-	rounded_rectangle (cr, 10, 10, DAWIDTH - 20, DAHEIGHT - 20, 10);
-	CairoSetSouerceRGBA(c_blk);
-	cairo_fill_preserve(cr);
-	cairo_clip(cr);
-	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-
-#if 0
-	{
-		float y0 = 10 + (DAHEIGHT - 20.) * 70 / 92.;
-		float y1 = 10 + (DAHEIGHT - 20.) * 92 / 92.;
-		cairo_set_source_rgba(cr, 0.2, 0.2, 0.4, 0.5);
-		cairo_rectangle (cr, 0, y0, DAWIDTH, y1-y0);
-		cairo_fill(cr);
-	}
-#endif
-
-	cairo_set_line_width (cr, 1.0);
-	cairo_set_source_rgba(cr, 0.2, 0.2, 0.2, 1.0);
-	for (float dB = 6; dB < 92; dB += 6) {
-		char tmp[16];
-		const double dash[] = {3.0, 1.5};
-		cairo_set_dash(cr, dash, 2, 0);
-		sprintf(tmp, "%+0.0fdB", -dB);
-		float y = 10 + (DAHEIGHT - 20.) * dB / 92.;
-		cairo_move_to(cr, 10, rintf(y) + .5);
-		cairo_line_to(cr, DAWIDTH - 10, rintf(y) + .5);
-		cairo_stroke(cr);
-		write_text_full(cr, tmp, ui->font[F_M_SMALL],
-				DAWIDTH - 15, y, 0, 1, c_g60);
-	}
-
-	for (int fq = 50; fq < 1500; fq += 50) {
-		float x = 10 + (DAWIDTH - 20.) * fq / 1500.;
-		const double dash[] = {1.5};
-		if (fq%100) {
-			cairo_set_dash(cr, dash, 1, 0);
-		} else {
-			cairo_set_dash(cr, NULL, 0, 0);
-		}
-
-		cairo_move_to(cr, rintf(x) - .5, 10);
-		cairo_line_to(cr, rintf(x) - .5, DAHEIGHT - 10);
-		cairo_stroke(cr);
-
-		if (fq%100 == 0 && fq <= 1300) {
-			char tmp[16];
-			if (fq < 1000.0) {
-				sprintf(tmp, "%dHz", fq);
-			} else {
-				sprintf(tmp, "%0.1fkHz", fq/1000.0);
-			}
-			write_text_full(cr, tmp, ui->font[F_M_SMALL],
-					x, 10, 1.5 * M_PI, 1, c_g60);
-		}
-	}
-	cairo_restore(cr);
-	cairo_destroy(cr);
-	robtk_xydraw_set_surface(ui->xyp, ui->spect_ann);
+	render_spectrum_faceplate(ui);
 
 	/* meter pattern */
 
@@ -532,9 +755,253 @@ static void render_frontface(TunaUI* ui) {
 
 
 
+/* area covered by a text drawn with write_text_full(), for the
+ * widest text that is shown there. Text sizes depend on the font that
+ * is used, these are measured once the fonts are known */
+static void text_area(cairo_rectangle_t* a, PangoFontDescription* font, const char* txt,
+		float x, float y, int align) {
+	PangoRectangle ink, log;
+	cairo_surface_t* tmp = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+	cairo_t* cr = cairo_create (tmp);
+	PangoLayout* pl = pango_cairo_create_layout (cr);
+	pango_layout_set_font_description (pl, font);
+	pango_layout_set_text (pl, txt, -1);
+	pango_layout_get_pixel_extents (pl, &ink, &log);
+	g_object_unref (pl);
+	cairo_destroy (cr);
+	cairo_surface_destroy (tmp);
+
+	/* layout origin, 1..3: right, center, left -- middle; 5: center, bottom */
+	double x0 = rintf(x);
+	double y0 = rintf(y) + ceil(log.height / -2.0);
+	switch (align) {
+		case 1: x0 -= log.width; break;
+		case 2: x0 += ceil(log.width / -2.0); break;
+		case 5: x0 += ceil(log.width / -2.0); y0 = rintf(y) - log.height; break;
+		default: break;
+	}
+	/* the ink may exceed the logical extents, allow for rounding and antialiasing */
+	const int x1 = MAX(log.x + log.width, ink.x + ink.width);
+	const int y1 = MAX(log.y + log.height, ink.y + ink.height);
+	const int xo = MIN(log.x, ink.x);
+	const int yo = MIN(log.y, ink.y);
+	a->x      = floor(x0) + xo - 2;
+	a->y      = floor(y0) + yo - 2;
+	a->width  = x1 - xo + 4;
+	a->height = y1 - yo + 4;
+}
+
+static void area_union(cairo_rectangle_t* a, const cairo_rectangle_t* b) {
+	const double x1 = MAX(a->x + a->width, b->x + b->width);
+	const double y1 = MAX(a->y + a->height, b->y + b->height);
+	a->x = MIN(a->x, b->x);
+	a->y = MIN(a->y, b->y);
+	a->width  = x1 - a->x;
+	a->height = y1 - a->y;
+}
+
+/* areas of the individually redrawn elements, a superset of what
+ * expose_event() draws there */
+static void layout_areas(TunaUI* ui) {
+	cairo_rectangle_t* a = ui->d_area;
+	cairo_rectangle_t nosig;
+	text_area(&a[D_NOTE], ui->font[F_M_HUGE], "C#-1", L_NFO_XL, L_NFO_YC, 3);
+	text_area(&a[D_CENT], ui->font[F_M_MED], "-99.99\u00A2", L_NFO_XC, L_NFO_YC, 1);
+	text_area(&a[D_TUNE], ui->font[F_M_SMALL], "00000.00Hz @ 000.0Hz", L_TUN_XC, L_TUN_YC, 2);
+	text_area(&a[D_FOOT], ui->font[F_M_MED], "00000.00Hz", L_FOO_XC, L_FOO_YB, 5);
+	text_area(&nosig, ui->font[F_M_MED], " -- no signal -- ", L_FOO_XC, L_FOO_YB, 5);
+	area_union(&a[D_FOOT], &nosig);
+
+	/* the cent bar starts half a pixel left of the center */
+	a[D_CNTBAR] = (cairo_rectangle_t) { L_BAR_X - 1, L_CNT_YT, L_BAR_W + 2, L_CNT_H };
+	a[D_STROBE] = (cairo_rectangle_t) { L_BAR_X, L_STB_YC - 8, L_BAR_W, 16 };
+	a[D_LEVEL]  = (cairo_rectangle_t) { L_BAR_X, L_LVL_YT, L_BAR_W, L_LVL_H };
+	a[D_ERROR]  = (cairo_rectangle_t) { L_BAR_X, L_ERR_YT, L_BAR_W, L_ERR_H };
+}
+
+/* threshold of visible changes [px] */
+#define D_MIN_PX (.25f)
+
+static bool px_changed (float a, float b) {
+	return fabsf(a - b) >= D_MIN_PX;
+}
+
+static void invalidate (TunaUI* ui, int d) {
+	const cairo_rectangle_t* a = &ui->d_area[d];
+	queue_draw_area(ui->darea, a->x, a->y, a->width, a->height);
+}
+
+/* compute the display from the current values, and invalidate
+ * the areas that changed. Calls coalesce until the next expose */
+static void update_display(TunaUI* ui) {
+	TunaDisplay* d = &ui->dpy;
+	char txt[64];
+	const float tuning = robtk_spin_get_value(ui->spb_tuning);
+
+	/* HUGE info: note, ocatave, cent */
+	snprintf(txt, 16, "%-2s%.0f", notename[(int)ui->p_note], ui->p_octave);
+	if (strcmp(txt, d->note)) {
+		strcpy(d->note, txt);
+		invalidate(ui, D_NOTE);
+	}
+
+	if (fabsf(ui->s_cent) < 100) {
+		snprintf(txt, 16, "%+6.2f\u00A2", ui->s_cent);
+	} else {
+		txt[0] = '\0';
+	}
+	if (strcmp(txt, d->cent)) {
+		strcpy(d->cent, txt);
+		invalidate(ui, D_CENT);
+	}
+
+	/* settings, the note's frequency on the current scale is reported by the plugin */
+	if (ui->p_target > 0) {
+		snprintf(txt, 32, "%7.2fHz @ %5.1fHz", ui->p_target, tuning);
+	} else {
+		snprintf(txt, 32, "@ %5.1fHz", tuning);
+	}
+	if (strcmp(txt, d->tune)) {
+		strcpy(d->tune, txt);
+		invalidate(ui, D_TUNE);
+	}
+
+	/* footer, Frequency || no-signal */
+	const bool signal = ui->p_freq > 0;
+	if (signal) {
+		snprintf(txt, 32, "%.2fHz", ui->p_freq);
+	} else {
+		strcpy(txt, " -- no signal -- ");
+	}
+	if (signal != d->signal || strcmp(txt, d->foot)) {
+		strcpy(d->foot, txt);
+		invalidate(ui, D_FOOT);
+	}
+
+	/* cent bar graph, at most half the bar (50ct) to either side */
+	const float cent_w = signal ? L_BAR_W * MAX(-.5f, MIN(.5f, ui->s_cent / 100.f)) : 0;
+	const bool cent_ok = fabsf(ui->s_cent) <= 5.0;
+	if (signal != d->signal || cent_ok != d->cent_ok || px_changed(cent_w, d->cent_w)) {
+		d->cent_ok = cent_ok;
+		d->cent_w  = cent_w;
+		invalidate(ui, D_CNTBAR);
+	}
+	d->signal = signal;
+
+	/* level bar graph */
+	const float level_w = deflect(ui->s_rms) > 4 ? deflect(ui->s_rms + 6.0) : 0;
+	if (px_changed(level_w, d->level_w)) {
+		d->level_w = level_w;
+		invalidate(ui, D_LEVEL);
+	}
+
+	/* accuracy bar graph */
+	int   err_cls;
+	float err_w;
+	if (!signal) {
+		err_cls = E_NONE;
+		err_w = 0;
+	} else if (fabsf(ui->s_error) < 10) {
+		err_cls = E_LOCKED;
+		err_w = fabsf(ui->s_error) > 2 ? L_BAR_W * ui->s_error / 150.0 : 0;
+	} else if (ui->s_error > -25 && ui->s_error < 25) {
+		/* normal range -50..+50 blue */
+		err_cls = E_CLOSE;
+		err_w = L_BAR_W * ui->s_error / 150.0;
+	} else if (ui->s_error > -50 && ui->s_error < 50) {
+		/* normal range -50..+50 yellow*/
+		err_cls = E_NEAR;
+		err_w = L_BAR_W * ui->s_error / 150.0;
+	} else if (ui->s_error > -100 && ui->s_error < 100) {
+		/* out of phase */
+		err_cls = E_PHASE;
+		err_w = L_BAR_W * ((ui->s_error + ((ui->s_error>0)?33.3:-33.3)) / 266.6);
+	} else {
+		err_cls = E_RANGE;
+		err_w = L_BAR_W * (ui->s_error > 0 ? .5 : -.5);
+	}
+	if (err_cls != d->err_cls || px_changed(err_w, d->err_w)) {
+		d->err_cls = err_cls;
+		d->err_w   = err_w;
+		invalidate(ui, D_ERROR);
+	}
+
+	/* strobe */
+	ui->strobe_hl = false;
+	if (ui->strobe_dpy != ui->strobe_tme) {
+		if (ui->strobe_tme > ui->strobe_dpy) {
+			float tdiff = ui->strobe_tme - ui->strobe_dpy;
+			ui->strobe_phase += tdiff * ui->p_cent * 4;
+			ui->strobe_hl = true;
+		}
+		ui->strobe_dpy = ui->strobe_tme;
+	}
+	/* the fine dash moves twice as fast */
+	if (ui->strobe_hl != d->strobe_hl || px_changed(2.f * ui->strobe_phase, 2.f * d->strobe_phase)) {
+		d->strobe_hl    = ui->strobe_hl;
+		d->strobe_phase = ui->strobe_phase;
+		invalidate(ui, D_STROBE);
+	}
+}
+
+/* smooth the values received since the last tick over `dt` seconds,
+ * and update the display */
+static void ui_tick(TunaUI* ui, float dt) {
+	dt = MIN(dt, .5f);
+
+	if (ui->p_freq <= 0) {
+		ui->s_cent = 0;
+	} else {
+		ui->s_cent += (1.f - expf(-dt / TAU_CENT)) * (ui->p_cent - ui->s_cent) + 1e-12;
+	}
+
+	if (ui->p_rms < -90) {
+		ui->s_rms = -90;
+	} else {
+		ui->s_rms += (1.f - expf(-dt / TAU_RMS)) * (ui->p_rms - ui->s_rms) + 1e-12;
+	}
+
+	if (ui->p_error == 0) {
+		ui->s_error = 0;
+	} else {
+		ui->s_error += (1.f - expf(-dt / TAU_ERROR)) * (ui->p_error - ui->s_error) + 1e-12;
+	}
+
+	update_display(ui);
+}
+
+static double ui_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* called for every port event. The display is clocked by the wall-clock,
+ * at most UI_FPS times per second, independent of how often the host
+ * delivers port events. When the note is lost the host may stop sending
+ * events (nothing changes during silence), so all events of the following
+ * frame are displayed right away, until the final state is drawn */
+static void ui_poll(TunaUI* ui, bool lost) {
+	const double t = ui_clock();
+	if (lost) {
+		ui->flush_tme = t + 1.f / UI_FPS;
+	}
+	if (t < ui->flush_tme || t - ui->tick_tme >= 1.f / UI_FPS) {
+		ui_tick(ui, t - ui->tick_tme);
+		ui->tick_tme = t;
+	}
+}
+
+static bool exposed(const TunaUI* ui, const cairo_rectangle_t *ev, int d) {
+	const cairo_rectangle_t* a = &ui->d_area[d];
+	return ev->x < a->x + a->width && a->x < ev->x + ev->width
+		&& ev->y < a->y + a->height && a->y < ev->y + ev->height;
+}
+
 static bool expose_event(RobWidget* handle, cairo_t* cr, cairo_rectangle_t *ev)
 {
 	TunaUI* ui = (TunaUI*) GET_HANDLE(handle);
+	const TunaDisplay* d = &ui->dpy;
 
 	/* limit cairo-drawing to exposed area */
 	cairo_rectangle (cr, ev->x, ev->y, ev->width, ev->height);
@@ -543,162 +1010,165 @@ static bool expose_event(RobWidget* handle, cairo_t* cr, cairo_rectangle_t *ev)
 	cairo_paint (cr);
 
 	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-	char txt[255];
-	const float tuning = robtk_spin_get_value(ui->spb_tuning);
 
+	/* only widgets inside the exposed area, the text layout is expensive */
+	if (exposed(ui, ev, D_NOTE)) {
+		write_text_full(cr, d->note, ui->font[F_M_HUGE], L_NFO_XL, L_NFO_YC, 0, 3, c_wht);
+	}
 
-	/* HUGE info: note, ocatave, cent */
-	snprintf(txt, 255, "%-2s%.0f", notename[(int)ui->p_note], ui->p_octave);
-	write_text_full(cr, txt, ui->font[F_M_HUGE], L_NFO_XL, L_NFO_YC, 0, 3, c_wht);
-
-	if (fabsf(ui->s_cent) < 100) {
-		snprintf(txt, 255, "%+6.2f\u00A2", ui->s_cent);
-		write_text_full(cr, txt, ui->font[F_M_MED], L_NFO_XC, L_NFO_YC, 0, 1, c_wht);
+	if (exposed(ui, ev, D_CENT) && d->cent[0]) {
+		write_text_full(cr, d->cent, ui->font[F_M_MED], L_NFO_XC, L_NFO_YC, 0, 1, c_wht);
 	}
 
-	float note = ui->p_note + (ui->p_octave+1) * 12.f;
-	if (note >= 0 && note < 128) {
-		const float note_freq = tuning * powf(2.0, (note - 69.f) / 12.f);
-		snprintf(txt, 255, "%7.2fHz @ %5.1fHz", note_freq, tuning);
-	} else {
-		snprintf(txt, 255, "@ %5.1fHz\n", tuning);
+	if (exposed(ui, ev, D_TUNE)) {
+		write_text_full(cr, d->tune, ui->font[F_M_SMALL], L_TUN_XC, L_TUN_YC, 0, 2, c_wht);
 	}
-	/* settings */
-	write_text_full(cr, txt, ui->font[F_M_SMALL], L_TUN_XC, L_TUN_YC, 0, 2, c_wht);
 
-	/* footer, Frequency || no-signal */
-	if (ui->p_freq > 0) {
-		snprintf(txt, 255, "%.2fHz", ui->p_freq );
-		write_text_full(cr, txt,
-				ui->font[F_M_MED], L_FOO_XC, L_FOO_YB, 0, 5, c_wht);
-		//write_text_full(cr, txt, ui->font[F_M_MED], L_NFO_XC, L_TUN_YC, 0, 4, c_wht);
-	} else {
-		write_text_full(cr, " -- no signal -- ",
-				ui->font[F_M_MED], L_FOO_XC, L_FOO_YB, 0, 5, c_g60);
+	if (exposed(ui, ev, D_FOOT)) {
+		write_text_full(cr, d->foot,
+				ui->font[F_M_MED], L_FOO_XC, L_FOO_YB, 0, 5, d->signal ? c_wht : c_g60);
 	}
 
 	/* cent bar graph */
-	if (ui->p_freq > 0) {
-		if (fabsf(ui->s_cent) <= 5.0) {
+	if (exposed(ui, ev, D_CNTBAR) && d->signal) {
+		if (d->cent_ok) {
 			cairo_set_source_rgba (cr, .0, .8, .0, .7);
 		} else {
 			cairo_set_source_rgba (cr, .8, .0, .0, .7);
 		}
-		cairo_rectangle (cr, L_CNT_XC -.5, L_CNT_YT,
-				L_BAR_W * ui->s_cent / 100., L_CNT_H);
+		cairo_rectangle (cr, L_CNT_XC -.5, L_CNT_YT, d->cent_w, L_CNT_H);
 		cairo_fill(cr);
-#if 0
-		if (fabsf(ui->s_cent) <= 5.0) {
-			/* cent triangles */
-			cairo_set_line_width(cr, 1.0);
-			float x1 = rint(L_CNT_XC - L_BAR_W *.05) -.5;
-			float x2 = rint(L_CNT_XC - L_BAR_W *.05 - L_CNT_H *.7) -.5;
-			cairo_move_to(cr, x1, L_CNT_YT + L_CNT_H *.5);
-			cairo_line_to(cr, x2, L_CNT_YT );
-			cairo_line_to(cr, x2, L_CNT_YT + L_CNT_H);
-			cairo_close_path(cr);
-			cairo_fill_preserve(cr);
-			CairoSetSouerceRGBA(c_blk);
-			cairo_stroke(cr);
-
-			x1 = rint(L_CNT_XC + L_BAR_W *.05) +.5;
-			x2 = rint(L_CNT_XC + L_BAR_W *.05 + L_CNT_H *.7) +.5;
-			cairo_set_source_rgba (cr, .0, .8, .0, .7);
-			cairo_move_to(cr, x1, L_CNT_YT + L_CNT_H *.5);
-			cairo_line_to(cr, x2, L_CNT_YT );
-			cairo_line_to(cr, x2, L_CNT_YT + L_CNT_H);
-			cairo_close_path(cr);
-			cairo_fill_preserve(cr);
-			CairoSetSouerceRGBA(c_blk);
-			cairo_stroke(cr);
-		}
-#endif
 	}
 
 	/* level bar graph */
-	float level = deflect(ui->s_rms);
-	if (level > 4) {
+	if (exposed(ui, ev, D_LEVEL) && d->level_w > 0) {
 		cairo_set_source(cr, ui->meterpattern);
-		rounded_rectangle (cr, L_BAR_X, L_LVL_YT, deflect(ui->s_rms + 6.0), L_LVL_H, 3);
+		rounded_rectangle (cr, L_BAR_X, L_LVL_YT, d->level_w, L_LVL_H, 3);
 		cairo_fill(cr);
 	}
 
 	/* accuracy bar graph */
-	if (ui->p_freq == 0) {
-		; // no data
-	} else if (fabsf(ui->s_error) < 10) {
-		cairo_set_source_rgba (cr, .0, .8, .0, .4);
-		rounded_rectangle (cr, L_CNT_XC-40, L_ERR_YT, 80, L_ERR_H, 4);
-		cairo_fill(cr);
-		if (fabsf(ui->s_error) > 2) {
-			cairo_set_source_rgba (cr, .0, .0, .9, .2);
-			cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-					L_BAR_W * ui->s_error / 150.0, L_ERR_H);
+	if (exposed(ui, ev, D_ERROR)) {
+		switch (d->err_cls) {
+			case E_LOCKED:
+				cairo_set_source_rgba (cr, .0, .8, .0, .4);
+				rounded_rectangle (cr, L_CNT_XC-40, L_ERR_YT, 80, L_ERR_H, 4);
+				cairo_fill(cr);
+				cairo_set_source_rgba (cr, .0, .0, .9, .2);
+				break;
+			case E_CLOSE:
+				cairo_set_source_rgba (cr, .2, .3, .9, .7);
+				break;
+			case E_NEAR:
+				cairo_set_source_rgba (cr, .6, .6, .2, .7);
+				break;
+			case E_PHASE:
+				cairo_set_source_rgba (cr, .9, .3, .2, .7);
+				break;
+			case E_RANGE:
+				cairo_set_source_rgba (cr, .9, .0, .0, .7);
+				break;
+			default:
+				break;
+		}
+		if (d->err_cls != E_NONE && d->err_w != 0) {
+			cairo_rectangle (cr, L_CNT_XC, L_ERR_YT, d->err_w, L_ERR_H);
 			cairo_fill(cr);
 		}
-	} else if (ui->s_error > -25 && ui->s_error < 25) {
-		/* normal range -50..+50 blue */
-		cairo_set_source_rgba (cr, .2, .3, .9, .7);
-		cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-				L_BAR_W * ui->s_error / 150.0, L_ERR_H);
-		cairo_fill(cr);
-	} else if (ui->s_error > -50 && ui->s_error < 50) {
-		/* normal range -50..+50 yellow*/
-		cairo_set_source_rgba (cr, .6, .6, .2, .7);
-		cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-				L_BAR_W * ui->s_error / 150.0, L_ERR_H);
-		cairo_fill(cr);
-	} else if (ui->s_error > -100 && ui->s_error < 100) {
-		/* out of phase */
-		cairo_set_source_rgba (cr, .9, .3, .2, .7);
-		cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-				L_BAR_W * ((ui->s_error + ((ui->s_error>0)?33.3:-33.3)) / 266.6), L_ERR_H);
-		cairo_fill(cr);
-	} else if (ui->s_error >= 100) {
-		cairo_set_source_rgba (cr, .9, .0, .0, .7);
-		cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-				L_BAR_W * .5 , L_ERR_H);
-		cairo_fill(cr);
-	} else if (ui->s_error <= -100) {
-		cairo_set_source_rgba (cr, .9, .0, .0, .7);
-		cairo_rectangle (cr, L_CNT_XC, L_ERR_YT,
-				L_BAR_W * -.5 , L_ERR_H);
-		cairo_fill(cr);
 	}
 
-	/* strobe setup */
-	cairo_set_source_rgba (cr, .5, .5, .5, .8);
-	if (ui->strobe_dpy != ui->strobe_tme) {
-		if (ui->strobe_tme > ui->strobe_dpy) {
-			float tdiff = ui->strobe_tme - ui->strobe_dpy;
-			ui->strobe_phase += tdiff * ui->p_cent * 4;
+	/* render strobe */
+	if (exposed(ui, ev, D_STROBE)) {
+		if (d->strobe_hl) {
 			cairo_set_source_rgba (cr, .8, .8, .0, .8);
+		} else {
+			cairo_set_source_rgba (cr, .5, .5, .5, .8);
 		}
-		ui->strobe_dpy = ui->strobe_tme;
+		cairo_save(cr);
+		const double dash1[] = {8.0};
+		const double dash2[] = {16.0};
+
+		cairo_set_dash(cr, dash1, 1, d->strobe_phase * -2.);
+		cairo_set_line_width(cr, 8.0);
+		cairo_move_to(cr, 20, L_STB_YC);
+		cairo_line_to(cr, DAWIDTH-20, L_STB_YC);
+		cairo_stroke (cr);
+
+		cairo_set_dash(cr, dash2, 1, -d->strobe_phase);
+		cairo_set_line_width(cr, 16.0);
+		cairo_move_to(cr, 20, L_STB_YC);
+		cairo_line_to(cr, DAWIDTH-20, L_STB_YC);
+		cairo_stroke (cr);
+		cairo_restore(cr);
 	}
 
-	/* render strobe */
-	cairo_save(cr);
-	const double dash1[] = {8.0};
-	const double dash2[] = {16.0};
-
-	cairo_set_dash(cr, dash1, 1, ui->strobe_phase * -2.);
-	cairo_set_line_width(cr, 8.0);
-	cairo_move_to(cr, 20, L_STB_YC);
-	cairo_line_to(cr, DAWIDTH-20, L_STB_YC);
-	cairo_stroke (cr);
-
-	cairo_set_dash(cr, dash2, 1, -ui->strobe_phase);
-	cairo_set_line_width(cr, 16.0);
-	cairo_move_to(cr, 20, L_STB_YC);
-	cairo_line_to(cr, DAWIDTH-20, L_STB_YC);
-	cairo_stroke (cr);
-	cairo_restore(cr);
+	return TRUE;
+}
 
+#ifdef TUNA_PROFILE
+/******************************************************************************
+ * DSP profile
+ */
 
-	return TRUE;
+static const float* prof_vector(TunaUI* ui, const LV2_Atom* a, LV2_URID type) {
+	if (!a || a->type != ui->uris.atom_Vector) {
+		return NULL;
+	}
+	LV2_Atom_Vector* vof = (LV2_Atom_Vector*)LV2_ATOM_BODY(a);
+	if (vof->atom.type != type || (a->size - sizeof(LV2_Atom_Vector_Body)) / vof->atom.size < TP_LAST) {
+		return NULL;
+	}
+	return (const float*) LV2_ATOM_BODY(&vof->atom);
 }
 
+static void update_profile(TunaUI* ui, const LV2_Atom_Object* obj) {
+	static const char* stage_name[TP_LAST] = {
+		"run", "fft", " window", " analyze", "note", "filter", "dll"
+	};
+	const LV2_Atom *a_unit = NULL;
+	const LV2_Atom *a_min = NULL, *a_avg = NULL, *a_max = NULL, *a_hist = NULL;
+	lv2_atom_object_get(obj,
+			ui->uris.prof_unit, &a_unit,
+			ui->uris.prof_min,  &a_min,
+			ui->uris.prof_avg,  &a_avg,
+			ui->uris.prof_max,  &a_max,
+			ui->uris.prof_hist, &a_hist,
+			NULL);
+
+	const float*   p_min  = prof_vector(ui, a_min, ui->uris.atom_Float);
+	const float*   p_avg  = prof_vector(ui, a_avg, ui->uris.atom_Float);
+	const float*   p_max  = prof_vector(ui, a_max, ui->uris.atom_Float);
+	const int32_t* p_hist = (const int32_t*) prof_vector(ui, a_hist, ui->uris.atom_Int);
+	if (!a_unit || a_unit->type != ui->uris.atom_Int || !p_min || !p_avg || !p_max || !p_hist) {
+		return;
+	}
+	const bool cycles = ((LV2_Atom_Int*)a_unit)->body == 1;
+
+	char txt[1024];
+	int off = snprintf(txt, sizeof(txt), "DSP [%s]  min / avg / p95 / max\n", cycles ? "kcycles" : "usec");
+	for (int i = 0; i < TP_LAST && off < (int)sizeof(txt); ++i) {
+		/* 95th percentile: upper bound of the histogram bin */
+		const int32_t* hist = &p_hist[i * TUNA_PROF_BINS];
+		int32_t n = 0, acc = 0;
+		for (int b = 0; b < TUNA_PROF_BINS; ++b) {
+			n += hist[b];
+		}
+		int b95 = 0;
+		for (; b95 < TUNA_PROF_BINS - 1; ++b95) {
+			acc += hist[b95];
+			if (acc >= .95 * n) break;
+		}
+		const float p95 = MIN(p_max[i], (float)(1ULL << (b95 + TUNA_PROF_BIN0 + 1)));
+
+		off += snprintf(&txt[off], sizeof(txt) - off, "%-8s %.1f / %.1f / %.1f / %.1f%s",
+				stage_name[i],
+				p_min[i] * 1e-3, p_avg[i] * 1e-3, p95 * 1e-3, p_max[i] * 1e-3,
+				i + 1 < TP_LAST ? "\n" : "");
+	}
+	robtk_lbl_set_text(ui->lbl_prof, txt);
+}
+#endif
+
 /******************************************************************************
  * UI callbacks
  */
@@ -711,6 +1181,9 @@ static bool cb_disp_changed (RobWidget* handle, void *data) {
 			robwidget_hide(ui->spb_debug[i]->rw, false);
 			robwidget_hide(ui->lbl_debug[i]->rw, false);
 		}
+#ifdef TUNA_PROFILE
+		robwidget_hide(ui->lbl_prof->rw, false);
+#endif
 		for (uint32_t i = 0; i < 4; ++i) {
 			robwidget_show(ui->label[i]->rw, false);
 		}
@@ -735,6 +1208,12 @@ static bool cb_disp_changed (RobWidget* handle, void *data) {
 			robwidget_show(ui->spb_debug[i]->rw, false);
 			robwidget_show(ui->lbl_debug[i]->rw, false);
 		}
+#ifdef TUNA_PROFILE
+#ifdef GTK_BACKEND
+		gtk_widget_set_no_show_all(ui->lbl_prof->rw->c, false);
+#endif
+		robwidget_show(ui->lbl_prof->rw, false);
+#endif
 		for (uint32_t i = 0; i < 4; ++i) {
 			robwidget_hide(ui->label[i]->rw, false);
 		}
@@ -784,7 +1263,7 @@ static bool cb_set_tuning (RobWidget* handle, void *data) {
 		float val = robtk_spin_get_value(ui->spb_tuning);
 		ui->write(ui->controller, TUNA_TUNING, sizeof(float), 0, (const void*) &val);
 	}
-	queue_draw(ui->darea);
+	update_display(ui);
 	return TRUE;
 }
 
@@ -826,10 +1305,197 @@ static void ui_enable(LV2UI_Handle handle)
 	LV2_Atom_Forge_Frame frame;
 	lv2_atom_forge_frame_time(&ui->forge, 0);
 	LV2_Atom* msg = (LV2_Atom*)x_forge_object(&ui->forge, &frame, 1, ui->uris.ui_on);
+	lv2_atom_forge_property_head(&ui->forge, ui->uris.ui_zoom, 0);
+	lv2_atom_forge_int(&ui->forge, ui->zoom ? 1 : 0);
 	lv2_atom_forge_pop(&ui->forge, &frame);
 	ui->write(ui->controller, 0, lv2_atom_total_size(msg), ui->uris.atom_eventTransfer, msg);
 }
 
+static bool cb_zoom (RobWidget* handle, void *data) {
+	TunaUI* ui = (TunaUI*) (data);
+	ui->zoom = robtk_cbtn_get_active(ui->btn_zoom);
+	ui->zoom_fc = 0;
+	ui->zoom_level = -INFINITY;
+	set_spectrum_mapping(ui);
+	robtk_xydraw_set_points(ui->xyp, 0, NULL, NULL);
+	render_spectrum_faceplate(ui);
+	/* ask the plugin to send the zoomed spectrum instead */
+	ui_enable(ui);
+	return TRUE;
+}
+
+/* colors of the waterfall, quantized dB, see tuna_spec_dB() */
+static void wf_colormap(TunaUI* ui) {
+	static const float stop[5][4] = {
+		/* pos, r, g, b */
+		{ 0.00, .0, .0, .0 },
+		{ 0.35, .1, .1, .6 },
+		{ 0.60, .8, .1, .3 },
+		{ 0.80, 1., .6, .0 },
+		{ 1.00, 1., 1., .8 },
+	};
+	ui->wf_lut[0] = 0;
+	for (int q = 1; q < 256; ++q) {
+		const float v = MIN(1.f, -(tuna_spec_dB(q) - TUNA_SPEC_FLOOR) / TUNA_SPEC_FLOOR);
+		int i = 0;
+		while (i < 3 && v > stop[i + 1][0]) ++i;
+		const float a = (v - stop[i][0]) / (stop[i + 1][0] - stop[i][0]);
+		uint32_t rgb = 0;
+		for (int c = 1; c < 4; ++c) {
+			const float cc = stop[i][c] + a * (stop[i + 1][c] - stop[i][c]);
+			rgb = (rgb << 8) | (uint32_t) rintf(255.f * MAX(0.f, MIN(1.f, cc)));
+		}
+		ui->wf_lut[q] = rgb;
+	}
+}
+
+/* clear the history, map pixel columns to bins of the current grid */
+static void wf_reset(TunaUI* ui) {
+	if (!ui->wf_surf) {
+		return;
+	}
+	cairo_surface_flush(ui->wf_surf);
+	memset(cairo_image_surface_get_data(ui->wf_surf), 0,
+			WF_ROWS * cairo_image_surface_get_stride(ui->wf_surf));
+	cairo_surface_mark_dirty(ui->wf_surf);
+	ui->wf_row = 0;
+
+	for (int x = 0; x < WF_W; ++x) {
+		float b[2];
+		for (int e = 0; e < 2; ++e) {
+			const float rel = (x + e) / (float)WF_W;
+			const float f = ui->constq ? SPEC_LOG_FMIN * exp2f(rel * SPEC_LOG_OCT) : rel * 1500.f;
+			if (ui->spec_bpo > 0) {
+				b[e] = f > 0 ? log2f(f / ui->spec_f0) * ui->spec_bpo : -1;
+			} else {
+				b[e] = ui->spec_df > 0 ? (f - ui->spec_f0) / ui->spec_df : -1;
+			}
+		}
+		/* bins inside the column, or the closest one */
+		int b0 = ceilf(b[0]);
+		int b1 = ceilf(b[1]);
+		if (b1 <= b0) {
+			b0 = rintf(.5f * (b[0] + b[1]));
+			b1 = b0 + 1;
+		}
+		b0 = MAX(0, MIN((int)ui->spec_bins, b0));
+		b1 = MAX(0, MIN((int)ui->spec_bins, b1));
+		ui->wf_b0[x] = b0;
+		ui->wf_b1[x] = b1;
+	}
+}
+
+/* add the received spectrum as newest row, only the row is written */
+static void wf_push(TunaUI* ui) {
+	if (!ui->wf_surf) {
+		return;
+	}
+	ui->wf_row = (ui->wf_row + WF_ROWS - 1) % WF_ROWS;
+
+	cairo_surface_flush(ui->wf_surf);
+	uint32_t* row = (uint32_t*) (cairo_image_surface_get_data(ui->wf_surf)
+			+ ui->wf_row * cairo_image_surface_get_stride(ui->wf_surf));
+	for (int x = 0; x < WF_W; ++x) {
+		uint8_t q = 0;
+		for (uint32_t b = ui->wf_b0[x]; b < ui->wf_b1[x]; ++b) {
+			q = MAX(q, ui->spec_q[b]);
+		}
+		row[x] = ui->wf_lut[q];
+	}
+	cairo_surface_mark_dirty_rectangle(ui->wf_surf, 0, ui->wf_row, WF_W, 1);
+}
+
+static bool cb_waterfall (RobWidget* handle, void *data) {
+	TunaUI* ui = (TunaUI*) (data);
+	ui->waterfall = robtk_cbtn_get_active(ui->btn_waterfall);
+	if (ui->waterfall && !ui->wf_surf) {
+		ui->wf_surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, WF_W, WF_ROWS);
+		wf_reset(ui);
+	}
+	queue_draw(robtk_xydraw_widget(ui->xyp));
+	return TRUE;
+}
+
+/* pass the received spectrum to the plot */
+static void spectrum_points(TunaUI* ui) {
+	float px[TUNA_SPEC_BINS], py[TUNA_SPEC_BINS];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < ui->spec_bins; ++i) {
+		if (ui->spec_q[i] == 0) {
+			continue;
+		}
+		const float f = ui->spec_bpo > 0
+			? ui->spec_f0 * exp2f(i / (float)ui->spec_bpo)
+			: ui->spec_f0 + i * ui->spec_df;
+		px[n] = spectrum_xval(ui, f);
+		py[n] = tuna_spec_dB(ui->spec_q[i]);
+		++n;
+	}
+	robtk_xydraw_set_points(ui->xyp, n, px, py);
+}
+
+/* decode a spectrum message: the changed range of quantized bins */
+static void update_spectrum(TunaUI* ui, const LV2_Atom_Object* obj) {
+	const LV2_Atom *a_f0 = NULL, *a_df = NULL, *a_bpo = NULL;
+	const LV2_Atom *a_bins = NULL, *a_start = NULL, *a_q = NULL;
+	lv2_atom_object_get(obj,
+			ui->uris.spec_f0,    &a_f0,
+			ui->uris.spec_df,    &a_df,
+			ui->uris.spec_bpo,   &a_bpo,
+			ui->uris.spec_bins,  &a_bins,
+			ui->uris.spec_start, &a_start,
+			ui->uris.spec_q,     &a_q,
+			NULL);
+	if (!a_f0 || a_f0->type != ui->uris.atom_Float
+			|| !a_df || a_df->type != ui->uris.atom_Float
+			|| !a_bpo || a_bpo->type != ui->uris.atom_Int
+			|| !a_bins || a_bins->type != ui->uris.atom_Int
+			|| !a_start || a_start->type != ui->uris.atom_Int
+			|| !a_q || a_q->type != ui->uris.atom_Chunk) {
+		return;
+	}
+
+	const float    f0    = ((LV2_Atom_Float*)a_f0)->body;
+	const float    df    = ((LV2_Atom_Float*)a_df)->body;
+	const int32_t  bpo   = ((LV2_Atom_Int*)a_bpo)->body;
+	const uint32_t bins  = MIN(TUNA_SPEC_BINS, MAX(0, ((LV2_Atom_Int*)a_bins)->body));
+	const uint32_t start = MAX(0, ((LV2_Atom_Int*)a_start)->body);
+
+	if (bins != ui->spec_bins || f0 != ui->spec_f0 || df != ui->spec_df || bpo != ui->spec_bpo) {
+		/* different grid, the plugin sends all bins */
+		memset(ui->spec_q, 0, sizeof(ui->spec_q));
+		ui->spec_bins = bins;
+		ui->spec_f0   = f0;
+		ui->spec_df   = df;
+		ui->spec_bpo  = bpo;
+		wf_reset(ui);
+	}
+	if (start < bins) {
+		memcpy(&ui->spec_q[start], LV2_ATOM_BODY_CONST(a_q), MIN(a_q->size, bins - start));
+	}
+	/* one message per analysis, also when nothing changed */
+	if (ui->waterfall) {
+		wf_push(ui);
+	}
+	spectrum_points(ui);
+}
+
+static bool cb_constq (RobWidget* handle, void *data) {
+	TunaUI* ui = (TunaUI*) (data);
+	ui->constq = robtk_cbtn_get_active(ui->btn_constq);
+	set_spectrum_mapping(ui);
+	if (!ui->zoom) {
+		spectrum_points(ui);
+	}
+	wf_reset(ui);
+	render_spectrum_faceplate(ui);
+	if (!ui->disable_signals) {
+		float val = ui->constq ? 1 : 0;
+		ui->write(ui->controller, TUNA_CONSTQ, sizeof(float), 0, (const void*) &val);
+	}
+	return TRUE;
+}
+
 static void
 size_request(RobWidget* handle, int *w, int *h) {
 	//TunaUI* ui = (TunaUI*)GET_HANDLE(handle);
@@ -863,6 +1529,9 @@ static RobWidget * toplevel(TunaUI* ui, void * const top)
 	ui->btnbox  = rob_hbox_new(FALSE, 2);
 	ui->disp[0] = robtk_rbtn_new("Tuning", NULL);
 	ui->disp[1] = robtk_rbtn_new("Debug", robtk_rbtn_group(ui->disp[0]));
+	ui->btn_zoom = robtk_cbtn_new("Zoom", GBT_LED_LEFT, false);
+	ui->btn_constq = robtk_cbtn_new("Const-Q", GBT_LED_LEFT, false);
+	ui->btn_waterfall = robtk_cbtn_new("Waterfall", GBT_LED_LEFT, false);
 
 	ui->sep[0] = robtk_sep_new(TRUE);
 	ui->sep[1] = robtk_sep_new(TRUE);
@@ -892,6 +1561,9 @@ static RobWidget * toplevel(TunaUI* ui, void * const top)
 	ui->lbl_debug[4] = robtk_lbl_new("1st cut  (fund)");
 	ui->lbl_debug[5] = robtk_lbl_new("Filt 1st (fund)");
 	ui->lbl_debug[6] = robtk_lbl_new("Filt Nth (n-1)");
+#ifdef TUNA_PROFILE
+	ui->lbl_prof     = robtk_lbl_new("DSP profile: waiting for data");
+#endif
 
 #define SPIN_DFTNVAL(SPB, VAL) \
 	robtk_spin_set_default(SPB, VAL); \
@@ -962,6 +1634,12 @@ static RobWidget * toplevel(TunaUI* ui, void * const top)
 		rob_hbox_child_pack(ui->btnbox, robtk_rbtn_widget(ui->disp[i]), FALSE, FALSE);
 		robtk_rbtn_set_callback(ui->disp[i], cb_disp_changed, ui);
 	}
+	rob_hbox_child_pack(ui->btnbox, robtk_cbtn_widget(ui->btn_zoom), FALSE, FALSE);
+	robtk_cbtn_set_callback(ui->btn_zoom, cb_zoom, ui);
+	rob_hbox_child_pack(ui->btnbox, robtk_cbtn_widget(ui->btn_constq), FALSE, FALSE);
+	robtk_cbtn_set_callback(ui->btn_constq, cb_constq, ui);
+	rob_hbox_child_pack(ui->btnbox, robtk_cbtn_widget(ui->btn_waterfall), FALSE, FALSE);
+	robtk_cbtn_set_callback(ui->btn_waterfall, cb_waterfall, ui);
 	/* table layout */
 	int row = 0;
 #define TBLADDSS(WIDGET, X0, X1, Y0, Y1) \
@@ -989,6 +1667,14 @@ static RobWidget * toplevel(TunaUI* ui, void * const top)
 			row++;
 			robtk_spin_set_callback(ui->spb_debug[i], cb_set_debug, ui);
 		}
+#ifdef TUNA_PROFILE
+		robtk_lbl_set_alignment(ui->lbl_prof, 0, 0.5);
+		TBLADDES(robtk_lbl_widget(ui->lbl_prof), 0, 2, row, row+1);
+#ifdef GTK_BACKEND
+		gtk_widget_set_no_show_all(ui->lbl_prof->rw->c, true);
+#endif
+		row++;
+#endif
 	}
 
 	TBLADDSS(robtk_lbl_widget(ui->label[0]), 0, 1, row, row+1);
@@ -1034,6 +1720,7 @@ static RobWidget * toplevel(TunaUI* ui, void * const top)
 	ui->font[1] = pango_font_description_from_string("Sans 14px");
 	ui->font[2] = pango_font_description_from_string("Mono 56px");
 	ui->font[3] = pango_font_description_from_string("Mono 11px");
+	layout_areas(ui);
 
 	if (ui->spectr_enable) {
 		robtk_rbtn_set_active(ui->disp[0], TRUE);
@@ -1067,6 +1754,8 @@ instantiate(
 	ui->strobe_dpy = 0;
 	ui->strobe_tme = 0;
 	ui->strobe_phase = 0;
+	ui->tick_tme = ui_clock();
+	ui->flush_tme = 0;
 	ui->s_rms = 0;
 	ui->s_cent = 0;
 	ui->s_error = 0;
@@ -1098,11 +1787,13 @@ instantiate(
 	ui->write      = write_function;
 	ui->controller = controller;
 	map_tuna_uris(ui->map, &ui->uris);
+	wf_colormap(ui);
 	lv2_atom_forge_init(&ui->forge, ui->map);
 	ui->nfo = robtk_info(ui_toplevel);
 
 	*widget = toplevel(ui, ui_toplevel);
 	render_frontface(ui);
+	update_display(ui);
 	ui_enable(ui);
 	return ui;
 }
@@ -1123,6 +1814,9 @@ cleanup(LV2UI_Handle handle)
 	robtk_xydraw_set_surface(ui->xyp, NULL);
 	cairo_surface_destroy (ui->spect_ann);
 	robtk_xydraw_destroy(ui->xyp);
+	if (ui->wf_surf) {
+		cairo_surface_destroy (ui->wf_surf);
+	}
 
 	for (uint32_t i = 0; i < 2; ++i) {
 		robtk_sep_destroy(ui->sep[i]);
@@ -1134,9 +1828,15 @@ cleanup(LV2UI_Handle handle)
 		robtk_spin_destroy(ui->spb_debug[i]);
 		robtk_lbl_destroy(ui->lbl_debug[i]);
 	}
+#ifdef TUNA_PROFILE
+	robtk_lbl_destroy(ui->lbl_prof);
+#endif
 	for (uint32_t i = 0; i < 2; ++i) {
 		robtk_rbtn_destroy(ui->disp[i]);
 	}
+	robtk_cbtn_destroy(ui->btn_zoom);
+	robtk_cbtn_destroy(ui->btn_constq);
+	robtk_cbtn_destroy(ui->btn_waterfall);
 
 	robtk_spin_destroy(ui->spb_tuning);
 	robtk_spin_destroy(ui->spb_octave);
@@ -1172,25 +1872,45 @@ port_event(LV2UI_Handle handle,
 		LV2_Atom_Object* obj = (LV2_Atom_Object*)atom;
 		LV2_Atom *a0 = NULL;
 		LV2_Atom *a1 = NULL;
+		LV2_Atom *a2 = NULL;
+		LV2_Atom *a3 = NULL;
 		if (
-				obj->body.otype == ui->uris.spectrum
-				&& 2 == lv2_atom_object_get(obj, ui->uris.spec_data_x, &a0, ui->uris.spec_data_y, &a1, NULL)
-				&& a0 && a1
-				&& a0->type == ui->uris.atom_Vector
-				&& a1->type == ui->uris.atom_Vector
+				obj->body.otype == ui->uris.zoom
+				&& 4 == lv2_atom_object_get(obj, ui->uris.zoom_fc, &a0, ui->uris.zoom_peak, &a1,
+					ui->uris.spec_data_x, &a2, ui->uris.spec_data_y, &a3, NULL)
+				&& a0 && a1 && a2 && a3
+				&& a0->type == ui->uris.atom_Float
+				&& a1->type == ui->uris.atom_Float
+				&& a2->type == ui->uris.atom_Vector
+				&& a3->type == ui->uris.atom_Vector
 			 )
 		{
-			LV2_Atom_Vector* vof_x = (LV2_Atom_Vector*)LV2_ATOM_BODY(a0);
-			LV2_Atom_Vector* vof_y = (LV2_Atom_Vector*)LV2_ATOM_BODY(a1);
-			if (vof_x->atom.type == ui->uris.atom_Float
+			LV2_Atom_Vector* vof_x = (LV2_Atom_Vector*)LV2_ATOM_BODY(a2);
+			LV2_Atom_Vector* vof_y = (LV2_Atom_Vector*)LV2_ATOM_BODY(a3);
+			if (ui->zoom
+					&& vof_x->atom.type == ui->uris.atom_Float
 					&& vof_y->atom.type == ui->uris.atom_Float)
 			{
-				const size_t n_elem = (a0->size - sizeof(LV2_Atom_Vector_Body)) / vof_x->atom.size;
+				const size_t n_elem = (a2->size - sizeof(LV2_Atom_Vector_Body)) / vof_x->atom.size;
 				const float *px = (float*) LV2_ATOM_BODY(&vof_x->atom);
 				const float *py = (float*) LV2_ATOM_BODY(&vof_y->atom);
+				ui->zoom_fc   = ((LV2_Atom_Float*)a0)->body;
+				ui->zoom_peak = ((LV2_Atom_Float*)a1)->body;
+				ui->zoom_level = -INFINITY;
+				for (size_t i = 0; i < n_elem; ++i) {
+					ui->zoom_level = MAX(ui->zoom_level, py[i]);
+				}
 				robtk_xydraw_set_points(ui->xyp, n_elem, px, py);
 			}
 		}
+		else if (obj->body.otype == ui->uris.spectrum && !ui->zoom) {
+			update_spectrum(ui, obj);
+		}
+#ifdef TUNA_PROFILE
+		else if (obj->body.otype == ui->uris.profile) {
+			update_profile(ui, obj);
+		}
+#endif
 		return;
 	}
 
@@ -1219,37 +1939,31 @@ port_event(LV2UI_Handle handle,
 			ui->disable_signals = false;
 			break;
 
-		/* input ports */
-		case TUNA_OCTAVE:   ui->p_octave = v; break;
-		case TUNA_NOTE:     ui->p_note = MAX(0, MIN(11,v)); break;
-		case TUNA_FREQ_OUT: ui->p_freq = v;
-			if (v <= 0) ui->s_cent = 0;
-			break;
-		case TUNA_CENT:     ui->p_cent = v;
-				ui->s_cent += .4 * (v - ui->s_cent) + 1e-12;
-			break;
-		case TUNA_RMS:      ui->p_rms = v;
-			if (ui->p_rms < -90) {
-				ui->s_rms = -90;
-			} else {
-				ui->s_rms += .3 * (v - ui->s_rms) + 1e-12;
-			}
-			if (ui->strobe_tme == 0 && v > -100) {
-				queue_draw(ui->darea);
-			}
-			break;
-
-		case TUNA_ERROR:    ui->p_error = v;
-			if (ui->p_error==0) {
-				ui->s_error = 0;
-			} else {
-				ui->s_error += .03 * (v - ui->s_error) + 1e-12;
-			}
-			break;
+		/* input ports, displayed by ui_tick() */
+		case TUNA_OCTAVE:   ui->p_octave = v; ui_poll(ui, false); break;
+		case TUNA_NOTE:     ui->p_note = MAX(0, MIN(11,v)); ui_poll(ui, false); break;
+		case TUNA_CENT:     ui->p_cent = v; ui_poll(ui, false); break;
+		case TUNA_TARGET:   ui->p_target = v; ui_poll(ui, false); break;
+		case TUNA_ERROR:    ui->p_error = v; ui_poll(ui, false); break;
+		case TUNA_FREQ_OUT: {
+			const bool lost = ui->p_freq > 0 && v <= 0;
+			ui->p_freq = v;
+			ui_poll(ui, lost);
+			} break;
+		case TUNA_RMS: {
+			const bool lost = ui->p_rms >= -90 && v < -90;
+			ui->p_rms = v;
+			ui_poll(ui, lost);
+			} break;
 
 		case TUNA_STROBE:
-			ui->strobe_tme = v;
-			queue_draw(ui->darea);
+			/* time since the DLL locked, 0 while there is no note.
+			 * The strobe phase advances with the plugin's time, keep
+			 * the last time as reference until the next note */
+			if (v > 0) {
+				ui->strobe_tme = v;
+			}
+			ui_poll(ui, false);
 			break;
 
 		case TUNA_T_RMS:
@@ -1287,6 +2001,11 @@ port_event(LV2UI_Handle handle,
 			robtk_spin_set_value(ui->spb_debug[6], v);
 			ui->disable_signals = false;
 			break;
+		case TUNA_CONSTQ:
+			ui->disable_signals = true;
+			robtk_cbtn_set_active(ui->btn_constq, v > 0);
+			ui->disable_signals = false;
+			break;
 		default:
 			return;
 	}
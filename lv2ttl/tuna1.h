@@ -10,9 +10,9 @@ static const RtkLv2Description _plugin_tuna_one = {
 	, 0 // uint32_t dsp_descriptor_id
 	, 0 // uint32_t gui_descriptor_id
 	, "x42 Instrument Tuner" // const char *plugin_human_id
-	, (const struct LV2Port[20])
+	, (const struct LV2Port[34])
 	{
-		{ "control", ATOM_IN, nan, nan, nan, "GUI to plugin communication"},
+		{ "control", ATOM_IN, nan, nan, nan, "GUI to plugin communication, scale files"},
 		{ "sysex", MIDI_OUT, nan, nan, nan, "MTS/SysEx output and Plugin to GUI communication"},
 		{ "in", AUDIO_IN, nan, nan, nan, "Audio Input"},
 		{ "out", AUDIO_OUT, nan, nan, nan, "Audio output"},
@@ -32,17 +32,31 @@ static const RtkLv2Description _plugin_tuna_one = {
 		{ "thresholdFundamental", CONTROL_IN, 5.000000, 0.000000, 60.000000, "thresholdFundamental"},
 		{ "thresholdOctave", CONTROL_IN, -30.000000, -100.000000, 0.000000, "thresholdOctave"},
 		{ "thresholdOvertones", CONTROL_IN, -15.000000, -100.000000, 0.000000, "thresholdvertones"},
+		{ "stage", CONTROL_OUT, nan, 0.000000, 2.000000, "Tracking Stage"},
+		{ "polyphony", CONTROL_IN, 0.000000, 0.000000, 8.000000, "Polyphonic Notes"},
+		{ "partials", CONTROL_IN, 0.000000, 0.000000, 16.000000, "Partial Analysis"},
+		{ "constq", CONTROL_IN, 0.000000, 0.000000, 1.000000, "Constant-Q Analysis"},
+		{ "mts", CONTROL_IN, 0.000000, 0.000000, 2.000000, "MTS Output"},
+		{ "mts_interval", CONTROL_IN, 50.000000, 0.000000, 1000.000000, "MTS Minimum Interval"},
+		{ "mts_hysteresis", CONTROL_IN, 0.050000, 0.000000, 10.000000, "MTS Hysteresis"},
+		{ "mts_dump", CONTROL_IN, 0.000000, 0.000000, 1.000000, "Send MTS Dump"},
+		{ "instrument", CONTROL_IN, 0.000000, 0.000000, 5.000000, "Instrument"},
+		{ "fmin", CONTROL_IN, 20.000000, 20.000000, 10000.000000, "Minimum Frequency"},
+		{ "fmax", CONTROL_IN, 10000.000000, 20.000000, 10000.000000, "Maximum Frequency"},
+		{ "fft_size", CONTROL_IN, 0.000000, 0.000000, 32768.000000, "Analysis Size"},
+		{ "log_level", CONTROL_IN, 0.000000, 0.000000, 3.000000, "Log Level"},
+		{ "target", CONTROL_OUT, nan, 0.000000, 10000.000000, "Target Frequency"},
 	}
-	, 20 // uint32_t nports_total
+	, 34 // uint32_t nports_total
 	, 1 // uint32_t nports_audio_in
 	, 1 // uint32_t nports_audio_out
 	, 0 // uint32_t nports_midi_in
 	, 1 // uint32_t nports_midi_out
 	, 1 // uint32_t nports_atom_in
 	, 0 // uint32_t nports_atom_out
-	, 16 // uint32_t nports_ctrl
-	, 9 // uint32_t nports_ctrl_in
-	, 7 // uint32_t nports_ctrl_out
+	, 30 // uint32_t nports_ctrl
+	, 21 // uint32_t nports_ctrl_in
+	, 9 // uint32_t nports_ctrl_out
 	, 8192 // uint32_t min_atom_bufsiz
 	, false // bool send_time_info
 	, UINT32_MAX // uint32_t latency_ctrl_port
@@ -0,0 +1,335 @@
+/* libtuna -- spectral analysis, sized for the instrument
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The spectrum that notes are found in. Included by libtuna.c.
+ *
+ * An analysis is the FFT, the constant-Q kernel of its bins, and an
+ * anti-aliasing filter. Its size follows the range of notes to detect:
+ *  - the signal is decimated by a power of two, as long as the octave-
+ *    overtones of the highest note that are searched remain below
+ *    ANALYSIS_BAND of the decimated rate,
+ *  - the FFT resolves the lowest note as well as the default analysis
+ *    resolves 20Hz (tuna_fft_size() at the full rate), unless the size
+ *    is set explicitly, to trade latency (fft-size * decimation / rate)
+ *    against resolution and CPU.
+ * At 48kHz a bass (25..400Hz) is analyzed at 6kHz with 1024 points,
+ * instead of 8192 points at 48kHz.
+ *
+ * Building an analysis plans an FFT, it is not realtime safe. The
+ * engine keeps using the one it has until another one is swapped in,
+ * see libtuna_swap_analysis(). At the same decimation the new analysis
+ * starts with the samples of the previous one, and delivers a spectrum
+ * without waiting for its window to fill.
+ */
+
+#define ANALYSIS_BAND    (.35) // highest searched frequency, relative to the decimated rate
+#define ANALYSIS_AA      (.40) // upper edge of the anti-aliasing filter, ditto
+#define ANALYSIS_HPF     (10)  // [Hz] lower edge of the anti-aliasing filter
+#define ANALYSIS_ORDER   (6)
+#define ANALYSIS_DECIM   (16)  // max. decimation
+#define ANALYSIS_FFT_MIN (1024)
+#ifdef __ARMEL__
+#define ANALYSIS_FFT_MAX (16384)
+#else
+#define ANALYSIS_FFT_MAX (32768)
+#endif
+
+#define FFT_FMAX (4200) // [Hz] highest fundamental that is searched, C8
+
+/* constant-Q kernel, see constq.c */
+struct ConstQ;
+static struct ConstQ* cq_alloc (struct FFTAnalysis* ft);
+static void cq_free (struct ConstQ* cq);
+
+/* notes to detect, see tuna_range() */
+typedef struct {
+	float    fmin, fmax; // [Hz]
+	uint32_t octaves;    // octave-overtones that are searched, 1..4
+	uint32_t fft_size;   // 0: auto, else ANALYSIS_FFT_MIN .. ANALYSIS_FFT_MAX
+} TunaRange;
+
+/* built-in instrument profiles, LibTunaInstrument */
+static const TunaRange tuna_instruments[LIBTUNA_INSTRUMENT_LAST] = {
+	{ 20,   10000, 4, 0 }, // generic
+	{ 25,   400,   2, 0 }, // bass, B0 (31Hz) .. G4
+	{ 60,   1400,  2, 0 }, // guitar, B1 (62Hz) .. E6
+	{ 180,  3000,  1, 0 }, // violin, G3 (196Hz) .. E7
+	{ 75,   1200,  2, 0 }, // voice, E2 (82Hz) .. C6
+	{ 27.5, 4200,  2, 0 }, // piano, A0 .. C8
+};
+
+/* the instrument's range, limited to fmin .. fmax.
+ * Realtime safe. If both do not overlap, the instrument's range is used.
+ */
+static void tuna_range (TunaRange* rg, const LibTunaRange* r)
+{
+	const LibTunaInstrument i = (r->instrument < LIBTUNA_INSTRUMENT_LAST) ? r->instrument : LIBTUNA_INSTRUMENT_GENERIC;
+	*rg = tuna_instruments[i];
+	const float fmin = MAX(rg->fmin, r->fmin);
+	const float fmax = MIN(rg->fmax, r->fmax);
+	if (fmin < fmax) {
+		rg->fmin = fmin;
+		rg->fmax = fmax;
+	}
+	if (r->fft_size > 0) {
+		/* round up to a power of two */
+		uint32_t n = ANALYSIS_FFT_MIN;
+		while (n < ANALYSIS_FFT_MAX && n < r->fft_size) {
+			n *= 2;
+		}
+		rg->fft_size = n;
+	}
+}
+
+/* FFT size for the given sample-rate, resolves 20Hz */
+static int
+tuna_fft_size (double rate)
+{
+	int fft_size;
+	fft_size = MAX(6144, rate / 15);
+
+	/* round up to next power of two */
+	fft_size--;
+	fft_size |= fft_size >> 1;
+	fft_size |= fft_size >> 2;
+	fft_size |= fft_size >> 4;
+	fft_size |= fft_size >> 8;
+	fft_size |= fft_size >> 16;
+	fft_size++;
+	fft_size = MIN(32768, fft_size);
+
+#ifdef __ARMEL__
+	// TODO investigate autocorrelation
+	// https://en.wikipedia.org/wiki/Wiener%E2%80%93Khinchin_theorem
+	// http://miracle.otago.ac.nz/tartini/papers/A_Smarter_Way_to_Find_Pitch.pdf
+	// for "note finding"
+	fft_size = MIN(16384, fft_size);
+#endif
+	return fft_size;
+}
+
+/* FFT size and decimation for the range, realtime safe */
+static void
+analysis_size (double rate, const TunaRange* rg, uint32_t* fft_size, uint32_t* decim)
+{
+	const double band = rg->fmax * (double)(1 << rg->octaves);
+	uint32_t d = 1;
+	while (d < ANALYSIS_DECIM && band <= ANALYSIS_BAND * rate / (2 * d)) {
+		d *= 2;
+	}
+
+	*decim = d;
+	if (rg->fft_size > 0) {
+		*fft_size = rg->fft_size;
+		return;
+	}
+
+	const uint32_t n_max = tuna_fft_size (rate);
+	const double   n_min = n_max * 20. / (rg->fmin * d);
+	uint32_t n = ANALYSIS_FFT_MIN;
+	while (n < n_max && n < n_min) {
+		n *= 2;
+	}
+	*fft_size = MIN(n, n_max);
+}
+
+struct LibTunaAnalysis {
+	double   rate;     // input sample-rate
+	uint32_t decim;    // input samples per analyzed sample
+	struct FFTAnalysis* fftx; // at rate / decim
+	struct ConstQ* cq; // kernel for fftx
+
+	/* anti-aliasing and decimation, decim > 1 */
+	struct FilterBank aa;
+	float*   buf;      // decimated samples, fftx->window_size
+	uint32_t phase;    // input samples since the last decimated sample
+	uint32_t warmup;   // decimated samples until the window is filled, no result
+	bool     seed;     // the next spectrum only sets the phase reference, no result
+};
+
+static void analysis_free (LibTunaAnalysis* an)
+{
+	if (!an) {
+		return;
+	}
+	cq_free (an->cq);
+	fftx_free (an->fftx);
+	free (an->buf);
+	free (an);
+}
+
+/* not realtime safe */
+static LibTunaAnalysis* analysis_alloc (double rate, uint32_t fft_size, uint32_t decim)
+{
+	LibTunaAnalysis* an = (LibTunaAnalysis*)calloc (1, sizeof (LibTunaAnalysis));
+	if (!an) {
+		return NULL;
+	}
+	an->rate  = rate;
+	an->decim = decim;
+
+	an->fftx = (struct FFTAnalysis*)calloc (1, sizeof (struct FFTAnalysis));
+	if (!an->fftx) {
+		free (an);
+		return NULL;
+	}
+	fftx_init (an->fftx, fft_size, rate / decim, 0);
+	/* not lazily, in realtime context */
+	if (!ft_gen_window (an->fftx)) {
+		analysis_free (an);
+		return NULL;
+	}
+
+	an->cq = cq_alloc (an->fftx);
+	if (!an->cq) {
+		analysis_free (an);
+		return NULL;
+	}
+
+	if (decim > 1) {
+		an->buf = (float*)malloc (fft_size * sizeof (float));
+		if (!an->buf) {
+			analysis_free (an);
+			return NULL;
+		}
+		const double fu = ANALYSIS_AA * rate / decim;
+		bandpass_setup (&an->aa, rate, .5 * (ANALYSIS_HPF + fu), fu - ANALYSIS_HPF, ANALYSIS_ORDER);
+	}
+	return an;
+}
+
+/* true if the analysis is sized for the range */
+static bool analysis_match (const LibTunaAnalysis* an, const TunaRange* rg)
+{
+	uint32_t fft_size, decim;
+	analysis_size (an->rate, rg, &fft_size, &decim);
+	return fft_size == an->fftx->window_size && decim == an->decim;
+}
+
+/* continue with the samples of the previous analysis, realtime safe.
+ * Returns the number of (decimated) signal samples that were carried over.
+ */
+static uint32_t analysis_prefill (LibTunaAnalysis* an, const LibTunaAnalysis* prev)
+{
+	if (an->decim != prev->decim || an->rate != prev->rate) {
+		return 0;
+	}
+	/* the filter is the same, continue with its state */
+	an->aa    = prev->aa;
+	an->phase = prev->phase;
+
+	/* the last m samples, oldest first; the rest of the window is silent */
+	const struct FFTAnalysis* src = prev->fftx;
+	struct FFTAnalysis*       dst = an->fftx;
+	const uint32_t m = MIN(src->window_size, dst->window_size);
+	const uint32_t o = dst->window_size - m;
+	for (uint32_t i = 0; i < m; ++i) {
+		dst->ringbuf[o + i] = src->ringbuf[(src->rboff + src->window_size - m + i) % src->window_size];
+	}
+	dst->rboff = 0;
+	/* the frequency of a bin is estimated from the phase difference to
+	 * the previous spectrum, which this analysis does not have yet */
+	an->seed = true;
+	/* the previous analysis may not have filled its window yet */
+	return MIN(m, src->window_size - prev->warmup);
+}
+
+/* input samples between the last two spectra */
+static inline uint32_t analysis_step (const LibTunaAnalysis* an)
+{
+	return an->fftx->step * an->decim;
+}
+
+/* like fftx_run(), the first spectrum after a prefill is not reported */
+static inline int analysis_fft (LibTunaAnalysis* an, const uint32_t n_samples, const float* data)
+{
+	if (fftx_run (an->fftx, n_samples, data)) {
+		return -1;
+	}
+	if (an->seed) {
+		an->seed = false;
+		return -1;
+	}
+	return 0;
+}
+
+/* anti-alias, decimate and analyze. Realtime safe,
+ * returns 0 if the spectrum was updated, like fftx_run()
+ */
+static int analysis_run (LibTunaAnalysis* an, const uint32_t n_samples, const float* data)
+{
+	struct FFTAnalysis* ft = an->fftx;
+	int rv;
+
+	if (an->decim == 1) {
+		rv = analysis_fft (an, n_samples, data);
+		an->warmup -= MIN(an->warmup, n_samples);
+	} else {
+		const uint32_t decim = an->decim;
+		uint32_t phase = an->phase;
+		uint32_t n = 0;
+		rv = -1;
+		for (uint32_t i = 0; i < n_samples; ++i) {
+			const float y = bandpass_process (&an->aa, data[i]);
+			if (++phase < decim) {
+				continue;
+			}
+			phase = 0;
+			an->buf[n] = y;
+			if (++n == ft->window_size) {
+				if (0 == analysis_fft (an, n, an->buf)) {
+					rv = 0;
+				}
+				an->warmup -= MIN(an->warmup, n);
+				n = 0;
+			}
+		}
+		an->phase = phase;
+		/* no FFT without new samples, fftx_freq_at_bin() divides by the step */
+		if (n > 0) {
+			if (0 == analysis_fft (an, n, an->buf)) {
+				rv = 0;
+			}
+			an->warmup -= MIN(an->warmup, n);
+		}
+	}
+	return an->warmup > 0 ? -1 : rv;
+}
+
+/******************************************************************************
+ * public API, analysis
+ */
+
+LIBTUNA_API
+LibTunaAnalysis*
+libtuna_analysis_alloc (double rate, const LibTunaRange* range)
+{
+	TunaRange rg;
+	uint32_t fft_size, decim;
+	tuna_range (&rg, range);
+	analysis_size (rate, &rg, &fft_size, &decim);
+	return analysis_alloc (rate, fft_size, decim);
+}
+
+LIBTUNA_API
+void
+libtuna_analysis_free (LibTunaAnalysis* an)
+{
+	analysis_free (an);
+}
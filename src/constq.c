@@ -0,0 +1,326 @@
+/* libtuna -- constant-Q spectrum
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Musically spaced spectrum, CQ_BPO bins per octave on the tuning grid
+ * of A440, computed from the spectrum of fft.c. Included by libtuna.c.
+ *
+ * J. Brown, M. Puckette, "An efficient algorithm for the calculation of a
+ * constant Q transform", JASA 92(5), 1992:
+ * every CQ bin k is the product of the signal with a temporal kernel
+ * (a Hann window of length N_k = Q * rate / f_k, modulated to f_k). By
+ * Parseval this is the product of the signal's spectrum with the
+ * kernel's spectrum, which is concentrated around f_k. The kernel
+ * spectra are computed once, and only coefficients above CQ_SPARSE
+ * are kept: a few per bin in the bass, more in the treble.
+ *
+ * The FFT's input is windowed (Hann) already, the effective kernel is
+ * the product of both windows. Kernels are not longer than the FFT: below
+ * Q * rate / window_size (600Hz at 48kHz) the bins are still spaced
+ * musically, but the resolution is that of the FFT.
+ *
+ * The result is scaled to fft.c's power spectrum (0dBFS sine: 1), so
+ * the same thresholds apply.
+ */
+
+#define CQ_BPO    (36)      // bins per octave
+#define CQ_FMAX   (8000)    // [Hz] highest bin
+#define CQ_SPARSE (.0054f)  // discard kernel coefficients below, relative to the max
+#define CQ_LOWBIN (4)       // lowest CQ bin: 4 FFT bins, keep the kernel off 0Hz
+
+typedef struct ConstQ ConstQ;
+
+struct ConstQ {
+	uint32_t  n_bins;
+	float*    freq;   // [Hz] center frequency of every bin
+	float*    power;  // result, |X|^2
+	/* sparse kernel, coefficients of bin k: coef[offset[k] .. offset[k+1]-1]
+	 * apply to FFT bins fft_bin[k], fft_bin[k] + 1, ...
+	 */
+	uint32_t* offset; // n_bins + 1
+	uint32_t* fft_bin;
+	float*    coef;   // interleaved re, im; conjugated and scaled
+};
+
+static void cq_free (ConstQ* cq) {
+	if (!cq) {
+		return;
+	}
+	free (cq->freq);
+	free (cq->power);
+	free (cq->offset);
+	free (cq->fft_bin);
+	free (cq->coef);
+	free (cq);
+}
+
+/* build the kernel for the given FFT, not realtime-safe */
+static ConstQ* cq_alloc (struct FFTAnalysis* ft) {
+	const uint32_t N  = ft->window_size;
+	const double rate = ft->rate;
+	const double Q    = 1. / (pow (2., 1. / CQ_BPO) - 1.);
+
+	const double fmin = MAX(CQ_LOWBIN * ft->freq_per_bin, 20);
+	const double fmax = MIN(CQ_FMAX, .45 * rate);
+	const int k_lo = ceil (CQ_BPO * log2 (fmin / 440.));
+	const int k_hi = floor (CQ_BPO * log2 (fmax / 440.));
+	if (k_hi <= k_lo) {
+		return NULL;
+	}
+
+	ConstQ* cq = (ConstQ*)calloc (1, sizeof (ConstQ));
+	if (!cq) {
+		return NULL;
+	}
+	cq->n_bins  = k_hi - k_lo + 1;
+	cq->freq    = (float*)malloc (cq->n_bins * sizeof (float));
+	cq->power   = (float*)calloc (cq->n_bins, sizeof (float));
+	cq->offset  = (uint32_t*)malloc ((cq->n_bins + 1) * sizeof (uint32_t));
+	cq->fft_bin = (uint32_t*)malloc (cq->n_bins * sizeof (uint32_t));
+
+	/* temporary: twiddle factors, a kernel and its spectrum */
+	float* tw_re  = (float*)malloc (N * sizeof (float));
+	float* tw_im  = (float*)malloc (N * sizeof (float));
+	float* kr     = (float*)malloc (N * sizeof (float));
+	float* ki     = (float*)malloc (N * sizeof (float));
+	float* sp     = (float*)malloc (N * sizeof (float) * 2);
+	uint32_t n_alloc = 64 * cq->n_bins;
+	cq->coef = (float*)malloc (n_alloc * 2 * sizeof (float));
+
+	if (!cq->freq || !cq->power || !cq->offset || !cq->fft_bin || !cq->coef
+			|| !tw_re || !tw_im || !kr || !ki || !sp) {
+		goto fail;
+	}
+
+	for (uint32_t i = 0; i < N; ++i) {
+		tw_re[i] =  cos (2. * M_PI * i / N);
+		tw_im[i] = -sin (2. * M_PI * i / N);
+	}
+
+	const float* window = ft_gen_window (ft);
+	uint32_t n_coef = 0;
+
+	for (uint32_t k = 0; k < cq->n_bins; ++k) {
+		const double fk = 440. * pow (2., (k_lo + (int)k) / (double)CQ_BPO);
+		const uint32_t Nk = MIN(N, ceil (Q * rate / fk));
+		const uint32_t n0 = (N - Nk) / 2; // center the kernel
+		cq->freq[k] = fk;
+
+		/* temporal kernel, normalized for a full-scale sine */
+		double sum = 0;
+		for (uint32_t n = 0; n < Nk; ++n) {
+			const double w = .5 - .5 * cos (2. * M_PI * n / (Nk - 1.));
+			const double p = 2. * M_PI * fk * (n0 + n) / rate;
+			kr[n0 + n] = w * cos (p);
+			ki[n0 + n] = w * sin (p);
+			sum += w * window[n0 + n];
+		}
+
+		/* its spectrum around fk: main lobe and a few side lobes */
+		const double   center = fk / ft->freq_per_bin;
+		const uint32_t range  = 4 * N / Nk + 4;
+		const uint32_t j0 = MAX(1, center - range);
+		const uint32_t j1 = MIN(ft->data_size - 2, center + range);
+		float peak = 0;
+		for (uint32_t j = j0; j <= j1; ++j) {
+			double re = 0, im = 0;
+			uint32_t t = (j * n0) % N;
+			for (uint32_t n = n0; n < n0 + Nk; ++n) {
+				re += kr[n] * tw_re[t] - ki[n] * tw_im[t];
+				im += kr[n] * tw_im[t] + ki[n] * tw_re[t];
+				t += j;
+				if (t >= N) {
+					t -= N;
+				}
+			}
+			/* conjugate, scale: 1/N (parseval) and 2/sum (window) */
+			const double g = 2. / (sum * N);
+			sp[2 * j]     = re * g;
+			sp[2 * j + 1] = -im * g;
+			peak = MAX(peak, hypotf (sp[2 * j], sp[2 * j + 1]));
+		}
+
+		/* keep the contiguous range of significant coefficients */
+		uint32_t s0 = j1, s1 = j0;
+		for (uint32_t j = j0; j <= j1; ++j) {
+			if (hypotf (sp[2 * j], sp[2 * j + 1]) >= CQ_SPARSE * peak) {
+				s0 = MIN(s0, j);
+				s1 = MAX(s1, j);
+			}
+		}
+
+		if (n_coef + s1 - s0 + 1 > n_alloc) {
+			n_alloc = 2 * (n_coef + s1 - s0 + 1);
+			float* c = (float*)realloc (cq->coef, n_alloc * 2 * sizeof (float));
+			if (!c) {
+				goto fail;
+			}
+			cq->coef = c;
+		}
+
+		cq->offset[k]  = n_coef;
+		cq->fft_bin[k] = s0;
+		for (uint32_t j = s0; j <= s1; ++j, ++n_coef) {
+			cq->coef[2 * n_coef]     = sp[2 * j];
+			cq->coef[2 * n_coef + 1] = sp[2 * j + 1];
+		}
+	}
+	cq->offset[cq->n_bins] = n_coef;
+
+	/* shrink to fit */
+	float* c = (float*)realloc (cq->coef, MAX(1, n_coef) * 2 * sizeof (float));
+	if (c) {
+		cq->coef = c;
+	}
+
+	free (tw_re);
+	free (tw_im);
+	free (kr);
+	free (ki);
+	free (sp);
+	return cq;
+
+fail:
+	free (tw_re);
+	free (tw_im);
+	free (kr);
+	free (ki);
+	free (sp);
+	cq_free (cq);
+	return NULL;
+}
+
+/* compute the constant-Q spectrum, after fftx_run() returned 0 */
+static void cq_analyze (ConstQ* cq, const struct FFTAnalysis* ft) {
+	const float* const fft_out = ft->fft_out;
+	const uint32_t N = ft->window_size;
+
+	for (uint32_t k = 0; k < cq->n_bins; ++k) {
+		const float* c = &cq->coef[2 * cq->offset[k]];
+		const uint32_t n = cq->offset[k + 1] - cq->offset[k];
+		const uint32_t j0 = cq->fft_bin[k];
+		float re = 0, im = 0;
+		for (uint32_t i = 0; i < n; ++i, c += 2) {
+			/* FFTW_R2HC: real part at j, imaginary part at N - j */
+			const float yr = fft_out[j0 + i];
+			const float yi = fft_out[N - j0 - i];
+			re += yr * c[0] - yi * c[1];
+			im += yr * c[1] + yi * c[0];
+		}
+		cq->power[k] = re * re + im * im;
+	}
+}
+
+/* frequency of a peak at CQ bin k. The phase-vocoder estimate of the
+ * closest FFT bin, unless it is more than one CQ bin off (the bin is
+ * shared by several partials), else interpolated on the CQ bins.
+ */
+static float cq_freq_at_bin (const ConstQ* cq, struct FFTAnalysis* ft, const uint32_t k) {
+	float f = cq->freq[k];
+	if (k > 0 && k + 1 < cq->n_bins) {
+		const float a = cq->power[k - 1];
+		const float b = cq->power[k];
+		const float c = cq->power[k + 1];
+		if (a > 0 && c > 0) {
+			const float la = logf (a), lb = logf (b), lc = logf (c);
+			const float d = la - 2.f * lb + lc;
+			if (d < 0) {
+				f *= exp2f (.5f * (la - lc) / d / CQ_BPO);
+			}
+		}
+	}
+
+	uint32_t j = rintf (f / ft->freq_per_bin);
+	if (j < 1 || j + 1 >= ft->data_size) {
+		return f;
+	}
+	if (ft->power[j - 1] > ft->power[j]) { --j; }
+	else if (ft->power[j + 1] > ft->power[j]) { ++j; }
+
+	const float pv = fftx_freq_at_bin (ft, j);
+	if (fabsf (pv - f) < f * (exp2f (1.f / CQ_BPO) - 1.f)) {
+		return pv;
+	}
+	return f;
+}
+
+/* recursively scan octave-overtones up to rg->octaves, see fftx_scan_overtones() */
+static uint32_t cq_scan_overtones (const ConstQ* cq, const TunaRange* rg,
+		const float threshold, uint32_t bin, uint32_t octave,
+		const float v_oct2)
+{
+	const uint32_t scan = CQ_BPO / 7; // ~ +-10%, like fftx_scan_overtones()
+	uint32_t peak_pos = 0;
+	for (uint32_t i = MAX(1, bin - scan); i <= bin + scan && i + 1 < cq->n_bins; ++i) {
+		if (
+				   cq->power[i] > threshold
+				&& cq->power[i] > cq->power[i-1]
+				&& cq->power[i] > cq->power[i+1]
+			 ) {
+			peak_pos = i;
+			break;
+		}
+	}
+	if (peak_pos > 0) {
+		octave *= 2;
+		if (octave <= (1u << rg->octaves)) {
+			octave = cq_scan_overtones (cq, rg, threshold * v_oct2, peak_pos + CQ_BPO, octave, v_oct2);
+		}
+	}
+	return octave;
+}
+
+/* find lowest peak frequency in the range above a given threshold,
+ * same rules as fftx_find_note(), on the CQ bins */
+static float cq_find_note (const ConstQ* cq, struct FFTAnalysis *ft, const TunaRange* rg,
+		const float abs_threshold,
+		const float v_ovr, const float v_fun, const float v_oct, const float v_ovt)
+{
+	uint32_t fundamental = 0;
+	uint32_t octave = 0;
+	float peak_dat = 0;
+	float threshold = abs_threshold;
+
+	for (uint32_t i = 1; i + 1 < cq->n_bins && cq->freq[i] <= rg->fmax; ++i) {
+		if (cq->freq[i] < rg->fmin) {
+			continue;
+		}
+		if (
+				cq->power[i] > threshold
+				&& cq->power[i] > cq->power[i-1]
+				&& cq->power[i] > cq->power[i+1]
+			 ) {
+
+			uint32_t o = cq_scan_overtones (cq, rg, cq->power[i] * v_oct, i + CQ_BPO, 2, v_ovt);
+
+			if (o > octave
+					|| (cq->power[i] > threshold * v_ovr)
+					) {
+				if (cq->power[i] > peak_dat) {
+					peak_dat = cq->power[i];
+					fundamental = i;
+					octave = o;
+					if (o > 2) threshold = peak_dat * v_fun;
+				}
+			}
+		}
+	}
+
+	if (octave == 0) { return 0; }
+	return cq_freq_at_bin (cq, ft, fundamental);
+}
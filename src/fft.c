@@ -61,6 +61,12 @@ struct FFTAnalysis {
 	uint32_t sps;
 	uint32_t step;
 	double   phasediff_bin;
+
+#ifdef FFTX_PROFILE_NOW
+	/* accumulated time, reset by the caller */
+	uint64_t prof_window;
+	uint64_t prof_analyze;
+#endif
 };
 
 /* ****************************************************************************
@@ -160,11 +166,10 @@ ft_gen_window (struct FFTAnalysis* ft)
 	return ft->window;
 }
 
+/* power and phase, after fft_out was computed */
 static void
-ft_analyze (struct FFTAnalysis* ft)
+ft_power (struct FFTAnalysis* ft)
 {
-	fftwf_execute (ft->fftplan);
-
 	memcpy (ft->phase_h, ft->phase, sizeof (float) * ft->data_size);
 	ft->power[0] = ft->fft_out[0] * ft->fft_out[0];
 	ft->phase[0] = 0;
@@ -179,6 +184,13 @@ ft_analyze (struct FFTAnalysis* ft)
 #undef FIm
 }
 
+static void
+ft_analyze (struct FFTAnalysis* ft)
+{
+	fftwf_execute (ft->fftplan);
+	ft_power (ft);
+}
+
 /******************************************************************************
  * public API (static for direct source inclusion)
  */
@@ -204,9 +216,9 @@ fftx_reset (struct FFTAnalysis* ft)
 	ft->step  = 0;
 }
 
-FFTX_FN_PREFIX
-void
-fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps)
+/* set parameters and allocate buffers, except FFT in/out */
+static void
+ft_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps)
 {
 	ft->rate           = rate;
 	ft->window_size    = window_size;
@@ -222,11 +234,18 @@ fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps
 	ft->phasediff_bin  = 0;
 
 	ft->ringbuf = (float*)malloc (window_size * sizeof (float));
-	ft->fft_in  = (float*)fftwf_malloc (sizeof (float) * window_size);
-	ft->fft_out = (float*)fftwf_malloc (sizeof (float) * window_size);
 	ft->power   = (float*)malloc (ft->data_size * sizeof (float));
 	ft->phase   = (float*)malloc (ft->data_size * sizeof (float));
 	ft->phase_h = (float*)malloc (ft->data_size * sizeof (float));
+}
+
+FFTX_FN_PREFIX
+void
+fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps)
+{
+	ft_init (ft, window_size, rate, fps);
+	ft->fft_in  = (float*)fftwf_malloc (sizeof (float) * window_size);
+	ft->fft_out = (float*)fftwf_malloc (sizeof (float) * window_size);
 
 	fftx_reset (ft);
 
@@ -285,27 +304,63 @@ fftx_free (struct FFTAnalysis* ft)
 	free (ft);
 }
 
-static int
-_fftx_run (struct FFTAnalysis* ft,
-           const uint32_t n_samples, float const* const data)
+/* add samples to the ringbuffer */
+static void
+ft_push (struct FFTAnalysis* ft,
+         const uint32_t n_samples, float const* const data)
 {
-	assert (n_samples <= ft->window_size);
-
-	float* const f_buf = ft->fft_in;
 	float* const r_buf = ft->ringbuf;
 
 	const uint32_t n_off = ft->rboff;
 	const uint32_t n_siz = ft->window_size;
-	const uint32_t n_old = n_siz - n_samples;
 
 	for (uint32_t i = 0; i < n_samples; ++i) {
 		r_buf[(i + n_off) % n_siz] = data[i];
-		f_buf[n_old + i]           = data[i];
 	}
 
 	ft->rboff = (ft->rboff + n_samples) % n_siz;
-#if 1
 	ft->smps += n_samples;
+}
+
+/* copy the ringbuffer to fft_in, oldest sample first, and apply the window */
+static void
+ft_prepare (struct FFTAnalysis* ft)
+{
+#ifdef FFTX_PROFILE_NOW
+	const uint64_t t0 = FFTX_PROFILE_NOW ();
+#endif
+
+	float* const f_buf = ft->fft_in;
+	float* const r_buf = ft->ringbuf;
+
+	const uint32_t n_off = ft->rboff;
+	const uint32_t n_siz = ft->window_size;
+
+	memcpy (f_buf, &r_buf[n_off], sizeof (float) * (n_siz - n_off));
+	memcpy (&f_buf[n_siz - n_off], &r_buf[0], sizeof (float) * n_off);
+
+	/* apply window function */
+	float const* const window = ft_gen_window (ft);
+	for (uint32_t i = 0; i < ft->window_size; i++) {
+		ft->fft_in[i] *= window[i];
+	}
+
+#ifdef FFTX_PROFILE_NOW
+	ft->prof_window += FFTX_PROFILE_NOW () - t0;
+#endif
+}
+
+/* add samples to the ringbuffer. If a new analysis is due, copy them
+ * to fft_in, apply the window and return 0.
+ */
+static int
+ft_feed (struct FFTAnalysis* ft,
+         const uint32_t n_samples, float const* const data)
+{
+	assert (n_samples <= ft->window_size);
+
+	ft_push (ft, n_samples, data);
+#if 1
 	if (ft->smps < ft->sps) {
 		return -1;
 	}
@@ -315,26 +370,29 @@ _fftx_run (struct FFTAnalysis* ft,
 	ft->step = n_samples;
 #endif
 
-	/* copy samples from ringbuffer into fft-buffer */
-	const uint32_t p0s = (n_off + n_samples) % n_siz;
-	if (p0s + n_old >= n_siz) {
-		const uint32_t n_p1 = n_siz - p0s;
-		const uint32_t n_p2 = n_old - n_p1;
-		memcpy (f_buf, &r_buf[p0s], sizeof (float) * n_p1);
-		memcpy (&f_buf[n_p1], &r_buf[0], sizeof (float) * n_p2);
-	} else {
-		memcpy (&f_buf[0], &r_buf[p0s], sizeof (float) * n_old);
-	}
+	ft_prepare (ft);
+	return 0;
+}
 
-	/* apply window function */
-	float const* const window = ft_gen_window (ft);
-	for (uint32_t i = 0; i < ft->window_size; i++) {
-		ft->fft_in[i] *= window[i];
+static int
+_fftx_run (struct FFTAnalysis* ft,
+           const uint32_t n_samples, float const* const data)
+{
+	if (ft_feed (ft, n_samples, data)) {
+		return -1;
 	}
 
+#ifdef FFTX_PROFILE_NOW
+	const uint64_t t1 = FFTX_PROFILE_NOW ();
+#endif
+
 	/* ..and analyze */
 	ft_analyze (ft);
 
+#ifdef FFTX_PROFILE_NOW
+	ft->prof_analyze += FFTX_PROFILE_NOW () - t1;
+#endif
+
 	ft->phasediff_bin = ft->phasediff_step * (double)ft->step;
 	return 0;
 }
@@ -360,6 +418,124 @@ fftx_run (struct FFTAnalysis* ft,
 	return rv;
 }
 
+/******************************************************************************
+ * several channels of the same size, analyzed in turn with a single plan
+ */
+struct FFTMulti {
+	uint32_t            n_channels;
+	uint32_t            next;    // channel that is analyzed next
+	struct FFTAnalysis* ch;      // per channel, fft_in/out point into the arrays below
+	float*              fft_in;  // n_channels * window_size
+	float*              fft_out;
+	fftwf_plan          fftplan; // one channel, see fftwf_execute_r2r()
+};
+
+FFTX_FN_PREFIX
+void
+fftx_multi_init (struct FFTMulti* fm, uint32_t n_channels, uint32_t window_size, double rate)
+{
+	fm->n_channels = n_channels;
+	fm->next    = 0;
+	fm->ch      = (struct FFTAnalysis*)calloc (n_channels, sizeof (struct FFTAnalysis));
+	fm->fft_in  = (float*)fftwf_malloc (sizeof (float) * window_size * n_channels);
+	fm->fft_out = (float*)fftwf_malloc (sizeof (float) * window_size * n_channels);
+
+	for (uint32_t c = 0; c < n_channels; ++c) {
+		struct FFTAnalysis* ft = &fm->ch[c];
+		ft_init (ft, window_size, rate, 0);
+		ft->fft_in  = &fm->fft_in[c * window_size];
+		ft->fft_out = &fm->fft_out[c * window_size];
+		fftx_reset (ft);
+		/* share the window */
+		ft->window = ft_gen_window (&fm->ch[0]);
+	}
+
+	/* the channels' arrays have the same alignment (window_size is a
+	 * power of two), the plan can be executed on any of them */
+	pthread_mutex_lock (&fftw_planner_lock);
+	fm->fftplan = fftwf_plan_r2r_1d (window_size, fm->fft_in, fm->fft_out, FFTW_R2HC, FFTW_MEASURE);
+	++instance_count;
+	pthread_mutex_unlock (&fftw_planner_lock);
+}
+
+FFTX_FN_PREFIX
+void
+fftx_multi_free (struct FFTMulti* fm)
+{
+	if (!fm) {
+		return;
+	}
+	pthread_mutex_lock (&fftw_planner_lock);
+	fftwf_destroy_plan (fm->fftplan);
+	if (instance_count > 0) {
+		--instance_count;
+	}
+	pthread_mutex_unlock (&fftw_planner_lock);
+
+	for (uint32_t c = 0; c < fm->n_channels; ++c) {
+		struct FFTAnalysis* ft = &fm->ch[c];
+		free (ft->ringbuf);
+		free (ft->power);
+		free (ft->phase);
+		free (ft->phase_h);
+	}
+	free (fm->ch[0].window);
+	free (fm->ch);
+	fftwf_free (fm->fft_in);
+	fftwf_free (fm->fft_out);
+	free (fm);
+}
+
+/* add samples of channel c, they are analyzed by fftx_multi_run() */
+FFTX_FN_PREFIX
+void
+fftx_multi_feed (struct FFTMulti* fm, const uint32_t c,
+                 const uint32_t n_samples, float const* const data)
+{
+	struct FFTAnalysis* ft = &fm->ch[c];
+	if (n_samples > ft->window_size) {
+		ft_push (ft, ft->window_size, &data[n_samples - ft->window_size]);
+		ft->smps += n_samples - ft->window_size;
+	} else {
+		ft_push (ft, n_samples, data);
+	}
+}
+
+/* analyze the next channel, one per call: the cost of a cycle is that
+ * of a single FFT, each channel's spectrum is updated every n_channels
+ * cycles. Returns the channel, or -1 if it has no new samples.
+ */
+FFTX_FN_PREFIX
+int
+fftx_multi_run (struct FFTMulti* fm)
+{
+	const uint32_t      c  = fm->next;
+	struct FFTAnalysis* ft = &fm->ch[c];
+	/* no FFT without new samples, fftx_freq_at_bin() divides by the step */
+	if (ft->smps == 0) {
+		return -1;
+	}
+	fm->next = (c + 1) % fm->n_channels;
+
+	ft->step = ft->smps;
+	ft->smps = 0;
+	ft_prepare (ft);
+
+#ifdef FFTX_PROFILE_NOW
+	const uint64_t t1 = FFTX_PROFILE_NOW ();
+#endif
+
+	fftwf_execute_r2r (fm->fftplan, ft->fft_in, ft->fft_out);
+	ft_power (ft);
+
+#ifdef FFTX_PROFILE_NOW
+	ft->prof_analyze += FFTX_PROFILE_NOW () - t1;
+#endif
+
+	ft->phasediff_bin = ft->phasediff_step * (double)ft->step;
+	return c;
+}
+
 FFTX_FN_PREFIX
 void
 fa_analyze_dsp (struct FFTAnalysis* ft,
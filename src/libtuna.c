@@ -0,0 +1,1299 @@
+/* libtuna -- pitch detection engine of tuna.lv2
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* FFT note finder, band-pass and DLL, see libtuna.h for the API.
+ *
+ * Compiled as library (`make libtuna`), or included by src/tuna.c
+ * with LIBTUNA_API defined as `static`.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <stdbool.h>
+
+
+#ifndef MIN
+#define MIN(A,B) ( (A) < (B) ? (A) : (B) )
+#endif
+#ifndef MAX
+#define MAX(A,B) ( (A) > (B) ? (A) : (B) )
+#endif
+
+
+/* use FFT signal if tracked freq & FFT-freq differ by more than */
+#define FFT_FREQ_THESHOLD_FAC (.10f)
+/* but at least .. [Hz] */
+#define FFT_FREQ_THESHOLD_MIN (5.f)
+
+/* a detected note may be outside the range by up to half a semitone */
+#define RANGE_TOLERANCE (1.0293022f)
+
+/* for testing only -- output filtered signal */
+//#define OUTPUT_POSTFILTER
+
+/* use both rising and falling signal edge to track phase */
+#define TWO_EDGES
+
+/* DLL gear-shift: acquire a note with a wide loop-bandwidth [per update]..  */
+#define DLL_ACQUIRE_OMEGA (.25)
+/* ..switch to narrow tracking once the smoothed phase-error (averaged over
+ * N edges) remains below the given fraction of a period.. */
+#define DLL_SETTLE_COUNT (16)
+#define DLL_SETTLE_ERROR (.01)
+/* ..and back to acquisition if the phase-error exceeds */
+#define DLL_LOSS_ERROR   (.05)
+/* re-align phase for N edges after changing the filter-bandwidth */
+#define DLL_REPHASE      (32)
+
+
+/* debug FFT note-search, use the diagnostics log [TUNA_LOG] for everything else */
+#if 0 // lots of output
+#define debug_printf printf
+#else
+static void debug_printf (const char *fmt,...) {}
+#endif
+
+
+#include "libtuna.h"
+#include "profile.h"
+#include "spectr.c"
+
+#ifdef TUNA_PROFILE
+#define FFTX_PROFILE_NOW tuna_prof_now
+#endif
+#include "fft.c"
+#include "poly.c"
+#include "analysis.c"
+#include "constq.c"
+#include "scale.c"
+#include "rtlog.h"
+
+#include <pthread.h>
+
+#ifdef __ARMEL__
+// TODO also use for "#one" - to spread out load
+// [maybe] run fft in GUI thread for "#two"
+#define BACKGROUND_FFT
+#endif
+
+#ifdef BACKGROUND_FFT
+#include "ringbuf.h"
+/* polyphonic result of the worker: n_notes, n_samples, freq[], power[] */
+#define POLY_FRAME (2 + 2 * LIBTUNA_POLY_MAX)
+#endif
+
+/* recursively scan octave-overtones up to rg->octaves (1..4) */
+static uint32_t fftx_scan_overtones(struct FFTAnalysis *ft, const TunaRange *rg,
+		const float threshold, uint32_t bin, uint32_t octave,
+		const float v_oct2)
+{
+	const float scan  = MAX(2, (float) bin * .1f);
+	uint32_t peak_pos = 0;
+	for (uint32_t i = MAX(1, floorf(bin-scan)); i < ceilf(bin+scan) && i + 1 < ft->data_size; ++i) {
+		if (
+				   ft->power[i] > threshold
+				&& ft->power[i] > ft->power[i-1]
+				&& ft->power[i] > ft->power[i+1]
+			 ) {
+			peak_pos = i;
+			debug_printf("ovt: bin %d oct %d th-fact: %f\n", i, octave, 10.0 * fast_log10(ft->power[i]/ threshold));
+			break;
+		}
+	}
+	if (peak_pos > 0) {
+		octave *= 2;
+		if (octave <= (1u << rg->octaves)) {
+			octave = fftx_scan_overtones(ft, rg, threshold * v_oct2, peak_pos * 2, octave, v_oct2);
+		}
+	}
+	return octave;
+}
+
+/** find lowest peak frequency in the range above a given threshold */
+static float fftx_find_note(struct FFTAnalysis *ft, const TunaRange *rg,
+		const float abs_threshold,
+		const float v_ovr, const float v_fun, const float v_oct, const float v_ovt)
+{
+	uint32_t fundamental = 0;
+	uint32_t octave = 0;
+	float peak_dat = 0;
+	const uint32_t lopos  = MAX(1, rg->fmin / ft->freq_per_bin);
+	const uint32_t brkpos = MIN(ft->data_size - 1, ft->data_size * 2 * MIN(rg->fmax, FFT_FMAX) / ft->rate);
+	float threshold = abs_threshold;
+
+	for (uint32_t i = lopos; i < brkpos; ++i) {
+		if (
+				ft->power[i] > threshold
+				&& ft->power[i] > ft->power[i-1]
+				&& ft->power[i] > ft->power[i+1]
+			 ) {
+
+			uint32_t o = fftx_scan_overtones(ft, rg, ft->power[i] * v_oct, i * 2, 2, v_ovt);
+			debug_printf("Candidate (%d) %f Hz -> %d overtones\n", i, fftx_freq_at_bin(ft, i) , o);
+
+			if (o > octave
+					|| (ft->power[i] > threshold * v_ovr)
+					) {
+				if (ft->power[i] > peak_dat) {
+					peak_dat = ft->power[i];
+					fundamental = i;
+					octave = o;
+					/* only prefer higher 'fundamental' if it's louder than a /usual/ 1st overtone.  */
+					if (o > 2) threshold = peak_dat * v_fun;
+					//if (o > 16) break;
+				}
+			}
+		}
+	}
+
+	debug_printf("fun: bin: %d octave: %d freq: %.1fHz th-fact: %fdB\n",
+			fundamental, octave, fftx_freq_at_bin(ft, fundamental), 10 * fast_log10(threshold / abs_threshold));
+	if (octave == 0) { return 0; }
+	return fftx_freq_at_bin(ft, fundamental);
+}
+
+/******************************************************************************
+ * diagnostics
+ *
+ * libtuna_process() queues events in a lock-free ring, a background thread
+ * formats them and passes them on to the log-callback (default: stderr).
+ * The verbosity is set with libtuna_set_log_level(), the TUNA_LOG
+ * environment variable (off, warn, info or debug) sets the minimum.
+ * Default is off, the thread is started when a level above off is set.
+ */
+
+typedef enum {
+	TL_BAND_NYQUIST = 0,
+	TL_BAND_LOW,
+	TL_SET_FILTER,
+	TL_FFT_PEAK,
+	TL_FFT_ADJUST,
+	TL_DLL_INIT,
+	TL_DLL_TRACK,
+	TL_DLL_ACQUIRE,
+	TL_LOST_LEVEL,
+	TL_LOST_FILTER,
+	TL_DLL_UPDATE,
+	TL_DETECTED,
+	TL_LAST
+} TunaLogEvent;
+
+static const struct {
+	RtLogLevel  level;
+	const char* fmt; // up to 4 float args
+} tuna_log_msg[TL_LAST] = {
+	{ RTLOG_WARN,  "band f:%.2fHz bw:%.2fHz exceeds nyquist, limited" },
+	{ RTLOG_WARN,  "band f:%.2fHz bw:%.2fHz contains sub-bass frequencies, limited" },
+	{ RTLOG_INFO,  "set filter: %.2fHz bw:%.2fHz" },
+	{ RTLOG_DEBUG, "FFT found peak: %.2fHz -> freq: %.2fHz (%.0f)" },
+	{ RTLOG_INFO,  "FFT adjust %.2fHz -> %.2fHz (fft:%.2fHz) cnt:%.0f" },
+	{ RTLOG_INFO,  "reinit DLL %.2fHz" },
+	{ RTLOG_INFO,  "DLL track %.2fHz (avg. phase-error %.4f)" },
+	{ RTLOG_INFO,  "DLL re-acquire %.2fHz (avg. phase-error %.4f)" },
+	{ RTLOG_INFO,  "signal below threshold: %.1fdB" },
+	{ RTLOG_INFO,  "signal too low after filter: %.1fdB %.1fdB" },
+	{ RTLOG_DEBUG, "detected Freq: %.2f flt: %.2f (error: %.2f [samples]) diff:%f" },
+	{ RTLOG_DEBUG, "detected Freq: %.2f (error: %.2f [samples])" },
+};
+
+static RtLogLevel tuna_log_level_from_env (void) {
+	const char* env = getenv ("TUNA_LOG");
+	if (!env) return RTLOG_OFF;
+	if (!strcasecmp (env, "off"))   return RTLOG_OFF;
+	if (!strcasecmp (env, "warn"))  return RTLOG_WARN;
+	if (!strcasecmp (env, "info"))  return RTLOG_INFO;
+	if (!strcasecmp (env, "debug")) return RTLOG_DEBUG;
+	return RTLOG_WARN;
+}
+
+/* queue an event at sample-offset N of the current cycle.
+ * Arguments are not evaluated unless the event's level is enabled.
+ */
+#define TUNA_LOG(CODE, N, V0, V1, V2, V3) \
+	do { \
+		if (__atomic_load_n (&self->log_level, __ATOMIC_RELAXED) >= tuna_log_msg[CODE].level) { \
+			rtlog_write (self->log, self->log_time + (N), CODE, V0, V1, V2, V3); \
+		} \
+	} while (0)
+
+/******************************************************************************
+ * engine state
+ */
+
+typedef struct TunaPartials TunaPartials;
+typedef struct TunaZoom TunaZoom;
+
+struct LibTuna {
+	/* settings */
+	double rate;
+	float  mode;
+	float  tuning;
+	bool   spectr_active;
+	TunaScale scale;
+
+	LibTunaResult result;
+#ifdef OUTPUT_POSTFILTER
+	float* a_out; // set by the LV2 wrapper
+#endif
+
+	/* internal state */
+	struct FilterBank fb;
+	float tuna_fc; // center freq of expected note
+	float tuna_bw; // bandwidth of the filter
+	uint32_t filter_init;
+
+	/* discriminator */
+	float prev_smpl;
+
+	/* RMS / threshold */
+	float rms_omega;
+	float rms_signal;
+	float rms_postfilter;
+
+	/* thresholds [dB] and their power values */
+	float t_rms, v_rms;
+	float t_flt, v_flt;
+	float t_fft, v_fft;
+	float t_ovr, v_ovr;
+	float t_fun, v_fun;
+	float t_oct, v_oct;
+	float t_ovt, v_ovt;
+
+#ifdef BACKGROUND_FFT
+	pthread_mutex_t lock;
+	pthread_cond_t  signal;
+	pthread_t       thread;
+	bool            keep_running;
+
+	ringbuf*        to_fft;
+	ringbuf*        fft_result;
+	ringbuf*        fft_poly;
+#endif
+
+	/* DLL */
+	bool dll_initialized;
+	int  dll_stage;
+	uint32_t dll_settled;
+	double   dll_pe;
+	uint32_t dll_rephase;
+	uint32_t monotonic_cnt;
+	double dll_e2, dll_e0;
+	double dll_t0, dll_t1;
+	double dll_b, dll_c;
+
+	/* FFT */
+	LibTunaAnalysis* an;
+	LibTunaRange range_set; // see libtuna_set_range()
+	TunaRange    range;
+	bool constq; // find notes on the constant-Q spectrum
+	bool fft_initialized;
+	bool fft_ran; // fftx has new data, last cycle
+	float fft_scale_freq;
+	int fft_note_count;
+	int fft_timeout;
+
+	/* polyphonic detection */
+	uint32_t          poly_n;
+	PolyVoice         poly_voice[LIBTUNA_POLY_MAX];
+	LibTunaPolyResult poly_result;
+
+	/* partial analysis */
+	TunaPartials* partials;
+
+	/* zoomed spectrum */
+	TunaZoom* zoom;
+
+	/* diagnostics */
+	RtLog*             log;
+	int                log_level;   // set by libtuna_set_log_level(), any thread
+	int                log_env;     // TUNA_LOG, minimum level
+	uint64_t           log_time;
+	uint32_t           log_dropped;
+	LibTunaLogCallback log_cb;
+	void*              log_arg;
+	pthread_t          log_thread;
+	pthread_mutex_t    log_lock;
+	pthread_cond_t     log_signal;
+	bool               log_running;
+	bool               log_started; // log_thread exists
+
+#ifdef TUNA_PROFILE
+	/* per-stage timing */
+	TunaProfStat prof[TP_LAST];
+	uint64_t     prof_dll;   // accumulated in the sample-loop, per cycle
+	uint64_t     prof_note;  // ditto
+#endif
+};
+
+/* partial analysis, see partials.c */
+static TunaPartials* partials_alloc (double rate);
+static void partials_free (TunaPartials* pa);
+static void tuna_partials (LibTuna *self, const float* a_in, const uint32_t n_samples);
+
+/* zoomed spectrum, see zoom.c */
+static TunaZoom* zoom_alloc (double rate);
+static void zoom_free (TunaZoom* zm);
+static void tuna_zoom (LibTuna *self, const float* a_in, const uint32_t n_samples);
+
+/* lowest note of the last spectrum, on the FFT or constant-Q bins */
+static float tuna_find_note (LibTuna* self, const bool constq, const float abs_threshold) {
+	if (constq) {
+		return cq_find_note (self->an->cq, self->an->fftx, &self->range, abs_threshold, self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
+	}
+	return fftx_find_note (self->an->fftx, &self->range, abs_threshold, self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
+}
+
+#ifdef BACKGROUND_FFT
+static void* worker (void* arg) {
+	LibTuna* self = (LibTuna*)arg;
+	const float rms_omega  = self->rms_omega;
+	float rms_signal = 0;
+
+  pthread_mutex_lock (&self->lock);
+	while (self->keep_running) {
+		// wait for signal
+    pthread_cond_wait (&self->signal, &self->lock);
+
+		if (!self->keep_running) {
+			break;
+		}
+
+		size_t n_samples = rb_read_space (self->to_fft);
+		do {
+			if (n_samples < 1) {
+				break;
+			}
+			if (n_samples > 8192) {
+				n_samples = 8192;
+			}
+
+			float a_in[8192];
+			rb_read (self->to_fft, a_in, n_samples);
+
+			for (uint32_t n = 0; n < n_samples; ++n) {
+				rms_signal += rms_omega * ((a_in[n] * a_in[n]) - rms_signal) + 1e-20;
+			}
+
+			const uint32_t poly_n = self->poly_n;
+			if (rms_signal > .00000001f) {
+				if (0 == analysis_run (self->an, n_samples, a_in)) {
+					// TODO optimize: split RB here, call _fftx_run ()
+					const bool constq = self->constq;
+					if (constq) {
+						cq_analyze (self->an->cq, self->an->fftx);
+					}
+					const float fft_peakfreq = tuna_find_note (self, constq, rms_signal * self->v_fft);
+
+					if (fft_peakfreq > 0) {
+						rb_write (self->fft_result, &fft_peakfreq, 1);
+					}
+					if (poly_n > 0) {
+						float frame[POLY_FRAME] = { 0, analysis_step (self->an) };
+						if (rms_signal >= self->v_rms) {
+							frame[0] = poly_find_notes (self->an->fftx, rms_signal * self->v_fft, poly_n,
+									&frame[2], &frame[2 + LIBTUNA_POLY_MAX]);
+						}
+						rb_write (self->fft_poly, frame, POLY_FRAME);
+					}
+				}
+			} else if (poly_n > 0) {
+				/* no notes, release voices */
+				const float frame[POLY_FRAME] = { 0, n_samples };
+				rb_write (self->fft_poly, frame, POLY_FRAME);
+			}
+
+			n_samples = rb_read_space (self->to_fft);
+		} while (n_samples > 0);
+	}
+  pthread_mutex_unlock (&self->lock);
+	return NULL;
+}
+
+static void feed_fft (LibTuna* self, const float* data, size_t n_samples) {
+	rb_write (self->to_fft, data, n_samples);
+
+  if (pthread_mutex_trylock (&self->lock) == 0) {
+    pthread_cond_signal (&self->signal);
+    pthread_mutex_unlock (&self->lock);
+  }
+}
+#endif
+
+static void log_print (LibTuna* self, const RtLogRecord* r) {
+	char msg[256];
+	snprintf (msg, sizeof (msg), tuna_log_msg[r->code].fmt, r->v[0], r->v[1], r->v[2], r->v[3]);
+	self->log_cb (self->log_arg, (LibTunaLogLevel)tuna_log_msg[r->code].level, r->time / self->rate, msg);
+}
+
+static void log_stderr (void* arg, LibTunaLogLevel level, double time, const char* msg) {
+	if (time < 0) {
+		fprintf (stderr, "libtuna: %s\n", msg);
+	} else {
+		fprintf (stderr, "libtuna [%.3fs]: %s\n", time, msg);
+	}
+}
+
+static void* log_worker (void* arg) {
+	LibTuna* self = (LibTuna*)arg;
+
+	pthread_mutex_lock (&self->log_lock);
+	while (true) {
+		RtLogRecord r;
+		while (0 == rtlog_read (self->log, &r)) {
+			log_print (self, &r);
+		}
+		const uint32_t dropped = rtlog_dropped (self->log, &self->log_dropped);
+		if (dropped > 0) {
+			char msg[64];
+			snprintf (msg, sizeof (msg), "%u log messages were lost", dropped);
+			self->log_cb (self->log_arg, LIBTUNA_LOG_WARN, -1, msg);
+		}
+		if (!self->log_running) {
+			break;
+		}
+		pthread_cond_wait (&self->log_signal, &self->log_lock);
+	}
+	pthread_mutex_unlock (&self->log_lock);
+	return NULL;
+}
+
+static void wake_log (LibTuna* self) {
+	if (rtlog_read_space (self->log) == 0) {
+		return;
+	}
+	if (pthread_mutex_trylock (&self->log_lock) == 0) {
+		pthread_cond_signal (&self->log_signal);
+		pthread_mutex_unlock (&self->log_lock);
+	}
+}
+
+/* (re)initialize the band-pass filter */
+static void tuna_bandpass(LibTuna *self, const float freq, const float band) {
+	const int bp = bandpass_setup(&self->fb, self->rate, freq, band, 4 /*th order butterworth */);
+	if (bp & BP_CLIP_NYQUIST) {
+		TUNA_LOG(TL_BAND_NYQUIST, 0, freq, band, 0, 0);
+	}
+	if (bp & BP_CLIP_LOW) {
+		TUNA_LOG(TL_BAND_LOW, 0, freq, band, 0, 0);
+	}
+}
+
+/* set DLL loop-bandwidth and band-pass filter
+ * according to the current tracking stage
+ */
+static void dll_set_stage(LibTuna *self, const LibTunaStage stage) {
+	const double fc = self->tuna_fc;
+	/* loop bandwidth per update of the track-stage ..*/
+	double omega = ((fc < 50) ? 4.0 : 3.0) * M_PI * fc / self->rate;
+	double band  = MAX(10, fc * .05);
+
+	if (stage == LIBTUNA_STAGE_ACQUIRE) {
+		/* ..wide-open for rapid capture */
+		omega = MIN(1.0, MAX(2. * omega, DLL_ACQUIRE_OMEGA));
+		band  = MAX(10, fc * .10);
+	}
+
+	self->dll_stage   = stage;
+	self->dll_settled = 0;
+	self->dll_pe      = 0;
+	self->dll_b = 1.4142135623730950488 * omega; // sqrt(2)
+	self->dll_c = omega * omega;
+
+	if (band != self->tuna_bw) {
+		/* restart the filter (a coefficient swap with retained state
+		 * rings for longer than a cold start), then re-align phase */
+		self->tuna_bw = band;
+		self->dll_rephase = DLL_REPHASE;
+		tuna_bandpass(self, fc, band);
+	}
+}
+
+static float freq_to_scale(LibTuna *self, const float freq, int *midinote) {
+	return scale_round(&self->scale, self->tuning, freq, midinote);
+}
+
+/******************************************************************************
+ * sample-loop
+ */
+
+/* re-init detector coefficients with frequency to track */
+static void tuna_retune(LibTuna *self, const float freq) {
+	self->tuna_fc = freq;
+
+	/* re-initialize filter */
+	self->tuna_bw = MAX(10, self->tuna_fc * .10);
+	tuna_bandpass(self, self->tuna_fc, self->tuna_bw);
+	self->filter_init = 16;
+	TUNA_LOG(TL_SET_FILTER, 0, self->tuna_fc, self->tuna_bw, 0, 0);
+
+	/* calculate DLL coefficients, start wide */
+	dll_set_stage(self, LIBTUNA_STAGE_ACQUIRE);
+	self->dll_rephase = 0;
+	self->dll_initialized = false;
+}
+
+/* evaluate FFT result, return frequency to track */
+static float tuna_fft_note(LibTuna *self, float freq, const float rms_signal, const uint32_t n_samples) {
+	/* get lowest peak frequency */
+#ifdef BACKGROUND_FFT
+	float fft_peakfreq = 0;
+	while (0 == rb_read_one (self->fft_result, &fft_peakfreq)) ;
+#else
+	TUNA_PROF_START(t_note);
+	const float fft_peakfreq = tuna_find_note (self, self->constq, rms_signal * self->v_fft);
+#ifdef TUNA_PROFILE
+	const uint64_t dt = tuna_prof_now () - t_note;
+	tuna_prof_add (&self->prof[TP_NOTE], dt);
+	self->prof_note += dt;
+#endif
+#endif
+	if (fft_peakfreq < self->range.fmin || fft_peakfreq > self->range.fmax) {
+		self->fft_note_count = 0;
+		return freq;
+	}
+
+	const float note_freq = freq_to_scale(self, fft_peakfreq, NULL);
+
+	/* keep track of fft stability */
+	if (note_freq == self->fft_scale_freq) {
+		self->fft_note_count+=n_samples;
+	} else {
+		self->fft_note_count = 0;
+	}
+	self->fft_scale_freq = note_freq;
+
+	TUNA_LOG(TL_FFT_PEAK, 0, fft_peakfreq, note_freq, self->fft_note_count, 0);
+
+	if (freq != note_freq &&
+			(   (!self->dll_initialized && self->fft_note_count > 768)
+			 || (self->fft_note_count > 1536 && fabsf(freq - note_freq) > MAX(FFT_FREQ_THESHOLD_MIN, freq * FFT_FREQ_THESHOLD_FAC))
+			 || (self->fft_note_count > self->rate / 8)
+			)
+		 ) {
+		TUNA_LOG(TL_FFT_ADJUST, 0, freq, note_freq, fft_peakfreq, self->fft_note_count);
+		freq = note_freq;
+	}
+	return freq;
+}
+
+/* assign polyphonic notes to voices, and update the result */
+static void tuna_poly_update(LibTuna *self, const uint32_t n_samples, const float* freq, const float* power, const uint32_t n_notes) {
+	LibTunaPolyResult* pr = &self->poly_result;
+
+	poly_track (self->poly_voice, self->poly_n, self->rate, n_samples, freq, power, n_notes);
+
+	pr->updated = true;
+	for (uint32_t k = 0; k < self->poly_n; ++k) {
+		const PolyVoice* v = &self->poly_voice[k];
+		LibTunaNote* n = &pr->note[k];
+		if (!poly_voice_valid (v, self->rate)) {
+			n->freq = 0;
+			continue;
+		}
+		const float note_freq = freq_to_scale(self, v->freq, &n->midinote);
+		n->freq  = v->freq;
+		n->cent  = scale_cent(v->freq / note_freq);
+		n->level = fftx_power_to_dB (v->power);
+	}
+}
+
+/* polyphonic detection, after the FFT ran */
+static void tuna_poly(LibTuna *self) {
+#ifdef BACKGROUND_FFT
+	float frame[POLY_FRAME];
+	while (0 == rb_read (self->fft_poly, frame, POLY_FRAME)) {
+		tuna_poly_update (self, frame[1], &frame[2], &frame[2 + LIBTUNA_POLY_MAX], frame[0]);
+	}
+#else
+	float freq[LIBTUNA_POLY_MAX];
+	float power[LIBTUNA_POLY_MAX];
+	uint32_t n_notes = 0;
+	if (self->rms_signal >= self->v_rms) {
+		n_notes = poly_find_notes (self->an->fftx, self->rms_signal * self->v_fft, self->poly_n, freq, power);
+	}
+	tuna_poly_update (self, analysis_step (self->an), freq, power, n_notes);
+#endif
+}
+
+/* refuse to track insanity. A detected note must be in the range `rg`,
+ * the note on the scale of a peak at its edge may be just outside.
+ * A frequency or note set by the user (rg == NULL) is tracked regardless. */
+static inline bool tuna_freq_valid(const TunaRange *rg, const float freq) {
+	if (freq < 20 || freq > 10000) {
+		return false;
+	}
+	return !rg || (freq * RANGE_TOLERANCE >= rg->fmin && freq <= rg->fmax * RANGE_TOLERANCE);
+}
+
+/******************************************************************************
+ * public API
+ */
+
+LIBTUNA_API
+LibTuna*
+libtuna_alloc (double rate)
+{
+	LibTuna* self = (LibTuna*)calloc(1, sizeof(LibTuna));
+	if(!self) {
+		return NULL;
+	}
+
+	self->rate = rate;
+	self->mode = 0;
+	self->tuning = 440;
+	libtuna_set_scale (self, NULL);
+	self->spectr_active = false;
+
+	self->tuna_fc = 0;
+	self->prev_smpl = 0;
+	self->rms_signal = 0;
+	self->rms_postfilter = 0;
+
+	self->result.updated  = false;
+	self->result.freq     = 0;
+	self->result.midinote = 69;
+	self->result.octave   = 4;
+	self->result.note     = 9;
+	self->result.cent     = 0;
+	self->result.target   = 440;
+	self->result.error    = -100;
+	self->result.rms      = -100;
+	self->result.strobe   = 0;
+	self->result.stage    = LIBTUNA_STAGE_IDLE;
+
+	libtuna_set_threshold (self, LIBTUNA_T_RMS, -75);
+	libtuna_set_threshold (self, LIBTUNA_T_FLT, -45);
+	libtuna_set_threshold (self, LIBTUNA_T_FFT, -40);
+	libtuna_set_threshold (self, LIBTUNA_T_OVR, 20);
+	libtuna_set_threshold (self, LIBTUNA_T_FUN, 5);
+	libtuna_set_threshold (self, LIBTUNA_T_OCT, -30);
+	libtuna_set_threshold (self, LIBTUNA_T_OVT, -15);
+
+	self->rms_omega = 1.0f - expf(-2.0 * M_PI * 15.0 / rate);
+	/* reset DLL */
+	self->dll_initialized = false;
+	self->dll_e0 = self->dll_e2 = 0;
+	self->dll_t1 = self->dll_t0 = 0;
+
+	/* initialize FFT */
+	self->fft_scale_freq = 0;
+	self->fft_note_count = 0;
+	self->fft_initialized = false;
+
+	self->range_set.instrument = LIBTUNA_INSTRUMENT_GENERIC;
+	self->range_set.fmin = 0;
+	self->range_set.fmax = INFINITY;
+	self->range_set.fft_size = 0;
+	tuna_range (&self->range, &self->range_set);
+
+	self->an = libtuna_analysis_alloc (rate, &self->range_set);
+	if (!self->an) {
+		free (self);
+		return NULL;
+	}
+
+	self->partials = partials_alloc (rate);
+	if (!self->partials) {
+		analysis_free (self->an);
+		free (self);
+		return NULL;
+	}
+
+	self->zoom = zoom_alloc (rate);
+	if (!self->zoom) {
+		partials_free (self->partials);
+		analysis_free (self->an);
+		free (self);
+		return NULL;
+	}
+
+#ifdef BACKGROUND_FFT
+	pthread_mutex_init (&self->lock, NULL);
+	pthread_cond_init (&self->signal, NULL);
+
+	self->to_fft = rb_alloc (tuna_fft_size (rate) * 8);
+	self->fft_result = rb_alloc (32);
+	self->fft_poly = rb_alloc (8 * POLY_FRAME);
+	self->keep_running = true;
+	if (pthread_create (&self->thread, NULL, worker, self)) {
+		pthread_mutex_destroy (&self->lock);
+		pthread_cond_destroy (&self->signal);
+		rb_free (self->to_fft);
+		rb_free (self->fft_result);
+		rb_free (self->fft_poly);
+		zoom_free (self->zoom);
+		partials_free (self->partials);
+		analysis_free (self->an);
+		free (self);
+		return NULL;
+	}
+#endif
+#ifdef TUNA_PROFILE
+	for (int i = 0; i < TP_LAST; ++i) {
+		tuna_prof_reset (&self->prof[i]);
+	}
+#endif
+
+	/* the ring is always there, the thread only once something is logged */
+	self->log_cb  = log_stderr;
+	self->log_arg = NULL;
+	self->log = rtlog_alloc (1024);
+	pthread_mutex_init (&self->log_lock, NULL);
+	pthread_cond_init (&self->log_signal, NULL);
+	self->log_level = RTLOG_OFF;
+	self->log_env   = tuna_log_level_from_env ();
+	libtuna_set_log_level (self, LIBTUNA_LOG_OFF);
+
+	return self;
+}
+
+LIBTUNA_API
+void
+libtuna_free (LibTuna* self)
+{
+	if (!self) {
+		return;
+	}
+#ifdef BACKGROUND_FFT
+  pthread_mutex_lock (&self->lock);
+	self->keep_running = false;
+	pthread_cond_signal (&self->signal);
+	pthread_mutex_unlock (&self->lock);
+	pthread_join (self->thread, NULL);
+
+	pthread_mutex_destroy (&self->lock);
+	pthread_cond_destroy (&self->signal);
+	rb_free (self->to_fft);
+	rb_free (self->fft_result);
+	rb_free (self->fft_poly);
+#endif
+
+	if (self->log_started) {
+		pthread_mutex_lock (&self->log_lock);
+		self->log_running = false;
+		pthread_cond_signal (&self->log_signal);
+		pthread_mutex_unlock (&self->log_lock);
+		pthread_join (self->log_thread, NULL);
+	}
+	pthread_mutex_destroy (&self->log_lock);
+	pthread_cond_destroy (&self->log_signal);
+	rtlog_free (self->log);
+
+	zoom_free (self->zoom);
+	partials_free (self->partials);
+	analysis_free (self->an);
+	free(self);
+}
+
+LIBTUNA_API
+void
+libtuna_set_log_callback (LibTuna* self, LibTunaLogCallback cb, void* arg)
+{
+	pthread_mutex_lock (&self->log_lock);
+	self->log_cb  = cb ? cb : log_stderr;
+	self->log_arg = cb ? arg : NULL;
+	pthread_mutex_unlock (&self->log_lock);
+}
+
+LIBTUNA_API
+void
+libtuna_set_log_level (LibTuna* self, LibTunaLogLevel level)
+{
+	int l = MAX((int)level, self->log_env);
+	if (l > RTLOG_OFF && !self->log_started) {
+		self->log_running = true;
+		if (pthread_create (&self->log_thread, NULL, log_worker, self)) {
+			l = RTLOG_OFF;
+		} else {
+			self->log_started = true;
+		}
+	}
+	__atomic_store_n (&self->log_level, l, __ATOMIC_RELAXED);
+}
+
+LIBTUNA_API
+void
+libtuna_set_mode (LibTuna* self, float mode)
+{
+	self->mode = mode;
+}
+
+LIBTUNA_API
+void
+libtuna_set_tuning (LibTuna* self, float tuning)
+{
+	self->tuning = tuning;
+}
+
+LIBTUNA_API
+void
+libtuna_set_scale (LibTuna* self, const LibTunaScale* s)
+{
+	LibTunaScale equal;
+	if (!s) {
+		libtuna_scale_equal (&equal);
+		s = &equal;
+	}
+	scale_table_set (&self->scale, s);
+}
+
+LIBTUNA_API
+void
+libtuna_set_threshold (LibTuna* self, LibTunaThreshold which, float db)
+{
+#define SET_THRESHOLD(VAR) \
+	if (db != self->t_ ## VAR) { \
+		self->t_ ## VAR = db; \
+		self->v_ ## VAR = powf(10, .1 * db); \
+	} \
+	break;
+
+	switch (which) {
+		case LIBTUNA_T_RMS: SET_THRESHOLD(rms)
+		case LIBTUNA_T_FLT: SET_THRESHOLD(flt)
+		case LIBTUNA_T_FFT: SET_THRESHOLD(fft)
+		case LIBTUNA_T_OVR: SET_THRESHOLD(ovr)
+		case LIBTUNA_T_FUN: SET_THRESHOLD(fun)
+		case LIBTUNA_T_OCT: SET_THRESHOLD(oct)
+		case LIBTUNA_T_OVT: SET_THRESHOLD(ovt)
+		default:
+			break;
+	}
+#undef SET_THRESHOLD
+}
+
+LIBTUNA_API
+void
+libtuna_set_spectrum (LibTuna* self, bool enable)
+{
+	self->spectr_active = enable;
+}
+
+LIBTUNA_API
+void
+libtuna_set_constq (LibTuna* self, bool enable)
+{
+	self->constq = enable;
+}
+
+LIBTUNA_API
+void
+libtuna_set_range (LibTuna* self, const LibTunaRange* range)
+{
+	if (range->instrument == self->range_set.instrument
+			&& range->fmin == self->range_set.fmin
+			&& range->fmax == self->range_set.fmax
+			&& range->fft_size == self->range_set.fft_size) {
+		return;
+	}
+	self->range_set = *range;
+	tuna_range (&self->range, range);
+}
+
+LIBTUNA_API
+bool
+libtuna_analysis_outdated (const LibTuna* self)
+{
+	return !analysis_match (self->an, &self->range);
+}
+
+LIBTUNA_API
+LibTunaAnalysis*
+libtuna_swap_analysis (LibTuna* self, LibTunaAnalysis* an)
+{
+#ifdef BACKGROUND_FFT
+	/* the worker holds the lock while it analyzes */
+	if (pthread_mutex_trylock (&self->lock)) {
+		return NULL;
+	}
+#endif
+	LibTunaAnalysis* prev = self->an;
+	an->warmup = an->fftx->window_size - analysis_prefill (an, prev);
+	self->an = an;
+#ifdef BACKGROUND_FFT
+	pthread_mutex_unlock (&self->lock);
+#endif
+	return prev;
+}
+
+LIBTUNA_API
+const LibTunaResult*
+libtuna_result (const LibTuna* self)
+{
+	return &self->result;
+}
+
+LIBTUNA_API
+void
+libtuna_set_polyphony (LibTuna* self, uint32_t n_notes)
+{
+	n_notes = MIN(n_notes, LIBTUNA_POLY_MAX);
+	if (n_notes == self->poly_n) {
+		return;
+	}
+	self->poly_n = n_notes;
+	self->poly_result.n_notes = n_notes;
+	for (uint32_t k = 0; k < LIBTUNA_POLY_MAX; ++k) {
+		self->poly_voice[k].freq = 0;
+		self->poly_voice[k].age  = 0;
+		self->poly_voice[k].hold = 0;
+		self->poly_result.note[k].freq = 0;
+	}
+}
+
+LIBTUNA_API
+const LibTunaPolyResult*
+libtuna_poly_result (const LibTuna* self)
+{
+	return &self->poly_result;
+}
+
+LIBTUNA_API
+void
+libtuna_process (LibTuna* self, const float* a_in, uint32_t n_samples)
+{
+	TUNA_PROF_START(t_run);
+	LibTunaResult* r = &self->result;
+	const float mode = self->mode;
+
+	/* initialize local vars */
+	float freq = self->tuna_fc;
+	bool fft_ran_this_cycle = false;
+	bool fft_active = false;
+
+	/* operation mode */
+	if (mode > 0 && mode < 10000) {
+		/* fixed user-specified frequency */
+		freq = mode;
+		fft_active = false;
+	} else if (mode <= -1 && mode >= -128) {
+		/* midi-note */
+		freq = scale_key(&self->scale, self->tuning, floorf(-1 - mode));
+		fft_active = false;
+	} else {
+		/* auto-detect  - run FFT */
+		fft_active = true;
+	}
+
+#ifdef BACKGROUND_FFT
+	if (fft_active || self->poly_n > 0) {
+		feed_fft (self, a_in, n_samples);
+	}
+	if (!fft_active) {
+		rb_read_clear (self->fft_result);
+	}
+#else
+	if (fft_active || self->spectr_active || self->poly_n > 0) {
+#ifdef TUNA_PROFILE
+		self->an->fftx->prof_window = self->an->fftx->prof_analyze = 0;
+#endif
+		TUNA_PROF_START(t_fft);
+		fft_ran_this_cycle = 0 == analysis_run(self->an, n_samples, a_in);
+		if (fft_ran_this_cycle && self->constq) {
+			cq_analyze (self->an->cq, self->an->fftx);
+		}
+		TUNA_PROF_STOP(&self->prof[TP_FFT], t_fft);
+#ifdef TUNA_PROFILE
+		if (fft_ran_this_cycle) {
+			tuna_prof_add (&self->prof[TP_FFT_WINDOW], self->an->fftx->prof_window);
+			tuna_prof_add (&self->prof[TP_FFT_ANALYZE], self->an->fftx->prof_analyze);
+		}
+#endif
+	}
+#endif
+	self->fft_ran = fft_ran_this_cycle;
+
+	self->poly_result.updated = false;
+#ifdef BACKGROUND_FFT
+	if (self->poly_n > 0) {
+#else
+	if (self->poly_n > 0 && fft_ran_this_cycle) {
+#endif
+		tuna_poly (self);
+	}
+
+#ifdef BACKGROUND_FFT
+	fft_ran_this_cycle = rb_read_space (self->fft_result) > 0;
+#endif
+
+	/* localize variables */
+	const float rms_omega  = self->rms_omega;
+	const float rms_threshold = self->v_rms;
+	const float v_flt = self->v_flt;
+	float prev_smpl = self->prev_smpl;
+	float rms_signal = self->rms_signal;
+	float rms_postfilter = self->rms_postfilter;
+	float detected_freq = 0;
+	uint32_t detected_count = 0;
+	bool fft_pending = fft_active && fft_ran_this_cycle;
+#ifdef OUTPUT_POSTFILTER
+	float * const a_out = self->a_out;
+#endif
+
+	/* the frequency only changes with a FFT result, check it once */
+	bool freq_valid = tuna_freq_valid(fft_active ? &self->range : NULL, freq);
+	if (freq_valid && freq != self->tuna_fc) {
+		tuna_retune(self, freq);
+	}
+
+	/* process every sample */
+#ifdef TUNA_PROFILE
+	self->prof_dll = self->prof_note = 0;
+#endif
+	TUNA_PROF_START(t_loop);
+	for (uint32_t n = 0; n < n_samples; ++n) {
+
+		/* 1) calculate RMS */
+		rms_signal += rms_omega * ((a_in[n] * a_in[n]) - rms_signal) + 1e-20;
+
+		if (rms_signal < rms_threshold) {
+			/* signal below threshold */
+			if (self->dll_initialized) {
+				TUNA_LOG(TL_LOST_LEVEL, n, 10.*fast_log10(2.f *rms_signal), 0, 0, 0);
+			}
+			self->dll_initialized = false;
+			self->fft_initialized = false;
+			self->fft_note_count = 0;
+			prev_smpl = 0;
+#ifdef OUTPUT_POSTFILTER
+			a_out[n] = 0;
+#endif
+			continue;
+		}
+
+		/* 2) detect frequency to track
+		 * use FFT to roughly detect the area
+		 *
+		 * FFT accumulates data and only returns us some
+		 * valid data once in a while..
+		 */
+		if (fft_pending) {
+			fft_pending = false;
+			freq = tuna_fft_note(self, freq, rms_signal, n_samples);
+
+			/* 2a) re-init detector coefficients with frequency to track */
+			freq_valid = tuna_freq_valid(fft_active ? &self->range : NULL, freq);
+			if (freq_valid && freq != self->tuna_fc) {
+				tuna_retune(self, freq);
+			}
+		}
+
+		if (!freq_valid) {
+			self->dll_initialized = false;
+			prev_smpl = 0;
+#ifdef OUTPUT_POSTFILTER
+			a_out[n] = 0;
+#endif
+			continue;
+		}
+
+		/* 3) band-pass filter the signal to clean up the
+		 * waveform for counting zero-transitions.
+		 */
+		const float signal = bandpass_process(&self->fb, a_in[n]);
+
+		if (self->filter_init > 0) {
+			self->filter_init--;
+			rms_postfilter = 0;
+#ifdef OUTPUT_POSTFILTER
+			a_out[n] = signal * (16.0 - self->filter_init) / 16.0;
+#endif
+			continue;
+		}
+#ifdef OUTPUT_POSTFILTER
+		a_out[n] = signal;
+#endif
+
+		/* 4) reject signals outside in the band */
+		rms_postfilter += rms_omega * ( (signal * signal) - rms_postfilter) + 1e-20;
+		if (rms_postfilter < rms_signal * v_flt) {
+			if (self->dll_initialized) {
+				TUNA_LOG(TL_LOST_FILTER, n,
+						10.*fast_log10(2.f *rms_signal),
+						10.*fast_log10(2.f *rms_postfilter), 0, 0);
+			}
+			self->dll_initialized = false;
+			prev_smpl = 0;
+			continue;
+		}
+
+		/* 5) track phase by counting
+		 * rising-edge zero-transitions
+		 * and a 2nd order phase-locked loop
+		 */
+		if (   (signal >= 0 && prev_smpl < 0)
+#ifdef TWO_EDGES
+				|| (signal <= 0 && prev_smpl > 0)
+#endif
+				) {
+			TUNA_PROF_START(t_edge);
+			/* interpolate the time of the zero-crossing
+			 * between the previous and the current sample.
+			 * (the edge-conditions above ensure signal != prev_smpl)
+			 */
+			const double t_zc = (double)(self->monotonic_cnt + n) - signal / (signal - prev_smpl);
+
+			if (!self->dll_initialized) {
+				TUNA_LOG(TL_DLL_INIT, n, self->tuna_fc, 0, 0, 0);
+				/* re-initialize DLL */
+				if (self->dll_stage != LIBTUNA_STAGE_ACQUIRE) {
+					dll_set_stage(self, LIBTUNA_STAGE_ACQUIRE);
+				}
+				self->dll_initialized = true;
+				self->dll_e0 = self->dll_t0 = 0;
+#ifdef TWO_EDGES
+				self->dll_e2 = self->rate / self->tuna_fc / 2.f;
+#else
+				self->dll_e2 = self->rate / self->tuna_fc;
+#endif
+				self->dll_t1 = t_zc + self->dll_e2;
+			} else if (self->dll_rephase > 0) {
+				/* filter's phase-response changed, keep period, re-align phase */
+				--self->dll_rephase;
+				self->dll_t0 = self->dll_t1;
+				self->dll_t1 = t_zc + self->dll_e2;
+			} else {
+				/* phase 'error' = detected_phase - expected_phase */
+				self->dll_e0 = t_zc - self->dll_t1;
+
+				/* gear-shift loop-filter, average phase-error (fraction of a period) */
+				self->dll_pe += (self->dll_e0 * freq / self->rate - self->dll_pe) / DLL_SETTLE_COUNT;
+				if (self->dll_stage == LIBTUNA_STAGE_ACQUIRE) {
+					if (++self->dll_settled >= 2 * DLL_SETTLE_COUNT && fabs (self->dll_pe) < DLL_SETTLE_ERROR) {
+						TUNA_LOG(TL_DLL_TRACK, n, freq, self->dll_pe, 0, 0);
+						dll_set_stage(self, LIBTUNA_STAGE_TRACK);
+					}
+				} else if (fabs (self->dll_pe) > DLL_LOSS_ERROR) {
+					TUNA_LOG(TL_DLL_ACQUIRE, n, freq, self->dll_pe, 0, 0);
+					dll_set_stage(self, LIBTUNA_STAGE_ACQUIRE);
+				}
+
+				/* update DLL, keep track of phase */
+				self->dll_t0 = self->dll_t1;
+				self->dll_t1 += self->dll_b * self->dll_e0 + self->dll_e2;
+				self->dll_e2 += self->dll_c * self->dll_e0;
+
+#ifdef TWO_EDGES
+				const float dfreq0 = self->rate / (self->dll_t1 - self->dll_t0) / 2.f;
+				const float dfreq2 = self->rate / (self->dll_e2) / 2.f;
+#else
+				const float dfreq0 = self->rate / (self->dll_t1 - self->dll_t0);
+				const float dfreq2 = self->rate / (self->dll_e2);
+#endif
+				TUNA_LOG(TL_DLL_UPDATE, n,
+						dfreq0, dfreq2, self->dll_e0, (self->dll_t1 - self->dll_t0) - self->dll_e2);
+
+				float dfreq;
+				if (self->dll_stage == LIBTUNA_STAGE_TRACK) {
+					dfreq = dfreq2;
+				} else if (fabs (self->dll_e0 * freq / self->rate) > .02) {
+					dfreq = dfreq0;
+				} else {
+					dfreq = dfreq2;
+				}
+
+#if 1
+				/* calculate average of all detected values in this cycle.
+				 * this is questionable, just use last value.
+				 */
+				detected_freq += dfreq;
+				detected_count++;
+#else
+				detected_freq = dfreq;
+				detected_count= 1;
+#endif
+			}
+			TUNA_PROF_ACC(self->prof_dll, t_edge);
+		}
+		prev_smpl = signal;
+	}
+#ifdef TUNA_PROFILE
+	{
+		const uint64_t t_flt = tuna_prof_now () - t_loop - self->prof_dll - self->prof_note;
+		tuna_prof_add (&self->prof[TP_FILTER], t_flt);
+		tuna_prof_add (&self->prof[TP_DLL], self->prof_dll);
+	}
+#endif
+
+	/* copy back variables */
+	self->prev_smpl = prev_smpl;
+	self->rms_signal = rms_signal;
+	self->rms_postfilter = rms_postfilter;
+
+	if (!self->dll_initialized) {
+		self->monotonic_cnt = 0;
+	} else {
+		self->monotonic_cnt += n_samples;
+	}
+
+	/* post-processing and data-output */
+	r->updated = detected_count > 0;
+	if (detected_count > 0) {
+		/* calculate average of detected frequency */
+		int note;
+		const float freq_avg = detected_freq / (float)detected_count;
+		/* ..and the corresponding note on the scale */
+		const float note_freq = freq_to_scale(self, freq_avg, &note);
+
+		TUNA_LOG(TL_DETECTED, n_samples, freq_avg, self->dll_e0, 0, 0);
+
+		/* calculate cent difference
+		 * One cent is one hundredth part of the semitone in 12-tone equal temperament
+		 */
+		r->freq     = freq_avg;
+		r->cent     = scale_cent(freq_avg / note_freq);
+		r->target   = note_freq;
+		r->midinote = note;
+		r->octave   = (note/12) -1;
+		r->note     = note%12;
+		r->error    = 100.0 * self->dll_e0 * note_freq / self->rate;
+	}
+	else if (!self->dll_initialized) {
+		/* no signal detected; or below threshold */
+		r->freq  = 0;
+		r->error = 0;
+	}
+	/* else { no change, maybe short cycle } */
+
+	/* input level
+	 * NB. 20 *log10f(sqrt(x)) == 10 * log10f(x) */
+	r->rms    = (rms_signal > .0000000001f) ? 10. * fast_log10(2 * rms_signal) : -100;
+	r->strobe = self->monotonic_cnt / self->rate;
+	r->stage  = self->dll_initialized ? self->dll_stage : LIBTUNA_STAGE_IDLE;
+
+	tuna_partials (self, a_in, n_samples);
+	tuna_zoom (self, a_in, n_samples);
+
+	self->log_time += n_samples;
+	wake_log (self);
+	TUNA_PROF_STOP(&self->prof[TP_RUN], t_run);
+}
+
+#include "libtuna_multi.c"
+#include "partials.c"
+#include "zoom.c"
+
+/* vi:set ts=2 sts=2 sw=2: */
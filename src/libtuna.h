@@ -0,0 +1,350 @@
+/* libtuna -- pitch detection engine of tuna.lv2
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Plain C API, no LV2 dependencies. `make libtuna` builds
+ * build/libtuna.a and build/libtuna.so (link with -lfftw3f -lm -lpthread).
+ *
+ *   LibTuna* t = libtuna_alloc (48000);
+ *   libtuna_set_tuning (t, 440);
+ *   for (;;) {
+ *     libtuna_process (t, buffer, n_samples);   // realtime safe
+ *     const LibTunaResult* r = libtuna_result (t);
+ *     if (r->updated) { printf ("%.2fHz\n", r->freq); }
+ *   }
+ *   libtuna_free (t);
+ *
+ * An instance is not thread-safe: all calls, except for the log-callback
+ * which is called from a background thread, and libtuna_set_log_level(),
+ * must be serialized.
+ */
+
+#ifndef LIBTUNA_H
+#define LIBTUNA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* static, when the engine is compiled into the same translation unit */
+#ifndef LIBTUNA_API
+# ifdef _WIN32
+#  define LIBTUNA_API
+# else
+#  define LIBTUNA_API __attribute__ ((visibility ("default")))
+# endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LibTuna LibTuna;
+
+typedef enum {
+	LIBTUNA_STAGE_IDLE = 0, // no signal, or not locked
+	LIBTUNA_STAGE_ACQUIRE,  // wide loop-bandwidth
+	LIBTUNA_STAGE_TRACK,    // narrow loop-bandwidth, fine tracking
+} LibTunaStage;
+
+/* detection thresholds [dB], see the LV2 plugin's port documentation */
+typedef enum {
+	LIBTUNA_T_RMS = 0, // signal level, default -75
+	LIBTUNA_T_FLT,     // level after band-pass, relative to signal, default -45
+	LIBTUNA_T_FFT,     // FFT peak, relative to signal, default -40
+	LIBTUNA_T_OVR,     // overtone threshold, default 20
+	LIBTUNA_T_FUN,     // fundamental suppression, default 5
+	LIBTUNA_T_OCT,     // octave threshold, default -30
+	LIBTUNA_T_OVT,     // overtone-octave threshold, default -15
+	LIBTUNA_T_LAST
+} LibTunaThreshold;
+
+typedef enum {
+	LIBTUNA_LOG_OFF = 0,
+	LIBTUNA_LOG_WARN,
+	LIBTUNA_LOG_INFO,
+	LIBTUNA_LOG_DEBUG,
+} LibTunaLogLevel;
+
+/* time: [sec] since the instance was created, or < 0 if not applicable */
+typedef void (*LibTunaLogCallback) (void* arg, LibTunaLogLevel level, double time, const char* msg);
+
+/* detection result, updated by libtuna_process()
+ * and valid until the next call.
+ */
+typedef struct {
+	bool  updated;  // a new value was detected during the last cycle
+	float freq;     // [Hz], 0: no signal (all other fields retain their values)
+	int   midinote; // closest note on the scale, 69: A4
+	int   octave;   // midinote / 12 - 1
+	int   note;     // midinote % 12, 0: C
+	float cent;     // deviation from the note [cent]
+	float target;   // [Hz] frequency of the note on the scale
+	float error;    // DLL phase-error [cent of the note's period]
+	float rms;      // input level [dBFS]
+	float strobe;   // [sec] since the DLL locked, phase reference for strobes
+	LibTunaStage stage;
+} LibTunaResult;
+
+/* create an instance for the given sample-rate, NULL on error.
+ * Not realtime safe: allocates memory and plans the FFT.
+ */
+LIBTUNA_API LibTuna* libtuna_alloc (double rate);
+
+LIBTUNA_API void libtuna_free (LibTuna* self);
+
+/* set before the first call to libtuna_process(), the default
+ * callback prints to stderr.
+ */
+LIBTUNA_API void libtuna_set_log_callback (LibTuna* self, LibTunaLogCallback cb, void* arg);
+
+/* verbosity of diagnostics, default off. The TUNA_LOG environment
+ * variable (off, warn, info, debug) sets the minimum level.
+ * Not realtime safe: the first level above off starts a thread that
+ * calls the log-callback. It may be called from another thread while
+ * libtuna_process() runs, e.g. from a worker.
+ */
+LIBTUNA_API void libtuna_set_log_level (LibTuna* self, LibTunaLogLevel level);
+
+/* operation mode, same semantics as the plugin's "mode" port:
+ * 0: auto-detect (default), > 0: track the given frequency [Hz],
+ * -1 .. -128: track the midi-note (-1 - mode)
+ */
+LIBTUNA_API void libtuna_set_mode (LibTuna* self, float mode);
+
+/* frequency of A4 [Hz], default 440 */
+LIBTUNA_API void libtuna_set_tuning (LibTuna* self, float tuning);
+
+/* Scale: the notes that detected frequencies are rounded to, and the
+ * frequencies of the midi-note modes. The frequency of note k is
+ * tuning * ratio[k]: the tuning transposes the scale.
+ */
+typedef struct {
+	float ratio[128];    // frequency of every midi-note, relative to A4
+	float semitone[128]; // the same in 12-TET semitones, 69 + 12 * log2 (ratio)
+	bool  mapped[128];   // false: the note is not on the scale (ratio is 12-TET)
+} LibTunaScale;
+
+/* 12-TET, the default */
+LIBTUNA_API void libtuna_scale_equal (LibTunaScale* s);
+
+/* Parse a Scala scale (.scl) and keyboard mapping (.kbm), either may
+ * be NULL (12-TET, and degree 0 at midi-note 60 which is 261.63Hz).
+ * Not realtime safe. Returns 0 on success, s is unchanged on error.
+ */
+LIBTUNA_API int libtuna_scale_load (LibTunaScale* s, const char* scl, const char* kbm);
+
+/* realtime safe, the scale is copied. NULL: 12-TET */
+LIBTUNA_API void libtuna_set_scale (LibTuna* self, const LibTunaScale* s);
+
+LIBTUNA_API void libtuna_set_threshold (LibTuna* self, LibTunaThreshold which, float db);
+
+/* keep analyzing the spectrum in fixed modes (e.g. to display it) */
+LIBTUNA_API void libtuna_set_spectrum (LibTuna* self, bool enable);
+
+/* find notes on a constant-Q spectrum (3 bins per semitone) instead of
+ * the linear FFT bins, default off. The kernel is computed with the analysis,
+ * by libtuna_alloc() and libtuna_analysis_alloc()
+ */
+LIBTUNA_API void libtuna_set_constq (LibTuna* self, bool enable);
+
+/* Instruments: the range of notes to detect, and the number of octave-
+ * overtones that confirm a fundamental. A smaller range is analyzed
+ * with a smaller FFT of a decimated signal.
+ */
+typedef enum {
+	LIBTUNA_INSTRUMENT_GENERIC = 0, // 20 .. 10000Hz, 4 octaves (default)
+	LIBTUNA_INSTRUMENT_BASS,        // 25 .. 400Hz, 2
+	LIBTUNA_INSTRUMENT_GUITAR,      // 60 .. 1400Hz, 2
+	LIBTUNA_INSTRUMENT_VIOLIN,      // 180 .. 3000Hz, 1
+	LIBTUNA_INSTRUMENT_VOICE,       // 75 .. 1200Hz, 2
+	LIBTUNA_INSTRUMENT_PIANO,       // 27.5 .. 4200Hz, 2
+	LIBTUNA_INSTRUMENT_LAST
+} LibTunaInstrument;
+
+typedef struct {
+	LibTunaInstrument instrument;
+	float fmin; // [Hz] lowest note, limited to the instrument's range
+	float fmax; // [Hz] highest note, ditto
+	/* 0: auto, sized for the range. Else the FFT size (rounded up to a
+	 * power of two, 1024 .. 32768, on ARM 16384) at the decimated rate:
+	 * larger resolves lower notes more precisely, smaller reacts faster
+	 * and needs less CPU. Latency: fft_size * decimation / sample-rate.
+	 */
+	uint32_t fft_size;
+} LibTunaRange;
+
+/* FFT, constant-Q kernel and decimation, sized for a range */
+typedef struct LibTunaAnalysis LibTunaAnalysis;
+
+/* detect notes in the given range only, default: generic 20 .. 10000Hz.
+ * Realtime safe, it applies immediately. The spectrum is analyzed as
+ * before until an analysis for the range is swapped in.
+ */
+LIBTUNA_API void libtuna_set_range (LibTuna* self, const LibTunaRange* range);
+
+/* true if the analysis in use is not sized for the range, realtime safe */
+LIBTUNA_API bool libtuna_analysis_outdated (const LibTuna* self);
+
+/* build an analysis for the range, NULL on error. Not realtime safe */
+LIBTUNA_API LibTunaAnalysis* libtuna_analysis_alloc (double rate, const LibTunaRange* range);
+
+LIBTUNA_API void libtuna_analysis_free (LibTunaAnalysis* an);
+
+/* Replace the analysis, call between libtuna_process() cycles.
+ * Realtime safe. Returns the previous one (to be freed by the caller,
+ * not in realtime context), or NULL if it cannot be replaced now, try
+ * again next cycle. The tracker continues, notes are found with the new
+ * analysis once its window is filled; at the same decimation it starts
+ * with the samples of the previous one. an must be allocated for the
+ * instance's sample-rate.
+ */
+LIBTUNA_API LibTunaAnalysis* libtuna_swap_analysis (LibTuna* self, LibTunaAnalysis* an);
+
+/* analyze a block of audio, realtime safe */
+LIBTUNA_API void libtuna_process (LibTuna* self, const float* in, uint32_t n_samples);
+
+LIBTUNA_API const LibTunaResult* libtuna_result (const LibTuna* self);
+
+/* Polyphonic detection: several simultaneous notes (e.g. a chord)
+ * are extracted from the spectrum, in addition to the monophonic
+ * tracker. A note keeps its slot while it sounds, its frequency follows
+ * the phase of its partials from one FFT to the next. Notes that are
+ * closer than the FFT resolution (a detuned unison) are reported as one,
+ * a note that coincides with an overtone of a lower one may be masked.
+ */
+#define LIBTUNA_POLY_MAX (8)
+
+typedef struct {
+	float freq;     // [Hz], 0: the slot is unused
+	int   midinote; // closest note on the scale
+	float cent;     // deviation from the note [cent]
+	float level;    // level of the fundamental [dBFS]
+} LibTunaNote;
+
+typedef struct {
+	bool        updated; // the spectrum was analyzed during the last cycle
+	uint32_t    n_notes; // number of slots, see libtuna_set_polyphony()
+	LibTunaNote note[LIBTUNA_POLY_MAX];
+} LibTunaPolyResult;
+
+/* detect up to n_notes (0..LIBTUNA_POLY_MAX) notes, 0: off (default).
+ * The FFT keeps running in fixed modes while this is enabled.
+ */
+LIBTUNA_API void libtuna_set_polyphony (LibTuna* self, uint32_t n_notes);
+
+LIBTUNA_API const LibTunaPolyResult* libtuna_poly_result (const LibTuna* self);
+
+/* Partial analysis, for stretch tuning: once the tracker is locked to a
+ * note, partials 1..n are tracked individually (band-pass and DLL, like
+ * the fundamental) and the inharmonicity coefficient B is estimated,
+ * partial n is at  f_n = n * f0 * sqrt (1 + B * n^2)
+ */
+#define LIBTUNA_PARTIALS_MAX (16)
+
+typedef struct {
+	bool     updated;    // new values during the last cycle
+	uint32_t n_partials; // see libtuna_set_partials()
+	float    freq[LIBTUNA_PARTIALS_MAX]; // [Hz] of partial 1..n, 0: not locked
+	float    f0;         // [Hz] fundamental of the fit, 0: less than 3 partials
+	float    B;          // inharmonicity coefficient
+} LibTunaPartials;
+
+/* analyze up to n_partials (0..LIBTUNA_PARTIALS_MAX) partials, 0: off (default) */
+LIBTUNA_API void libtuna_set_partials (LibTuna* self, uint32_t n_partials);
+
+LIBTUNA_API const LibTunaPartials* libtuna_partials_result (const LibTuna* self);
+
+/* Zoomed spectrum: +-100 cent around the note that the tracker is tuned
+ * to, at sub-cent resolution (the signal is mixed down and decimated,
+ * a small FFT analyzes about 500 periods of the note).
+ */
+#define LIBTUNA_ZOOM_BINS (512)
+
+typedef struct {
+	bool     updated; // new spectrum, or fc changed during the last cycle
+	float    fc;      // [Hz] center, 0: no note
+	uint32_t n_bins;  // 0: no data yet
+	float    cent[LIBTUNA_ZOOM_BINS];  // relative to fc
+	float    power[LIBTUNA_ZOOM_BINS]; // [dBFS]
+	float    peak;    // [cent] strongest peak, interpolated
+	float    level;   // [dBFS] of the peak
+} LibTunaZoom;
+
+/* analyze the zoomed spectrum, default off */
+LIBTUNA_API void libtuna_set_zoom (LibTuna* self, bool enable);
+
+LIBTUNA_API const LibTunaZoom* libtuna_zoom_result (const LibTuna* self);
+
+/* Multi-channel variant: independent trackers for up to
+ * LIBTUNA_MULTI_MAX inputs (e.g. a hexaphonic pickup) that share
+ * mode, tuning, thresholds and range. Per-sample state is processed for
+ * all channels in one vectorized loop. The spectra are sized for the
+ * range like libtuna_analysis_alloc(), and the channels are analyzed in
+ * turn, one FFT per libtuna_multi_process() call: a channel's spectrum
+ * is updated every n_channels calls, which delays the detection of a
+ * new note by as many cycles. There is no diagnostics log.
+ */
+#define LIBTUNA_MULTI_MAX (16)
+
+typedef struct LibTunaMulti LibTunaMulti;
+
+/* NULL on error, or if n_channels is not in 1..LIBTUNA_MULTI_MAX.
+ * range: the notes to detect, NULL for the generic instrument. It is
+ * fixed for the lifetime of the instance. Not realtime safe.
+ */
+LIBTUNA_API LibTunaMulti* libtuna_multi_alloc (double rate, uint32_t n_channels, const LibTunaRange* range);
+
+LIBTUNA_API void libtuna_multi_free (LibTunaMulti* self);
+
+LIBTUNA_API void libtuna_multi_set_mode (LibTunaMulti* self, float mode);
+
+LIBTUNA_API void libtuna_multi_set_tuning (LibTunaMulti* self, float tuning);
+
+LIBTUNA_API void libtuna_multi_set_scale (LibTunaMulti* self, const LibTunaScale* s);
+
+LIBTUNA_API void libtuna_multi_set_threshold (LibTunaMulti* self, LibTunaThreshold which, float db);
+
+/* in: one buffer per channel, realtime safe */
+LIBTUNA_API void libtuna_multi_process (LibTunaMulti* self, const float* const* in, uint32_t n_samples);
+
+/* NULL if channel is out of range */
+LIBTUNA_API const LibTunaResult* libtuna_multi_result (const LibTunaMulti* self, uint32_t channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef TUNA_PROFILE
+/* DSP stages that are timed (compile with -DTUNA_PROFILE) */
+typedef enum {
+	TP_RUN = 0,     // complete libtuna_process() cycle
+	TP_FFT,         // fftx_run(), every cycle
+	TP_FFT_WINDOW,  // .. copy samples & apply window
+	TP_FFT_ANALYZE, // .. FFT & power-spectrum
+	TP_NOTE,        // fftx_find_note()
+	TP_FILTER,      // sample-loop: RMS and band-pass cascade
+	TP_DLL,         // sample-loop: zero-crossings and DLL updates
+	TP_LAST
+} TunaProfStage;
+
+/* histogram: one bin per octave, bin 0: < 2^(TUNA_PROF_BIN0 + 1) */
+#define TUNA_PROF_BINS (16)
+#define TUNA_PROF_BIN0 (8)
+#endif
+
+#endif
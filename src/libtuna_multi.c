@@ -0,0 +1,741 @@
+/* libtuna -- multi-channel engine
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* N independent trackers in one instance, e.g. for hexaphonic pickups.
+ * Included by libtuna.c. The partial analysis (partials.c) uses the
+ * trackers with a given frequency per channel, see multi_run().
+ *
+ * Every cycle is processed in chunks, in two passes:
+ *  1) RMS and band-pass of all channels. The state is stored as arrays
+ *     indexed by channel, in groups of MULTI_LANES channels, the lanes
+ *     are processed with 2-wide vectors and have no dependency on each
+ *     other. The biquad recursion is latency bound: the filter runs one
+ *     stage at a time over the whole chunk so that the independent lanes
+ *     fill the pipeline.
+ *  2) thresholds, zero-crossings and the DLL. The DLL is only updated at
+ *     zero-crossings, and its state is kept per channel. All channels are
+ *     interleaved sample by sample, which hides the latency of the
+ *     post-filter RMS.
+ *
+ * The spectra are sized for the range of notes like the single-channel
+ * analysis (see analysis_size()): every channel is anti-aliased and
+ * decimated, and the channels are analyzed in turn with a single plan,
+ * one FFT per cycle. A channel's spectrum is updated every n_channels
+ * cycles, instead of every cycle.
+ *
+ * Differences to the single-channel engine: the band-pass keeps running
+ * while the signal is below threshold, a change of its bandwidth by the
+ * DLL takes effect at the next chunk, the FFT is evaluated at the start
+ * of the cycle, the range is set when the engine is allocated, and there
+ * is no diagnostics log.
+ */
+
+#define MULTI_STAGES (4)   // band-pass, 4th order butterworth
+#define MULTI_LANES  (8)   // channels per group
+#define MULTI_GROUPS (LIBTUNA_MULTI_MAX / MULTI_LANES)
+#define MULTI_CHUNK  (128) // samples per pass
+
+/* two lanes, a SSE register (GCC vector extension) */
+typedef double v2d __attribute__ ((vector_size (16)));
+#define MULTI_VEC (MULTI_LANES / 2)
+
+/* calloc() may not align to 16 bytes, access state with unaligned loads */
+static inline v2d v2d_load (const double* p) { v2d r; memcpy (&r, p, sizeof (v2d)); return r; }
+static inline void v2d_store (double* p, const v2d v) { memcpy (p, &v, sizeof (v2d)); }
+
+/* band-pass coefficients and state of a group [stage][lane] */
+typedef struct {
+	double b0[MULTI_STAGES][MULTI_LANES];
+	double b1[MULTI_STAGES][MULTI_LANES];
+	double b2[MULTI_STAGES][MULTI_LANES];
+	double a1[MULTI_STAGES][MULTI_LANES];
+	double a2[MULTI_STAGES][MULTI_LANES];
+	double z1[MULTI_STAGES][MULTI_LANES];
+	double z2[MULTI_STAGES][MULTI_LANES];
+} MultiBandpass;
+
+/* per channel state of the 2nd pass */
+typedef struct {
+	float tuna_fc; // center freq of expected note
+	float tuna_bw; // bandwidth of the filter
+	float band_max; // upper limit of tuna_bw, 0: none
+	bool  bw_pending; // tuna_bw changed, re-initialize the filter
+	float freq;    // frequency to track this cycle
+	bool  active;  // freq is valid
+
+	float    prev_smpl;
+	float    rms_postfilter;
+	uint32_t filter_init;
+	bool     below; // signal was below threshold
+
+	bool     dll_initialized;
+	int      dll_stage;
+	uint32_t dll_settled;
+	double   dll_pe;
+	uint32_t dll_rephase;
+	uint32_t monotonic_cnt;
+	double dll_e2, dll_e0;
+	double dll_t0, dll_t1;
+	double dll_b, dll_c;
+
+	float fft_scale_freq;
+	int   fft_note_count;
+
+	float    detected_freq;
+	uint32_t detected_count;
+} TunaChannel;
+
+struct LibTunaMulti {
+	/* settings */
+	double   rate;
+	uint32_t n_channels;
+	uint32_t n_groups;
+	float    mode;
+	float    tuning;
+	TunaScale scale;
+	TunaRange range; // notes to detect, sizes the analysis
+
+	/* thresholds [dB] and their power values */
+	float t_rms, v_rms;
+	float t_flt, v_flt;
+	float t_fft, v_fft;
+	float t_ovr, v_ovr;
+	float t_fun, v_fun;
+	float t_oct, v_oct;
+	float t_ovt, v_ovt;
+
+	float rms_omega;
+	bool  ac; // denormal protection, alternating sign
+
+	/* 1st pass, state */
+	float         rms_signal[LIBTUNA_MULTI_MAX];
+	MultiBandpass bp[MULTI_GROUPS];
+
+	/* 1st pass, result [sample][channel] */
+	float buf_rms[MULTI_CHUNK][LIBTUNA_MULTI_MAX];
+	float buf_sig[MULTI_CHUNK][LIBTUNA_MULTI_MAX];
+
+
+	TunaChannel      ch[LIBTUNA_MULTI_MAX];
+	LibTunaResult    result[LIBTUNA_MULTI_MAX];
+
+	/* spectra at rate / decim, anti-aliasing if decim > 1 */
+	struct FFTMulti*  fftx;
+	uint32_t          decim;
+	uint32_t          phase; // input samples since the last decimated sample
+	struct FilterBank aa[LIBTUNA_MULTI_MAX];
+};
+
+/* (re)initialize the band-pass filter of channel c */
+static void multi_bandpass(LibTunaMulti *self, const uint32_t c, const float freq, const float band) {
+	struct FilterBank fb;
+	MultiBandpass* bp = &self->bp[c / MULTI_LANES];
+	const uint32_t k = c % MULTI_LANES;
+	bandpass_setup(&fb, self->rate, freq, band, MULTI_STAGES);
+	for (uint32_t s = 0; s < MULTI_STAGES; ++s) {
+		bp->b0[s][k] = fb.f[s].W[b0];
+		bp->b1[s][k] = fb.f[s].W[b1];
+		bp->b2[s][k] = fb.f[s].W[b2];
+		bp->a1[s][k] = fb.f[s].W[a1];
+		bp->a2[s][k] = fb.f[s].W[a2];
+		bp->z1[s][k] = 0;
+		bp->z2[s][k] = 0;
+	}
+}
+
+/* limit the filter's bandwidth, e.g. to exclude neighboring partials */
+static float multi_band_limit(const TunaChannel* ch, const float band) {
+	return ch->band_max > 0 ? MIN(band, ch->band_max) : band;
+}
+
+/* see dll_set_stage(), the filter is updated by multi_bandwidth() */
+static void multi_dll_set_stage(LibTunaMulti *self, const uint32_t c, const LibTunaStage stage) {
+	TunaChannel* ch = &self->ch[c];
+	const double fc = ch->tuna_fc;
+	double omega = ((fc < 50) ? 4.0 : 3.0) * M_PI * fc / self->rate;
+	double band  = MAX(10, fc * .05);
+
+	if (stage == LIBTUNA_STAGE_ACQUIRE) {
+		omega = MIN(1.0, MAX(2. * omega, DLL_ACQUIRE_OMEGA));
+		band  = MAX(10, fc * .10);
+	}
+	band = multi_band_limit(ch, band);
+
+	ch->dll_stage   = stage;
+	ch->dll_settled = 0;
+	ch->dll_pe      = 0;
+	ch->dll_b = 1.4142135623730950488 * omega; // sqrt(2)
+	ch->dll_c = omega * omega;
+
+	if (band != ch->tuna_bw) {
+		ch->tuna_bw = band;
+		ch->bw_pending = true;
+	}
+}
+
+/* apply a pending change of the filter's bandwidth, between passes */
+static void multi_bandwidth(LibTunaMulti *self, const uint32_t c) {
+	TunaChannel* ch = &self->ch[c];
+	if (ch->bw_pending) {
+		ch->bw_pending = false;
+		ch->dll_rephase = DLL_REPHASE;
+		multi_bandpass(self, c, ch->tuna_fc, ch->tuna_bw);
+	}
+}
+
+/* see tuna_retune() */
+static void multi_retune(LibTunaMulti *self, const uint32_t c, const float freq) {
+	TunaChannel* ch = &self->ch[c];
+	ch->tuna_fc = freq;
+	ch->tuna_bw = multi_band_limit(ch, MAX(10, freq * .10));
+	multi_bandpass(self, c, freq, ch->tuna_bw);
+	ch->filter_init = 16;
+
+	multi_dll_set_stage(self, c, LIBTUNA_STAGE_ACQUIRE);
+	ch->bw_pending = false;
+	ch->dll_rephase = 0;
+	ch->dll_initialized = false;
+}
+
+/* see tuna_fft_note(), n_samples: input samples since the last spectrum of the channel */
+static float multi_fft_note(LibTunaMulti *self, const uint32_t c, float freq, const uint32_t n_samples) {
+	TunaChannel* ch = &self->ch[c];
+	const float fft_peakfreq = fftx_find_note(&self->fftx->ch[c], &self->range, self->rms_signal[c] * self->v_fft, self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
+	if (fft_peakfreq < self->range.fmin || fft_peakfreq > self->range.fmax) {
+		ch->fft_note_count = 0;
+		return freq;
+	}
+
+	const float note_freq = scale_round(&self->scale, self->tuning, fft_peakfreq, NULL);
+
+	if (note_freq == ch->fft_scale_freq) {
+		ch->fft_note_count += n_samples;
+	} else {
+		ch->fft_note_count = 0;
+	}
+	ch->fft_scale_freq = note_freq;
+
+	if (freq != note_freq &&
+			(   (!ch->dll_initialized && ch->fft_note_count > 768)
+			 || (ch->fft_note_count > 1536 && fabsf(freq - note_freq) > MAX(FFT_FREQ_THESHOLD_MIN, freq * FFT_FREQ_THESHOLD_FAC))
+			 || (ch->fft_note_count > self->rate / 8)
+			)
+		 ) {
+		freq = note_freq;
+	}
+	return freq;
+}
+
+/* zero-crossing of channel c at sample n, see libtuna_process() */
+static void multi_edge(LibTunaMulti *self, const uint32_t c, const uint32_t n, const float signal, const float prev_smpl) {
+	TunaChannel* ch = &self->ch[c];
+	const double t_zc = (double)(ch->monotonic_cnt + n) - signal / (signal - prev_smpl);
+	const float freq = ch->freq;
+
+	if (!ch->dll_initialized) {
+		if (ch->dll_stage != LIBTUNA_STAGE_ACQUIRE) {
+			multi_dll_set_stage(self, c, LIBTUNA_STAGE_ACQUIRE);
+		}
+		ch->dll_initialized = true;
+		ch->dll_e0 = ch->dll_t0 = 0;
+#ifdef TWO_EDGES
+		ch->dll_e2 = self->rate / ch->tuna_fc / 2.f;
+#else
+		ch->dll_e2 = self->rate / ch->tuna_fc;
+#endif
+		ch->dll_t1 = t_zc + ch->dll_e2;
+		return;
+	}
+
+	if (ch->dll_rephase > 0) {
+		--ch->dll_rephase;
+		ch->dll_t0 = ch->dll_t1;
+		ch->dll_t1 = t_zc + ch->dll_e2;
+		return;
+	}
+
+	ch->dll_e0 = t_zc - ch->dll_t1;
+
+	ch->dll_pe += (ch->dll_e0 * freq / self->rate - ch->dll_pe) / DLL_SETTLE_COUNT;
+	if (ch->dll_stage == LIBTUNA_STAGE_ACQUIRE) {
+		if (++ch->dll_settled >= 2 * DLL_SETTLE_COUNT && fabs (ch->dll_pe) < DLL_SETTLE_ERROR) {
+			multi_dll_set_stage(self, c, LIBTUNA_STAGE_TRACK);
+		}
+	} else if (fabs (ch->dll_pe) > DLL_LOSS_ERROR) {
+		multi_dll_set_stage(self, c, LIBTUNA_STAGE_ACQUIRE);
+	}
+
+	ch->dll_t0 = ch->dll_t1;
+	ch->dll_t1 += ch->dll_b * ch->dll_e0 + ch->dll_e2;
+	ch->dll_e2 += ch->dll_c * ch->dll_e0;
+
+#ifdef TWO_EDGES
+	const float dfreq0 = self->rate / (ch->dll_t1 - ch->dll_t0) / 2.f;
+	const float dfreq2 = self->rate / (ch->dll_e2) / 2.f;
+#else
+	const float dfreq0 = self->rate / (ch->dll_t1 - ch->dll_t0);
+	const float dfreq2 = self->rate / (ch->dll_e2);
+#endif
+
+	float dfreq;
+	if (ch->dll_stage == LIBTUNA_STAGE_TRACK) {
+		dfreq = dfreq2;
+	} else if (fabs (ch->dll_e0 * freq / self->rate) > .02) {
+		dfreq = dfreq0;
+	} else {
+		dfreq = dfreq2;
+	}
+
+	ch->detected_freq += dfreq;
+	ch->detected_count++;
+}
+
+/* 1st pass: RMS and band-pass of one group of channels */
+static void multi_filter(LibTunaMulti *self, const uint32_t g, const float* const* in, const uint32_t n_samples) {
+	const uint32_t c0 = g * MULTI_LANES;
+	const float rms_omega = self->rms_omega;
+
+	/* unused lanes of the last group process the last channel, the result is ignored */
+	float const* x[MULTI_LANES];
+	for (uint32_t k = 0; k < MULTI_LANES; ++k) {
+		x[k] = in[MIN(c0 + k, self->n_channels - 1)];
+	}
+
+	/* localize variables */
+	MultiBandpass* const restrict bp = &self->bp[g];
+	float rms_signal[MULTI_LANES];
+	for (uint32_t k = 0; k < MULTI_LANES; ++k) {
+		rms_signal[k] = self->rms_signal[c0 + k];
+	}
+	bool ac = self->ac;
+
+	float (* const restrict buf_rms)[LIBTUNA_MULTI_MAX] = self->buf_rms;
+	float (* const restrict buf_sig)[LIBTUNA_MULTI_MAX] = self->buf_sig;
+	v2d v[MULTI_CHUNK][MULTI_VEC]; // input, then output of each stage
+
+	for (uint32_t n = 0; n < n_samples; ++n) {
+		double a_in[MULTI_LANES];
+		ac = !ac;
+		const double nodenormal = ac ? NODENORMAL : -NODENORMAL;
+		for (uint32_t k = 0; k < MULTI_LANES; ++k) {
+			const float x_n = x[k][n];
+			rms_signal[k] += rms_omega * ((x_n * x_n) - rms_signal[k]) + 1e-20;
+			buf_rms[n][c0 + k] = rms_signal[k];
+			a_in[k] = x_n + nodenormal;
+		}
+		for (uint32_t j = 0; j < MULTI_VEC; ++j) {
+			v[n][j] = (v2d){ a_in[2 * j], a_in[2 * j + 1] };
+		}
+	}
+
+	/* one biquad stage at a time, the lanes' state stays in registers */
+	for (uint32_t s = 0; s < MULTI_STAGES; ++s) {
+		v2d b0[MULTI_VEC], b1[MULTI_VEC], b2[MULTI_VEC], a1[MULTI_VEC], a2[MULTI_VEC];
+		v2d w1[MULTI_VEC], w2[MULTI_VEC];
+		for (uint32_t j = 0; j < MULTI_VEC; ++j) {
+			b0[j] = v2d_load (&bp->b0[s][2 * j]);
+			b1[j] = v2d_load (&bp->b1[s][2 * j]);
+			b2[j] = v2d_load (&bp->b2[s][2 * j]);
+			a1[j] = v2d_load (&bp->a1[s][2 * j]);
+			a2[j] = v2d_load (&bp->a2[s][2 * j]);
+			w1[j] = v2d_load (&bp->z1[s][2 * j]);
+			w2[j] = v2d_load (&bp->z2[s][2 * j]);
+		}
+		for (uint32_t n = 0; n < n_samples; ++n) {
+			for (uint32_t j = 0; j < MULTI_VEC; ++j) {
+				const v2d in = v[n][j];
+				const v2d y = b0[j] * in + w1[j];
+				w1[j] = b1[j] * in - a1[j] * y + w2[j];
+				w2[j] = b2[j] * in - a2[j] * y;
+				v[n][j] = y;
+			}
+		}
+		for (uint32_t j = 0; j < MULTI_VEC; ++j) {
+			v2d_store (&bp->z1[s][2 * j], w1[j]);
+			v2d_store (&bp->z2[s][2 * j], w2[j]);
+		}
+	}
+
+	for (uint32_t n = 0; n < n_samples; ++n) {
+		for (uint32_t j = 0; j < MULTI_VEC; ++j) {
+			buf_sig[n][c0 + 2 * j]     = v[n][j][0];
+			buf_sig[n][c0 + 2 * j + 1] = v[n][j][1];
+		}
+	}
+
+	for (uint32_t k = 0; k < MULTI_LANES; ++k) {
+		self->rms_signal[c0 + k] = rms_signal[k];
+	}
+}
+
+/* 2nd pass: thresholds and zero-crossings of all channels, see libtuna_process().
+ * n_offset: position of the chunk in the cycle
+ */
+static void multi_track(LibTunaMulti *self, const uint32_t n_offset, const uint32_t n_samples) {
+	const uint32_t n_channels = self->n_channels;
+	const float rms_omega = self->rms_omega;
+	const float rms_threshold = self->v_rms;
+	const float v_flt = self->v_flt;
+
+	for (uint32_t n = 0; n < n_samples; ++n) {
+		for (uint32_t c = 0; c < n_channels; ++c) {
+			TunaChannel* ch = &self->ch[c];
+			const float rms_signal = self->buf_rms[n][c];
+			if (rms_signal < rms_threshold) {
+				ch->below = true;
+				ch->dll_initialized = false;
+				ch->prev_smpl = 0;
+				continue;
+			}
+
+			if (!ch->active) {
+				continue;
+			}
+
+			const float signal = self->buf_sig[n][c];
+
+			if (ch->filter_init > 0) {
+				--ch->filter_init;
+				ch->rms_postfilter = 0;
+				continue;
+			}
+
+			ch->rms_postfilter += rms_omega * ( (signal * signal) - ch->rms_postfilter) + 1e-20;
+			if (ch->rms_postfilter < rms_signal * v_flt) {
+				ch->dll_initialized = false;
+				ch->prev_smpl = 0;
+				continue;
+			}
+
+			if (   (signal >= 0 && ch->prev_smpl < 0)
+#ifdef TWO_EDGES
+					|| (signal <= 0 && ch->prev_smpl > 0)
+#endif
+					) {
+				multi_edge(self, c, n_offset + n, signal, ch->prev_smpl);
+			}
+			ch->prev_smpl = signal;
+		}
+	}
+}
+
+/* track ch[].freq of every channel, filter, DLL and results.
+ * rg: range of detected notes, NULL if the frequencies are given
+ */
+static void
+multi_run (LibTunaMulti* self, const TunaRange* rg, const float* const* in, uint32_t n_samples)
+{
+	const uint32_t n_channels = self->n_channels;
+
+	for (uint32_t c = 0; c < n_channels; ++c) {
+		TunaChannel* ch = &self->ch[c];
+		ch->detected_freq = 0;
+		ch->detected_count = 0;
+		ch->active = tuna_freq_valid(rg, ch->freq);
+		if (!ch->active) {
+			ch->dll_initialized = false;
+			ch->prev_smpl = 0;
+		} else if (ch->freq != ch->tuna_fc) {
+			multi_retune(self, c, ch->freq);
+		}
+	}
+
+	/* process every sample */
+	for (uint32_t off = 0; off < n_samples; off += MULTI_CHUNK) {
+		const uint32_t ns = MIN(MULTI_CHUNK, n_samples - off);
+		float const* chunk[LIBTUNA_MULTI_MAX];
+		for (uint32_t c = 0; c < n_channels; ++c) {
+			multi_bandwidth(self, c);
+			chunk[c] = &in[c][off];
+		}
+		for (uint32_t g = 0; g < self->n_groups; ++g) {
+			multi_filter(self, g, chunk, ns);
+		}
+		self->ac ^= ns & 1;
+		multi_track(self, off, ns);
+	}
+
+	/* post-processing and data-output, see libtuna_process() */
+	for (uint32_t c = 0; c < n_channels; ++c) {
+		TunaChannel* ch = &self->ch[c];
+		LibTunaResult* r = &self->result[c];
+
+		if (ch->below) {
+			ch->below = false;
+			ch->fft_note_count = 0;
+		}
+
+		if (!ch->dll_initialized) {
+			ch->monotonic_cnt = 0;
+		} else {
+			ch->monotonic_cnt += n_samples;
+		}
+
+		r->updated = ch->detected_count > 0;
+		if (ch->detected_count > 0) {
+			int note;
+			const float freq_avg = ch->detected_freq / (float)ch->detected_count;
+			const float note_freq = scale_round(&self->scale, self->tuning, freq_avg, &note);
+			r->freq     = freq_avg;
+			r->cent     = scale_cent(freq_avg / note_freq);
+			r->target   = note_freq;
+			r->midinote = note;
+			r->octave   = (note/12) -1;
+			r->note     = note%12;
+			r->error    = 100.0 * ch->dll_e0 * note_freq / self->rate;
+		}
+		else if (!ch->dll_initialized) {
+			r->freq  = 0;
+			r->error = 0;
+		}
+
+		const float rms_signal = self->rms_signal[c];
+		r->rms    = (rms_signal > .0000000001f) ? 10. * fast_log10(2 * rms_signal) : -100;
+		r->strobe = ch->monotonic_cnt / self->rate;
+		r->stage  = ch->dll_initialized ? ch->dll_stage : LIBTUNA_STAGE_IDLE;
+	}
+}
+
+/* anti-alias, decimate and add the samples of all channels to the
+ * spectra, see analysis_run() */
+static void
+multi_feed (LibTunaMulti* self, const float* const* in, uint32_t n_samples)
+{
+	const uint32_t decim = self->decim;
+	if (decim == 1) {
+		for (uint32_t c = 0; c < self->n_channels; ++c) {
+			fftx_multi_feed (self->fftx, c, n_samples, in[c]);
+		}
+		return;
+	}
+
+	uint32_t phase = self->phase;
+	for (uint32_t c = 0; c < self->n_channels; ++c) {
+		struct FilterBank* aa = &self->aa[c];
+		float buf[MULTI_CHUNK];
+		uint32_t n = 0;
+		phase = self->phase;
+		for (uint32_t i = 0; i < n_samples; ++i) {
+			const float y = bandpass_process (aa, in[c][i]);
+			if (++phase < decim) {
+				continue;
+			}
+			phase = 0;
+			buf[n] = y;
+			if (++n == MULTI_CHUNK) {
+				fftx_multi_feed (self->fftx, c, n, buf);
+				n = 0;
+			}
+		}
+		if (n > 0) {
+			fftx_multi_feed (self->fftx, c, n, buf);
+		}
+	}
+	self->phase = phase;
+}
+
+/******************************************************************************
+ * public API, multi-channel
+ */
+
+/* range: NULL if the channels are only used with a given
+ * frequency, see multi_run(). Else it sizes the analysis. */
+static LibTunaMulti*
+multi_alloc (double rate, uint32_t n_channels, const TunaRange* range)
+{
+	if (n_channels < 1 || n_channels > LIBTUNA_MULTI_MAX) {
+		return NULL;
+	}
+	LibTunaMulti* self = (LibTunaMulti*)calloc(1, sizeof(LibTunaMulti));
+	if (!self) {
+		return NULL;
+	}
+
+	self->rate = rate;
+	self->n_channels = n_channels;
+	self->n_groups = (n_channels + MULTI_LANES - 1) / MULTI_LANES;
+	self->mode = 0;
+	self->tuning = 440;
+	libtuna_multi_set_scale (self, NULL);
+	self->rms_omega = 1.0f - expf(-2.0 * M_PI * 15.0 / rate);
+
+	libtuna_multi_set_threshold (self, LIBTUNA_T_RMS, -75);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_FLT, -45);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_FFT, -40);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_OVR, 20);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_FUN, 5);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_OCT, -30);
+	libtuna_multi_set_threshold (self, LIBTUNA_T_OVT, -15);
+
+	for (uint32_t c = 0; c < n_channels; ++c) {
+		LibTunaResult* r = &self->result[c];
+		r->updated  = false;
+		r->freq     = 0;
+		r->midinote = 69;
+		r->octave   = 4;
+		r->note     = 9;
+		r->cent     = 0;
+		r->target   = 440;
+		r->error    = -100;
+		r->rms      = -100;
+		r->strobe   = 0;
+		r->stage    = LIBTUNA_STAGE_IDLE;
+	}
+
+	if (!range) {
+		return self;
+	}
+
+	self->fftx = (struct FFTMulti*) calloc(1, sizeof(struct FFTMulti));
+	if (!self->fftx) {
+		free (self);
+		return NULL;
+	}
+
+	uint32_t fft_size;
+	self->range = *range;
+	analysis_size (rate, range, &fft_size, &self->decim);
+	fftx_multi_init(self->fftx, n_channels, fft_size, rate / self->decim);
+
+	if (self->decim > 1) {
+		const double fu = ANALYSIS_AA * rate / self->decim;
+		for (uint32_t c = 0; c < n_channels; ++c) {
+			bandpass_setup (&self->aa[c], rate, .5 * (ANALYSIS_HPF + fu), fu - ANALYSIS_HPF, ANALYSIS_ORDER);
+		}
+	}
+	return self;
+}
+
+LIBTUNA_API
+LibTunaMulti*
+libtuna_multi_alloc (double rate, uint32_t n_channels, const LibTunaRange* range)
+{
+	TunaRange rg = tuna_instruments[LIBTUNA_INSTRUMENT_GENERIC];
+	if (range) {
+		tuna_range (&rg, range);
+	}
+	return multi_alloc (rate, n_channels, &rg);
+}
+
+LIBTUNA_API
+void
+libtuna_multi_free (LibTunaMulti* self)
+{
+	if (!self) {
+		return;
+	}
+	fftx_multi_free(self->fftx);
+	free(self);
+}
+
+LIBTUNA_API
+void
+libtuna_multi_set_mode (LibTunaMulti* self, float mode)
+{
+	self->mode = mode;
+}
+
+LIBTUNA_API
+void
+libtuna_multi_set_tuning (LibTunaMulti* self, float tuning)
+{
+	self->tuning = tuning;
+}
+
+LIBTUNA_API
+void
+libtuna_multi_set_scale (LibTunaMulti* self, const LibTunaScale* s)
+{
+	LibTunaScale equal;
+	if (!s) {
+		libtuna_scale_equal (&equal);
+		s = &equal;
+	}
+	scale_table_set (&self->scale, s);
+}
+
+LIBTUNA_API
+void
+libtuna_multi_set_threshold (LibTunaMulti* self, LibTunaThreshold which, float db)
+{
+#define SET_THRESHOLD(VAR) \
+	if (db != self->t_ ## VAR) { \
+		self->t_ ## VAR = db; \
+		self->v_ ## VAR = powf(10, .1 * db); \
+	} \
+	break;
+
+	switch (which) {
+		case LIBTUNA_T_RMS: SET_THRESHOLD(rms)
+		case LIBTUNA_T_FLT: SET_THRESHOLD(flt)
+		case LIBTUNA_T_FFT: SET_THRESHOLD(fft)
+		case LIBTUNA_T_OVR: SET_THRESHOLD(ovr)
+		case LIBTUNA_T_FUN: SET_THRESHOLD(fun)
+		case LIBTUNA_T_OCT: SET_THRESHOLD(oct)
+		case LIBTUNA_T_OVT: SET_THRESHOLD(ovt)
+		default:
+			break;
+	}
+#undef SET_THRESHOLD
+}
+
+LIBTUNA_API
+const LibTunaResult*
+libtuna_multi_result (const LibTunaMulti* self, uint32_t channel)
+{
+	if (channel >= self->n_channels) {
+		return NULL;
+	}
+	return &self->result[channel];
+}
+
+LIBTUNA_API
+void
+libtuna_multi_process (LibTunaMulti* self, const float* const* in, uint32_t n_samples)
+{
+	const uint32_t n_channels = self->n_channels;
+	const float mode = self->mode;
+
+	/* operation mode, see libtuna_process() */
+	bool fft_active = false;
+	float freq = 0;
+	if (mode > 0 && mode < 10000) {
+		freq = mode;
+	} else if (mode <= -1 && mode >= -128) {
+		freq = scale_key(&self->scale, self->tuning, floorf(-1 - mode));
+	} else {
+		fft_active = true;
+	}
+
+	for (uint32_t c = 0; c < n_channels; ++c) {
+		self->ch[c].freq = fft_active ? self->ch[c].tuna_fc : freq;
+	}
+
+	/* FFT, one channel per cycle */
+	if (fft_active) {
+		multi_feed (self, in, n_samples);
+		const int c = fftx_multi_run (self->fftx);
+		if (c >= 0 && self->rms_signal[c] >= self->v_rms) {
+			const uint32_t step = self->fftx->ch[c].step * self->decim;
+			self->ch[c].freq = multi_fft_note(self, c, self->ch[c].freq, step);
+		}
+	}
+
+	multi_run (self, fft_active ? &self->range : NULL, in, n_samples);
+}
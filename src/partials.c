@@ -0,0 +1,225 @@
+/* libtuna -- partial analysis, inharmonicity
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Measure the partials of the note that the tracker is locked to,
+ * for stretch tuning. Included by libtuna.c, after libtuna_multi.c.
+ *
+ * Partial n is tracked by channel n-1 of a multi-channel engine
+ * (band-pass and DLL, see libtuna_multi.c) that processes the same
+ * input on every channel, all partials are updated in one vectorized
+ * loop. The band-pass is limited to half the fundamental, to exclude
+ * neighboring partials.
+ *
+ * Stiff strings are not harmonic, partial n is at
+ *   f_n = n * f_0 * sqrt (1 + B * n^2)
+ * with (f_n / n)^2 = f_0^2 + f_0^2 * B * n^2 the inharmonicity B is a
+ * linear least-squares fit of the measured partials. Partials that are
+ * not yet locked are retuned to the position predicted by the fit.
+ */
+
+#define PARTIALS_MIN_FIT  (3)    // measured partials for a valid fit
+#define PARTIALS_NOTE_DEV (.03f) // re-start if the fundamental changes by 3% (~ 50 cent)
+#define PARTIALS_RETUNE   (.01f) // move a filter if the prediction differs by 1%
+
+struct TunaPartials {
+	LibTunaMulti*   bank;   // channel n-1: partial n
+	float           f_lock; // fundamental when the bank was tuned, 0: idle
+	float           target[LIBTUNA_PARTIALS_MAX];
+	LibTunaPartials result;
+};
+
+static TunaPartials* partials_alloc (double rate) {
+	TunaPartials* pa = (TunaPartials*)calloc(1, sizeof(TunaPartials));
+	if (!pa) {
+		return NULL;
+	}
+	pa->bank = multi_alloc (rate, LIBTUNA_PARTIALS_MAX, NULL);
+	if (!pa->bank) {
+		free (pa);
+		return NULL;
+	}
+	return pa;
+}
+
+static void partials_free (TunaPartials* pa) {
+	if (!pa) {
+		return;
+	}
+	libtuna_multi_free (pa->bank);
+	free (pa);
+}
+
+/* stop tracking, clear the result */
+static void partials_reset (TunaPartials* pa) {
+	LibTunaPartials* pr = &pa->result;
+	for (uint32_t c = 0; c < LIBTUNA_PARTIALS_MAX; ++c) {
+		pa->target[c] = 0;
+		pa->bank->ch[c].freq = 0;
+		pr->freq[c] = 0;
+	}
+	pr->f0 = 0;
+	pr->B  = 0;
+	pa->f_lock = 0;
+}
+
+/* tune all partials to the harmonic series of the given fundamental */
+static void partials_lock (TunaPartials* pa, const float freq) {
+	partials_reset (pa);
+	pa->f_lock = freq;
+	for (uint32_t c = 0; c < pa->bank->n_channels; ++c) {
+		pa->target[c] = freq * (c + 1);
+		pa->bank->ch[c].band_max = .5f * freq;
+		pa->bank->ch[c].tuna_fc = 0; // force re-tune
+	}
+}
+
+/* least-squares fit of (f_n / n)^2 = a + b * n^2, B = b / a */
+static bool partials_fit (LibTunaPartials* pr) {
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	uint32_t cnt = 0;
+	for (uint32_t c = 0; c < pr->n_partials; ++c) {
+		if (pr->freq[c] <= 0) {
+			continue;
+		}
+		const double n = c + 1;
+		const double x = n * n;
+		const double y = (pr->freq[c] / n) * (pr->freq[c] / n);
+		sx  += x;
+		sy  += y;
+		sxx += x * x;
+		sxy += x * y;
+		++cnt;
+	}
+	if (cnt < PARTIALS_MIN_FIT) {
+		return false;
+	}
+	const double det = cnt * sxx - sx * sx;
+	if (det <= 0) {
+		return false;
+	}
+	const double b = (cnt * sxy - sx * sy) / det;
+	const double a = (sy - b * sx) / cnt;
+	if (a <= 0) {
+		return false;
+	}
+	pr->f0 = sqrt (a);
+	pr->B  = b / a;
+	return true;
+}
+
+/* called by libtuna_process() after the fundamental was analyzed */
+static void tuna_partials (LibTuna *self, const float* a_in, const uint32_t n_samples) {
+	TunaPartials* pa = self->partials;
+	LibTunaPartials* pr = &pa->result;
+	LibTunaMulti* bank = pa->bank;
+	const LibTunaResult* r = &self->result;
+
+	pr->updated = false;
+
+	if (pr->n_partials == 0) {
+		return;
+	}
+
+	if (r->stage == LIBTUNA_STAGE_IDLE || r->freq <= 0) {
+		if (pa->f_lock > 0) {
+			partials_reset (pa);
+			pr->updated = true;
+		}
+		return;
+	}
+
+	if (pa->f_lock == 0) {
+		/* wait for the fundamental to settle */
+		if (r->stage != LIBTUNA_STAGE_TRACK) {
+			return;
+		}
+		partials_lock (pa, r->freq);
+	} else if (fabsf (r->freq - pa->f_lock) > pa->f_lock * PARTIALS_NOTE_DEV) {
+		/* different note, the tracker re-acquires first */
+		partials_reset (pa);
+		pr->updated = true;
+		return;
+	}
+
+	libtuna_multi_set_threshold (bank, LIBTUNA_T_RMS, self->t_rms);
+	libtuna_multi_set_threshold (bank, LIBTUNA_T_FLT, self->t_flt);
+
+	const float* in[LIBTUNA_PARTIALS_MAX];
+	for (uint32_t c = 0; c < bank->n_channels; ++c) {
+		in[c] = a_in;
+		bank->ch[c].freq = pa->target[c];
+	}
+
+	multi_run (bank, NULL, in, n_samples);
+
+	for (uint32_t c = 0; c < bank->n_channels; ++c) {
+		const LibTunaResult* pt = &bank->result[c];
+		if (pt->stage == LIBTUNA_STAGE_TRACK && pt->freq > 0) {
+			pr->updated |= pt->updated;
+			pr->freq[c] = pt->freq;
+		} else {
+			pr->freq[c] = 0;
+		}
+	}
+
+	if (!partials_fit (pr)) {
+		return;
+	}
+
+	/* move partials that are not locked to the predicted position */
+	for (uint32_t c = 0; c < bank->n_channels; ++c) {
+		if (pr->freq[c] > 0) {
+			continue;
+		}
+		const float n = c + 1;
+		const float f = n * pr->f0 * sqrtf (1.f + pr->B * n * n);
+		if (fabsf (f - pa->target[c]) > PARTIALS_RETUNE * pa->target[c]) {
+			pa->target[c] = f;
+		}
+	}
+}
+
+/******************************************************************************
+ * public API, partial analysis
+ */
+
+LIBTUNA_API
+void
+libtuna_set_partials (LibTuna* self, uint32_t n_partials)
+{
+	TunaPartials* pa = self->partials;
+	n_partials = MIN(n_partials, LIBTUNA_PARTIALS_MAX);
+	if (n_partials == pa->result.n_partials) {
+		return;
+	}
+	partials_reset (pa);
+	pa->result.n_partials = n_partials;
+	pa->result.updated = true;
+	if (n_partials > 0) {
+		pa->bank->n_channels = n_partials;
+		pa->bank->n_groups = (n_partials + MULTI_LANES - 1) / MULTI_LANES;
+	}
+}
+
+LIBTUNA_API
+const LibTunaPartials*
+libtuna_partials_result (const LibTuna* self)
+{
+	return &self->partials->result;
+}
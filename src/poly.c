@@ -0,0 +1,266 @@
+/* libtuna -- polyphonic note detection
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Several fundamentals from one spectrum, e.g. the strings of a chord.
+ * Included by libtuna.c.
+ *
+ * 1) pick the spectral peaks, their frequency is the phase-vocoder
+ *    estimate (fftx_freq_at_bin), which tracks the phase of every
+ *    partial from one FFT to the next.
+ * 2) harmonic sieve: every peak is a candidate fundamental, its
+ *    salience is the sum of the amplitudes of its partials. The series
+ *    ends at the 2nd missing partial, which rejects sub-octaves.
+ * 3) the best candidate is a note. Its partials are removed from the
+ *    peak-list down to the spectral envelope (the stronger of the
+ *    neighboring partials), so a partial that is shared with another note
+ *    (octaves, fifths) keeps the excess energy. Repeat 2) until no
+ *    candidate is left, the remaining ones are 12dB below the first note,
+ *    or the requested number of notes is found.
+ *
+ * Notes are assigned to slots (voices), a note keeps its slot while it
+ * sounds and the frequency of each voice is smoothed. Short-lived
+ * detections (residuals of imperfect subtraction, beating partials)
+ * are not reported.
+ */
+
+#define POLY_PEAKS     (64)    // max. spectral peaks, lowest first
+#define POLY_PARTIALS  (16)    // max. partials of a candidate
+#define POLY_TOLERANCE (.03f)  // partial matching, ~ +-50 cent
+#define POLY_DYNAMIC   (.25f)  // -12dB, weakest note relative to the strongest
+#define POLY_FMAX      (8000)  // [Hz] highest partial
+#define POLY_SMOOTH_HZ (5)     // voice frequency low-pass
+#define POLY_ONSET     (.03)   // [sec] a new voice must be detected continuously
+#define POLY_RELEASE   (.15)   // [sec] keep a voice after the note was lost
+
+typedef struct {
+	float freq; // [Hz]
+	float amp;  // residual amplitude, reduced as notes are extracted
+} PolyPeak;
+
+typedef struct {
+	float    freq;  // smoothed [Hz], 0: the slot is free
+	float    power; // of the fundamental
+	uint32_t age;   // samples since the onset
+	uint32_t hold;  // samples since the note was last detected
+} PolyVoice;
+
+/* the voice is sounding, and not a short-lived artifact */
+static bool
+poly_voice_valid (const PolyVoice* v, const double rate)
+{
+	return v->freq > 0 && v->age >= POLY_ONSET * rate;
+}
+
+/* find up to max_notes fundamentals with a power above threshold,
+ * strongest first, return the number of notes found.
+ */
+static uint32_t
+poly_find_notes (struct FFTAnalysis *ft, const float threshold, const uint32_t max_notes, float* freq, float* power)
+{
+	PolyPeak pk[POLY_PEAKS];
+	uint32_t n_peaks = 0;
+
+	const uint32_t brkpos = MIN(ft->data_size - 1, POLY_FMAX / ft->freq_per_bin);
+	for (uint32_t i = 1; i < brkpos && n_peaks < POLY_PEAKS; ++i) {
+		if (
+				ft->power[i] > threshold
+				&& ft->power[i] > ft->power[i-1]
+				&& ft->power[i] > ft->power[i+1]
+			 ) {
+			pk[n_peaks].freq = fftx_freq_at_bin (ft, i);
+			pk[n_peaks].amp  = sqrtf (ft->power[i]);
+			++n_peaks;
+		}
+	}
+
+	float    a_threshold = sqrtf (threshold);
+	uint32_t n_notes = 0;
+
+	while (n_notes < max_notes) {
+		/* 2) harmonic sieve */
+		int   best = -1;
+		float best_score = 0;
+		float best_top = 0;
+		int   best_match[POLY_PARTIALS + 1];
+
+		for (uint32_t c = 0; c < n_peaks; ++c) {
+			if (pk[c].amp < a_threshold) {
+				continue;
+			}
+			const float f0 = pk[c].freq;
+			int      match[POLY_PARTIALS + 1];
+			float    score = pk[c].amp;
+			float    top   = pk[c].amp;
+			uint32_t miss  = 0;
+			uint32_t j     = c + 1;
+
+			for (uint32_t h = 0; h <= POLY_PARTIALS; ++h) {
+				match[h] = -1;
+			}
+			match[1] = c;
+
+			for (uint32_t h = 2; h <= POLY_PARTIALS; ++h) {
+				const float fh  = h * f0;
+				const float tol = MAX(ft->freq_per_bin, POLY_TOLERANCE * fh);
+				if (fh > POLY_FMAX) {
+					break;
+				}
+				/* peaks are sorted by frequency, pick the strongest in range */
+				while (j < n_peaks && pk[j].freq < fh - tol) {
+					++j;
+				}
+				for (uint32_t k = j; k < n_peaks && pk[k].freq <= fh + tol; ++k) {
+					if (pk[k].amp > 0 && (match[h] < 0 || pk[k].amp > pk[match[h]].amp)) {
+						match[h] = k;
+					}
+				}
+				if (match[h] < 0) {
+					if (++miss > 1) {
+						break;
+					}
+					continue;
+				}
+				score += pk[match[h]].amp;
+				top    = MAX(top, pk[match[h]].amp);
+			}
+
+			/* leftovers of previously extracted notes are weak in all partials */
+			if (top < a_threshold) {
+				continue;
+			}
+
+			if (score > best_score) {
+				best_score = score;
+				best_top = top;
+				best = c;
+				memcpy (best_match, match, sizeof (match));
+			}
+		}
+
+		if (best < 0) {
+			break;
+		}
+
+		if (n_notes == 0) {
+			a_threshold = MAX(a_threshold, POLY_DYNAMIC * best_top);
+		}
+
+		freq[n_notes]  = pk[best].freq;
+		power[n_notes] = pk[best].amp * pk[best].amp;
+		++n_notes;
+
+		/* 3) remove the note's partials, down to the spectral envelope */
+		float est[POLY_PARTIALS + 1];
+		uint32_t h_last = 1;
+		for (uint32_t h = 1; h <= POLY_PARTIALS; ++h) {
+			if (best_match[h] < 0) {
+				est[h] = 0;
+				continue;
+			}
+			h_last = h;
+			float nb = 0;
+			for (uint32_t k = MAX(h, 3) - 2; k <= MIN(h + 2, POLY_PARTIALS); ++k) {
+				if (k != h && best_match[k] >= 0) {
+					nb = MAX(nb, pk[best_match[k]].amp);
+				}
+			}
+			const float a = pk[best_match[h]].amp;
+			est[h] = nb > 0 ? MIN(a, nb) : a;
+		}
+		for (uint32_t h = 2; h <= h_last; ++h) {
+			if (best_match[h] >= 0) {
+				pk[best_match[h]].amp -= est[h];
+			}
+		}
+		pk[best].amp = 0;
+	}
+	return n_notes;
+}
+
+/* assign the notes of one analysis to voices.
+ * n_samples: time since the previous analysis
+ */
+static void
+poly_track (PolyVoice* voice, const uint32_t n_voices, const double rate, const uint32_t n_samples,
+		const float* freq, const float* power, const uint32_t n_notes)
+{
+	const float omega = 1.f - expf (-2.f * M_PI * POLY_SMOOTH_HZ * n_samples / rate);
+	bool used[LIBTUNA_POLY_MAX] = { false };
+	bool done[LIBTUNA_POLY_MAX] = { false };
+
+	/* continue voices: the closest one of the same note */
+	for (uint32_t i = 0; i < n_notes; ++i) {
+		int v = -1;
+		for (uint32_t k = 0; k < n_voices; ++k) {
+			if (used[k] || voice[k].freq == 0) {
+				continue;
+			}
+			const float df = fabsf (freq[i] - voice[k].freq);
+			if (df < POLY_TOLERANCE * voice[k].freq && (v < 0 || df < fabsf (freq[i] - voice[v].freq))) {
+				v = k;
+			}
+		}
+		if (v < 0) {
+			continue;
+		}
+		voice[v].freq += omega * (freq[i] - voice[v].freq);
+		voice[v].power = power[i];
+		voice[v].age  += n_samples;
+		voice[v].hold  = 0;
+		used[v] = done[i] = true;
+	}
+
+	/* new notes: a free slot, or the one that was silent longest */
+	for (uint32_t i = 0; i < n_notes; ++i) {
+		if (done[i]) {
+			continue;
+		}
+		int v = -1;
+		for (uint32_t k = 0; k < n_voices; ++k) {
+			if (used[k]) {
+				continue;
+			}
+			if (voice[k].freq == 0) {
+				v = k;
+				break;
+			}
+			if (v < 0 || voice[k].hold > voice[v].hold) {
+				v = k;
+			}
+		}
+		if (v < 0) {
+			break;
+		}
+		voice[v].freq  = freq[i];
+		voice[v].power = power[i];
+		voice[v].age   = 0;
+		voice[v].hold  = 0;
+		used[v] = true;
+	}
+
+	for (uint32_t k = 0; k < n_voices; ++k) {
+		if (used[k] || voice[k].freq == 0) {
+			continue;
+		}
+		voice[k].hold += n_samples;
+		if (voice[k].age < POLY_ONSET * rate || voice[k].hold > POLY_RELEASE * rate) {
+			voice[k].freq = 0;
+		}
+	}
+}
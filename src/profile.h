@@ -0,0 +1,88 @@
+/* per-stage DSP timing
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Only used when compiled with -DTUNA_PROFILE, otherwise the
+ * TUNA_PROF_* macros expand to nothing.
+ *
+ * On x86 the time-stamp counter is used (unit: cycles), elsewhere
+ * the monotonic clock (unit: nanoseconds).
+ * Needs TUNA_PROF_BINS and TUNA_PROF_BIN0 from tuna.h
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef TUNA_PROFILE
+
+#include <stdint.h>
+
+#if defined __x86_64__ || defined __i386__
+# include <x86intrin.h>
+# define TUNA_PROF_UNIT (1) // cycles
+static inline uint64_t tuna_prof_now (void) {
+	return __rdtsc ();
+}
+#else
+# include <time.h>
+# define TUNA_PROF_UNIT (0) // ns
+static inline uint64_t tuna_prof_now (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+typedef struct {
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint32_t count;
+	uint32_t hist[TUNA_PROF_BINS];
+} TunaProfStat;
+
+static inline void tuna_prof_reset (TunaProfStat* s) {
+	memset (s, 0, sizeof (TunaProfStat));
+	s->min = UINT64_MAX;
+}
+
+static inline void tuna_prof_add (TunaProfStat* s, const uint64_t dt) {
+	/* one bin per octave */
+	int bin = 63 - __builtin_clzll (dt | 1) - TUNA_PROF_BIN0;
+	if (bin < 0) bin = 0;
+	if (bin >= TUNA_PROF_BINS) bin = TUNA_PROF_BINS - 1;
+	++s->hist[bin];
+	++s->count;
+	s->sum += dt;
+	if (dt < s->min) s->min = dt;
+	if (dt > s->max) s->max = dt;
+}
+
+# define TUNA_PROF_START(T)     const uint64_t T = tuna_prof_now ()
+# define TUNA_PROF_STOP(S, T)   tuna_prof_add (S, tuna_prof_now () - (T))
+# define TUNA_PROF_ACC(ACC, T)  (ACC) += tuna_prof_now () - (T)
+
+#else
+
+# define TUNA_PROF_START(T)
+# define TUNA_PROF_STOP(S, T)
+# define TUNA_PROF_ACC(ACC, T)
+
+#endif
+
+#endif
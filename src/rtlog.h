@@ -0,0 +1,117 @@
+/* real-time safe diagnostics log
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Lock-free single-producer, single-consumer queue of fixed size
+ * records. The realtime thread only copies a few values, formatting
+ * the message is left to the reader. Records that do not fit are
+ * dropped and counted.
+ */
+
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+	RTLOG_OFF = 0,
+	RTLOG_WARN,
+	RTLOG_INFO,
+	RTLOG_DEBUG,
+} RtLogLevel;
+
+typedef struct {
+	uint64_t time;  // sample-time
+	uint32_t code;  // event code, meaning is up to the application
+	float    v[4];  // event specific values
+} RtLogRecord;
+
+typedef struct {
+	RtLogRecord* data;
+	uint32_t len;
+	uint32_t mask;
+	uint32_t rp;      // modified by the reader only
+	uint32_t wp;      // modified by the writer only
+	uint32_t dropped; // modified by the writer only
+} RtLog;
+
+static RtLog* rtlog_alloc (uint32_t siz) {
+	RtLog* rl = (RtLog*) calloc (1, sizeof (RtLog));
+	uint32_t power_of_two;
+	for (power_of_two = 1; 1U << power_of_two < siz; ++power_of_two);
+	rl->len = 1 << power_of_two;
+	rl->mask = rl->len - 1;
+	rl->data = (RtLogRecord*) calloc (rl->len, sizeof (RtLogRecord));
+	return rl;
+}
+
+static void rtlog_free (RtLog* rl) {
+	if (!rl) {
+		return;
+	}
+	free (rl->data);
+	free (rl);
+}
+
+/* called from the realtime thread */
+static inline int rtlog_write (RtLog* rl, uint64_t time, uint32_t code, float v0, float v1, float v2, float v3) {
+	const uint32_t wp = rl->wp;
+	const uint32_t rp = __atomic_load_n (&rl->rp, __ATOMIC_ACQUIRE);
+	if (((wp + 1) & rl->mask) == rp) {
+		__atomic_store_n (&rl->dropped, rl->dropped + 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	RtLogRecord* r = &rl->data[wp];
+	r->time = time;
+	r->code = code;
+	r->v[0] = v0;
+	r->v[1] = v1;
+	r->v[2] = v2;
+	r->v[3] = v3;
+	__atomic_store_n (&rl->wp, (wp + 1) & rl->mask, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static inline int rtlog_read_space (RtLog* rl) {
+	const uint32_t wp = __atomic_load_n (&rl->wp, __ATOMIC_ACQUIRE);
+	return (rl->len + wp - rl->rp) & rl->mask;
+}
+
+/* called from the reader thread */
+static int rtlog_read (RtLog* rl, RtLogRecord* r) {
+	const uint32_t rp = rl->rp;
+	if (rp == __atomic_load_n (&rl->wp, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+	*r = rl->data[rp];
+	__atomic_store_n (&rl->rp, (rp + 1) & rl->mask, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* number of records that were dropped since the last call.
+ * (the counter is only read, the difference is kept by the caller)
+ */
+static uint32_t rtlog_dropped (RtLog* rl, uint32_t* last) {
+	const uint32_t dropped = __atomic_load_n (&rl->dropped, __ATOMIC_RELAXED);
+	const uint32_t rv = dropped - *last;
+	*last = dropped;
+	return rv;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/* libtuna -- scales, Scala .scl/.kbm files
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The notes that detected frequencies are rounded to. Included by libtuna.c.
+ *
+ * A LibTunaScale assigns a frequency to every midi-note. It is computed
+ * from Scala files when they are loaded (not realtime safe), see
+ *   http://www.huygens-fokker.org/scala/scl_format.html
+ *   http://www.huygens-fokker.org/scala/help.htm#mappings
+ *
+ * The engine keeps the notes of the scale sorted by frequency, with the
+ * geometric mean of neighboring notes as boundary. Rounding a frequency
+ * is a binary search, the deviation in cent is a short series; there are
+ * no calls to log() or pow() while processing.
+ */
+
+#define SCALE_MAX_DEGREES (1024)
+#define SCALE_MIDDLE_C    (261.6255653) // [Hz] 12-TET, A4 = 440Hz
+
+/* sorted notes of a scale, see scale_table_set() */
+typedef struct {
+	uint32_t n;          // notes on the scale, 1..128
+	float    ratio[128]; // ascending, relative to A4 = tuning
+	float    bound[128]; // upper boundary of note i, bound[n-1]: +inf
+	uint8_t  note[128];  // midi-note of ratio[i]
+	float    key[128];   // ratio of every midi-note, also unmapped ones
+} TunaScale;
+
+/* 1200 * log2 (x), x > 0 */
+static inline float scale_cent (float x) {
+	if (!(x > 0 && x < 1e30f)) {
+		return 0;
+	}
+	/* reduce to 1/sqrt(2) .. sqrt(2) */
+	float c = 0;
+	while (x > (float)M_SQRT2) {
+		x *= .5f;
+		c += 1200.f;
+	}
+	while (x < (float)M_SQRT1_2) {
+		x *= 2.f;
+		c -= 1200.f;
+	}
+	/* ln (x) = 2 atanh (u), |u| < .172, the next term is < 1e-6 cent */
+	const float u  = (x - 1.f) / (x + 1.f);
+	const float u2 = u * u;
+	return c + (float)(2400. / M_LN2) * u * (1.f + u2 * (1.f / 3.f + u2 * (1.f / 5.f + u2 * (1.f / 7.f + u2 * (1.f / 9.f)))));
+}
+
+/* index of the note closest to ratio (on a log-scale) */
+static inline uint32_t scale_find (const TunaScale* t, const float ratio) {
+	uint32_t lo = 0;
+	uint32_t hi = t->n - 1;
+	while (lo < hi) {
+		const uint32_t mid = (lo + hi) / 2;
+		if (ratio < t->bound[mid]) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/* round frequency to the closest note on the scale.
+ * use midi notation 0..127 for note-names
+ */
+static inline float scale_round (const TunaScale* t, const float tuning, const float freq, int* midinote) {
+	const uint32_t i = scale_find (t, freq / tuning);
+	if (midinote) *midinote = t->note[i];
+	return tuning * t->ratio[i];
+}
+
+/* frequency of a midi-note, not rounded */
+static inline float scale_key (const TunaScale* t, const float tuning, const int midinote) {
+	return tuning * t->key[MAX (0, MIN (127, midinote))];
+}
+
+/* realtime safe, s is not modified */
+static void scale_table_set (TunaScale* t, const LibTunaScale* s) {
+	uint32_t n = 0;
+	for (int k = 0; k < 128; ++k) {
+		const float r = s->ratio[k];
+		t->key[k] = r;
+		if (!s->mapped[k] || !(r > 0)) {
+			continue;
+		}
+		/* insertion sort, a note that has the same frequency as a lower one
+		 * remains after it, and is removed below */
+		uint32_t i = n++;
+		while (i > 0 && t->ratio[i - 1] > r) {
+			t->ratio[i] = t->ratio[i - 1];
+			t->note[i]  = t->note[i - 1];
+			--i;
+		}
+		t->ratio[i] = r;
+		t->note[i]  = k;
+	}
+
+	uint32_t m = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		if (m > 0 && t->ratio[i] == t->ratio[m - 1]) {
+			continue;
+		}
+		t->ratio[m] = t->ratio[i];
+		t->note[m]  = t->note[i];
+		++m;
+	}
+
+	if (m == 0) {
+		/* nothing mapped */
+		t->ratio[0] = 1;
+		t->note[0]  = 69;
+		m = 1;
+	}
+
+	for (uint32_t i = 0; i + 1 < m; ++i) {
+		t->bound[i] = sqrtf (t->ratio[i] * t->ratio[i + 1]);
+	}
+	t->bound[m - 1] = INFINITY;
+	t->n = m;
+}
+
+/******************************************************************************
+ * Scala files, not realtime safe
+ */
+
+/* next line that is not a comment, without trailing whitespace */
+static char* scala_line (FILE* f, char* buf, size_t len) {
+	while (fgets (buf, len, f)) {
+		if (buf[0] == '!') {
+			continue;
+		}
+		size_t l = strlen (buf);
+		while (l > 0 && (buf[l - 1] == '\n' || buf[l - 1] == '\r' || buf[l - 1] == ' ' || buf[l - 1] == '\t')) {
+			buf[--l] = '\0';
+		}
+		return buf;
+	}
+	return NULL;
+}
+
+/* pitch [cent] of a scale line: cents if it contains a period,
+ * otherwise a ratio "n/d" or an integer. Text after the value is ignored.
+ */
+static bool scala_pitch (const char* line, double* cent) {
+	while (*line == ' ' || *line == '\t') {
+		++line;
+	}
+	size_t len = strcspn (line, " \t");
+	if (memchr (line, '.', len)) {
+		char* end;
+		*cent = strtod (line, &end);
+		return end != line;
+	}
+	char* end;
+	const long num = strtol (line, &end, 10);
+	if (end == line || num <= 0) {
+		return false;
+	}
+	long den = 1;
+	if (*end == '/') {
+		const char* d = end + 1;
+		den = strtol (d, &end, 10);
+		if (end == d || den <= 0) {
+			return false;
+		}
+	}
+	*cent = 1200. * log2 ((double)num / den);
+	return true;
+}
+
+/* cent[0] = 0, cent[1..n]: degrees, cent[n] is the period */
+static int scala_read_scl (const char* path, double* cent, int* n_degrees) {
+	char buf[1024];
+	FILE* f = fopen (path, "r");
+	if (!f) {
+		return -1;
+	}
+	int n = 0;
+	int rv = -1;
+	if (!scala_line (f, buf, sizeof (buf))) { // description
+		goto out;
+	}
+	if (!scala_line (f, buf, sizeof (buf)) || 1 != sscanf (buf, "%d", &n) || n < 1 || n > SCALE_MAX_DEGREES) {
+		goto out;
+	}
+	cent[0] = 0;
+	for (int i = 1; i <= n; ++i) {
+		if (!scala_line (f, buf, sizeof (buf)) || !scala_pitch (buf, &cent[i])) {
+			goto out;
+		}
+	}
+	if (cent[n] <= 0) {
+		goto out;
+	}
+	*n_degrees = n;
+	rv = 0;
+out:
+	fclose (f);
+	return rv;
+}
+
+typedef struct {
+	int    size;     // of the mapping pattern, 0: linear
+	int    first, last;
+	int    middle;   // key of degree 0
+	int    ref_note;
+	double ref_freq;
+	int    octave;   // degree of the formal octave
+	int    map[128]; // degree of every key in the pattern, < 0: unmapped
+} ScalaKbm;
+
+static int scala_read_kbm (const char* path, ScalaKbm* kbm) {
+	char buf[1024];
+	FILE* f = fopen (path, "r");
+	if (!f) {
+		return -1;
+	}
+	int rv = -1;
+	int v[7];
+	for (int i = 0; i < 7; ++i) {
+		if (!scala_line (f, buf, sizeof (buf))) {
+			goto out;
+		}
+		if (i == 5) {
+			if (1 != sscanf (buf, "%lf", &kbm->ref_freq)) {
+				goto out;
+			}
+		} else if (1 != sscanf (buf, "%d", &v[i])) {
+			goto out;
+		}
+	}
+	kbm->size     = v[0];
+	kbm->first    = v[1];
+	kbm->last     = v[2];
+	kbm->middle   = v[3];
+	kbm->ref_note = v[4];
+	kbm->octave   = v[6];
+	if (kbm->size < 0 || kbm->size > 128 || kbm->ref_freq <= 0 || kbm->ref_note < 0 || kbm->ref_note > 127) {
+		goto out;
+	}
+	/* missing entries are not mapped */
+	for (int i = 0; i < kbm->size; ++i) {
+		kbm->map[i] = -1;
+		if (!scala_line (f, buf, sizeof (buf))) {
+			continue;
+		}
+		int d;
+		if (1 == sscanf (buf, "%d", &d) && d >= 0) {
+			kbm->map[i] = d;
+		}
+	}
+	rv = 0;
+out:
+	fclose (f);
+	return rv;
+}
+
+static inline int floor_div (const int a, const int b) {
+	return (a >= 0) ? a / b : -((b - 1 - a) / b);
+}
+
+/* pitch of any degree, relative to degree 0 */
+static double scala_degree (const double* cent, const int n, const int degree) {
+	const int o = floor_div (degree, n);
+	return o * cent[n] + cent[degree - o * n];
+}
+
+/* pitch of a key relative to degree 0, false if it is not mapped */
+static bool scala_key (const double* cent, const int n, const ScalaKbm* kbm, const int key, double* c) {
+	if (key < kbm->first || key > kbm->last) {
+		return false;
+	}
+	if (kbm->size == 0) {
+		*c = scala_degree (cent, n, key - kbm->middle);
+		return true;
+	}
+	const int i = key - kbm->middle;
+	const int o = floor_div (i, kbm->size);
+	const int d = kbm->map[i - o * kbm->size];
+	if (d < 0) {
+		return false;
+	}
+	const int octave = kbm->octave > 0 ? kbm->octave : n;
+	*c = scala_degree (cent, n, d) + o * scala_degree (cent, n, octave);
+	return true;
+}
+
+/******************************************************************************
+ * public API, scales
+ */
+
+LIBTUNA_API
+void
+libtuna_scale_equal (LibTunaScale* s)
+{
+	for (int k = 0; k < 128; ++k) {
+		s->ratio[k]    = pow (2., (k - 69.) / 12.);
+		s->semitone[k] = k;
+		s->mapped[k]   = true;
+	}
+}
+
+LIBTUNA_API
+int
+libtuna_scale_load (LibTunaScale* s, const char* scl, const char* kbm)
+{
+	double* cent = (double*)malloc (sizeof (double) * (SCALE_MAX_DEGREES + 1));
+	if (!cent) {
+		return -1;
+	}
+
+	int n = 12;
+	if (scl) {
+		if (scala_read_scl (scl, cent, &n)) {
+			free (cent);
+			return -1;
+		}
+	} else {
+		for (int i = 0; i <= 12; ++i) {
+			cent[i] = 100. * i;
+		}
+	}
+
+	/* default: degree 0 at middle-C, 12-TET A4 = 440Hz */
+	ScalaKbm map = { 0, 0, 127, 60, 60, SCALE_MIDDLE_C, 0 };
+	if (kbm && scala_read_kbm (kbm, &map)) {
+		free (cent);
+		return -1;
+	}
+
+	double c_ref;
+	if (!scala_key (cent, n, &map, map.ref_note, &c_ref)) {
+		/* the reference key is not mapped */
+		free (cent);
+		return -1;
+	}
+
+	/* semitones of the reference, relative to A4 = 440Hz */
+	const double ref = 69. + 12. * log2 (map.ref_freq / 440.);
+
+	LibTunaScale rv;
+	bool any = false;
+	for (int k = 0; k < 128; ++k) {
+		double c;
+		if (scala_key (cent, n, &map, k, &c)) {
+			rv.semitone[k] = ref + (c - c_ref) / 100.;
+			rv.mapped[k]   = true;
+			any = true;
+		} else {
+			rv.semitone[k] = k;
+			rv.mapped[k]   = false;
+		}
+		rv.ratio[k] = pow (2., (rv.semitone[k] - 69.) / 12.);
+	}
+	free (cent);
+
+	if (!any) {
+		return -1;
+	}
+	*s = rv;
+	return 0;
+}
@@ -86,7 +86,11 @@ bandpass_process(struct FilterBank * const fb, const float in)
 	return out;
 }
 
-static void
+/* flags returned by bandpass_setup() */
+#define BP_CLIP_NYQUIST (1) // band was limited to below nyquist
+#define BP_CLIP_LOW     (2) // band contained sub-bass frequencies
+
+static int
 bandpass_setup(struct FilterBank *fb,
 		double rate,
 		double freq,
@@ -109,25 +113,18 @@ bandpass_setup(struct FilterBank *fb,
 
 	double wl = _wc - (_ww / 2.);
 	double wu = _wc + (_ww / 2.);
+	int rv = 0;
 
+	/* this may be called from the realtime thread,
+	 * leave reporting to the caller */
 	if (wu > M_PI - 1e-9) {
 		/* limit band to below nyquist */
 		wu = M_PI - 1e-9;
-		fprintf(stderr, "tuna.lv2: band f:%9.2fHz (%.2fHz -> %.2fHz) exceeds nysquist (%.0f/2)\n",
-				freq, freq-band/2, freq+band/2, rate);
-		fprintf(stderr, "tuna.lv2: shifted to f:%.2fHz (%.2fHz -> %.2fHz)\n",
-				rate * (wu + wl) *.25 / M_PI,
-				rate * wl * .5 / M_PI,
-				rate * wu * .5 / M_PI);
+		rv |= BP_CLIP_NYQUIST;
 	}
 	if (wl < 1e-9) {
 		wl = 1e-9;
-		fprintf(stderr, "tuna.lv2: band f:%9.2fHz (%.2fHz -> %.2fHz) contains sub-bass frequencies\n",
-				freq, freq-band/2, freq+band/2);
-		fprintf(stderr, "tuna.lv2: shifted to f:%.2fHz (%.2fHz -> %.2fHz)\n",
-				rate * (wu + wl) *.25 / M_PI,
-				rate * wl * .5 / M_PI,
-				rate * wu * .5 / M_PI);
+		rv |= BP_CLIP_LOW;
 	}
 
 	wu *= .5; wl *= .5;
@@ -203,4 +200,5 @@ bandpass_setup(struct FilterBank *fb,
 				flt->W[b0], flt->W[b1], flt->W[b2]);
 	}
 #endif
+	return rv;
 }
@@ -0,0 +1,68 @@
+/* lock-free triple buffer
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Pass the latest state from one writer to one reader, neither waits.
+ *
+ * The application owns three slots; this only hands out indices. The
+ * writer fills its back slot and swaps it with the middle one, the
+ * reader swaps the middle slot with its front slot when it has been
+ * written since. Every slot is owned by one side at a time, so values
+ * are never torn; the reader gets the most recent complete state, older
+ * ones are skipped.
+ */
+
+#ifndef TRIPLEBUF_H
+#define TRIPLEBUF_H
+
+#define TRIPLEBUF_IDX   (3)
+#define TRIPLEBUF_FRESH (4) // middle was written, not yet read
+
+typedef struct {
+	int back;   // writer only
+	int middle; // shared, index | TRIPLEBUF_FRESH
+	int front;  // reader only
+} TripleBuf;
+
+static inline void tb_init (TripleBuf* tb) {
+	tb->back   = 0;
+	tb->middle = 1;
+	tb->front  = 2;
+}
+
+/* writer: slot to fill */
+static inline int tb_back (const TripleBuf* tb) {
+	return tb->back;
+}
+
+/* writer: publish the back slot, continue with another one */
+static inline void tb_publish (TripleBuf* tb) {
+	const int prev = __atomic_exchange_n (&tb->middle, tb->back | TRIPLEBUF_FRESH, __ATOMIC_ACQ_REL);
+	tb->back = prev & TRIPLEBUF_IDX;
+}
+
+/* reader: slot with the most recent state */
+static inline int tb_front (TripleBuf* tb) {
+	if (__atomic_load_n (&tb->middle, __ATOMIC_RELAXED) & TRIPLEBUF_FRESH) {
+		const int prev = __atomic_exchange_n (&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+		tb->front = prev & TRIPLEBUF_IDX;
+	}
+	return tb->front;
+}
+
+#endif
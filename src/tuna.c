@@ -25,145 +25,66 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
-#include <complex.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef HAVE_LV2_1_18_6
 #include <lv2/core/lv2.h>
+#include <lv2/log/logger.h>
+#include <lv2/state/state.h>
+#include <lv2/worker/worker.h>
 #else
 #include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/log/logger.h>
+#include <lv2/lv2plug.in/ns/ext/state/state.h>
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
 #endif
 
 #ifdef DISPLAY_INTERFACE
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
 #include "lv2_rgext.h"
+#include "triplebuf.h"
 #endif
 
-#ifndef MIN
-#define MIN(A,B) ( (A) < (B) ? (A) : (B) )
-#endif
-#ifndef MAX
-#define MAX(A,B) ( (A) > (B) ? (A) : (B) )
-#endif
-
-
-/* use FFT signal if tracked freq & FFT-freq differ by more than */
-#define FFT_FREQ_THESHOLD_FAC (.10f)
-/* but at least .. [Hz] */
-#define FFT_FREQ_THESHOLD_MIN (5.f)
-
-/* for testing only -- output filtered signal */
-//#define OUTPUT_POSTFILTER
-
-/* use both rising and falling signal edge to track phase */
-#define TWO_EDGES
-
-
-/* debug */
-#if 0
-#define info_printf printf
-#else
-void info_printf (const char *fmt,...) {}
-#endif
-
-#if 0 // lots of output
-#define debug_printf printf
-#else
-void debug_printf (const char *fmt,...) {}
-#endif
-
-
 /*****************************************************************************/
 
+#define LIBTUNA_API static
+#include "libtuna.c"
 #include "tuna.h"
-#include "spectr.c"
-#include "fft.c"
 
-#ifdef __ARMEL__
-// TODO also use for "#one" - to spread out load
-// [maybe] run fft in GUI thread for "#two"
-#define BACKGROUND_FFT
-#endif
-
-#ifdef BACKGROUND_FFT
-#include <pthread.h>
-#include "ringbuf.h"
+#ifdef DISPLAY_INTERFACE
+/* state of the tuner, passed from run() to the inline display */
+typedef struct {
+	float freq;
+	float octave;
+	float note;
+	float cent;
+	float error;
+	float rms;
+	float strobe_tme;
+	int   stage; // LibTunaStage
+} TunaDisplayState;
 #endif
 
-/* recursively scan octave-overtones up to 4 octaves */
-static uint32_t fftx_scan_overtones(struct FFTAnalysis *ft,
-		const float threshold, uint32_t bin, uint32_t octave,
-		const float v_oct2)
-{
-	const float scan  = MAX(2, (float) bin * .1f);
-	uint32_t peak_pos = 0;
-	for (uint32_t i = MAX(1, floorf(bin-scan)); i < ceilf(bin+scan); ++i) {
-		if (
-				   ft->power[i] > threshold
-				&& ft->power[i] > ft->power[i-1]
-				&& ft->power[i] > ft->power[i+1]
-			 ) {
-			peak_pos = i;
-			debug_printf("ovt: bin %d oct %d th-fact: %f\n", i, octave, 10.0 * fast_log10(ft->power[i]/ threshold));
-			break;
-		}
-	}
-	if (peak_pos > 0) {
-		octave *= 2;
-		if (octave <= 16) {
-			octave = fftx_scan_overtones(ft, threshold * v_oct2, peak_pos * 2, octave, v_oct2);
-		}
-	}
-	return octave;
-}
-
-/** find lowest peak frequency above a given threshold */
-static float fftx_find_note(struct FFTAnalysis *ft,
-		const float abs_threshold,
-		const float v_ovr, const float v_fun, const float v_oct, const float v_ovt)
-{
-	uint32_t fundamental = 0;
-	uint32_t octave = 0;
-	float peak_dat = 0;
-	const uint32_t brkpos = ft->data_size * 8000 / ft->rate;
-	float threshold = abs_threshold;
-
-	for (uint32_t i = 1; i < brkpos; ++i) {
-		if (
-				ft->power[i] > threshold
-				&& ft->power[i] > ft->power[i-1]
-				&& ft->power[i] > ft->power[i+1]
-			 ) {
-
-			uint32_t o = fftx_scan_overtones(ft, ft->power[i] * v_oct, i * 2, 2, v_ovt);
-			debug_printf("Candidate (%d) %f Hz -> %d overtones\n", i, fftx_freq_at_bin(ft, i) , o);
-
-			if (o > octave
-					|| (ft->power[i] > threshold * v_ovr)
-					) {
-				if (ft->power[i] > peak_dat) {
-					peak_dat = ft->power[i];
-					fundamental = i;
-					octave = o;
-					/* only prefer higher 'fundamental' if it's louder than a /usual/ 1st overtone.  */
-					if (o > 2) threshold = peak_dat * v_fun;
-					//if (o > 16) break;
-				}
-			}
-		}
-	}
-
-	debug_printf("fun: bin: %d octave: %d freq: %.1fHz th-fact: %fdB\n",
-			fundamental, octave, fftx_freq_at_bin(ft, fundamental), 10 * fast_log10(threshold / abs_threshold));
-	if (octave == 0) { return 0; }
-	return fftx_freq_at_bin(ft, fundamental);
-}
-
 /******************************************************************************
  * LV2 routines
  */
 
+/* scale files, index of Tuna::scale_path */
+enum {
+	SCALE_SCL = 0,
+	SCALE_KBM,
+};
+
+/* worker messages, the first member of every message */
+enum {
+	WORK_SCALE = 0, // TunaScaleRequest, TunaScaleResponse
+	WORK_ANALYSIS,  // TunaAnalysisMsg: build an analysis, and swap it in
+	WORK_FREE,      // TunaAnalysisMsg: free the analysis that was replaced
+	WORK_LOG,       // TunaLogMsg: set the log level
+};
+
 typedef struct {
 	/* LV2 ports */
 	float* a_in;
@@ -178,6 +99,20 @@ typedef struct {
 	float* p_cent;
 	float* p_error;
 	float* p_strobe;
+	float* p_stage;
+	float* p_poly;
+	float* p_partials;
+	float* p_constq;
+	float* p_mts;
+	float* p_mts_interval;
+	float* p_mts_hyst;
+	float* p_mts_dump;
+	float* p_instrument;
+	float* p_fmin;
+	float* p_fmax;
+	float* p_fft_size;
+	float* p_log_level;
+	float* p_target;
 
 	float* p_t_rms;
 	float* p_t_flt;
@@ -190,62 +125,52 @@ typedef struct {
 	LV2_Atom_Sequence* notify;
 	const LV2_Atom_Sequence* control;
 
-	/* internal state */
+	/* detection engine */
+	LibTuna* engine;
 	double rate;
-	struct FilterBank fb;
-	float tuna_fc; // center freq of expected note
-	uint32_t filter_init;
 	bool initialize;
 
 	/* rate limit */
-	int   note_last;
-	float cent_last;
+	LibTunaNote poly_last[LIBTUNA_POLY_MAX];
+	uint32_t partials_time; // samples since the last report
+	bool     partials_sent; // a report with locked partials was sent
+
+	/* MTS output */
+	int      mts_note;        // as sent
+	float    mts_cent;
+	int      mts_next_note;   // latest, sent after the interval
+	float    mts_next_cent;
+	bool     mts_pending;
+	uint32_t mts_time;        // samples since the last message
+	float    mts_scale[128];  // collected tuning [cent] of every note, relative to the scale
+	bool     mts_have[128];
+	float    mts_octave[12];  // latest of every pitch class
+	int      mts_octave_note[12];
+	bool     mts_octave_have[12];
+	float    mts_dump_last;   // TUNA_MTS_DUMP, previous value
+	bool     mts_dump_req;
+
+	/* scale, Scala files */
+	LV2_Worker_Schedule* schedule;
+	LibTunaScale scale;                    // as used by the engine
+	char         scale_path[2][TUNA_PATH_MAX]; // files of the scale, "": none
+	char         work_path[2][TUNA_PATH_MAX];  // the same, owned by the worker
+	bool         scale_notify;             // send scale_path
+
+	int          log_level;                // LibTunaLogLevel, as sent to the worker
+
+	/* analysis, sized for the range by the worker */
+	LibTunaRange     analysis_range;   // last request
+	bool             analysis_busy;    // the worker builds one
+	bool             analysis_failed;  // for analysis_range
+	LibTunaAnalysis* analysis_next;    // built, to be swapped in
+	LibTunaAnalysis* analysis_prev;    // replaced, to be freed by the worker
 #ifdef __ARMEL__
 	float freq_last;
-#endif
-
-	/* discriminator */
-	float prev_smpl;
-
-	/* RMS / threshold */
-	float rms_omega;
-	float rms_signal;
-	float rms_postfilter;
+	float cent_last;
 	float rms_last;
-
-	/* port thresholds */
-	float t_rms, v_rms;
-	float t_flt, v_flt;
-	float t_fft, v_fft;
-	float t_ovr, v_ovr;
-	float t_fun, v_fun;
-	float t_oct, v_oct;
-	float t_ovt, v_ovt;
-
-#ifdef BACKGROUND_FFT
-	pthread_mutex_t lock;
-	pthread_cond_t  signal;
-	pthread_t       thread;
-	bool            keep_running;
-
-	ringbuf*        to_fft;
-	ringbuf*        result;
 #endif
 
-	/* DLL */
-	bool dll_initialized;
-	uint32_t monotonic_cnt;
-	double dll_e2, dll_e0;
-	double dll_t0, dll_t1;
-	double dll_b, dll_c;
-
-	/* FFT */
-	struct FFTAnalysis *fftx;
-	bool fft_initialized;
-	float fft_scale_freq;
-	int fft_note_count;
-	int fft_timeout;
-
 	/* GUI communication */
 	LV2_URID_Map* map;
 	LV2_Atom_Forge forge;
@@ -254,6 +179,21 @@ typedef struct {
 
 	/* Spectrum */
 	bool spectr_active;
+	bool zoom_active; // zoomed spectrum instead of the full range
+	uint8_t  spec_last[TUNA_SPEC_BINS]; // as sent to the UI
+	float    spec_thr[256];  // lowest power of quantized level q, see spec_table()
+	uint32_t spec_bins;
+	float    spec_f0, spec_df;
+	int32_t  spec_bpo;
+	uint32_t spec_time; // samples since the last message
+	uint32_t spec_cnt;  // frames since all bins were sent
+
+	/* diagnostics */
+	LV2_Log_Logger  logger;
+
+#ifdef TUNA_PROFILE
+	uint32_t prof_time;  // samples since last report
+#endif
 
 #ifdef DISPLAY_INTERFACE
 	LV2_Inline_Display_Image_Surface surf;
@@ -265,72 +205,51 @@ typedef struct {
 	uint32_t               aspvf;
 	float                  ui_strobe_dpy;
 	float                  ui_strobe_phase;
-	int                    guard1, guard2;
-	float ui_note, ui_octave, ui_cent, ui_strobe_tme;
+	TunaDisplayState       ui_state[3]; // see triplebuf.h
+	TripleBuf              ui_tb;
+	cairo_surface_t*       glyphs;      // TUNA_GLYPHS, outlined
+	int                    glyph_adv, glyph_h;
+	cairo_pattern_t*       strobe[2];   // dash masks of the strobe lines
 #endif
 } Tuna;
 
-#ifdef BACKGROUND_FFT
-static void* worker (void* arg) {
-	Tuna* self = (Tuna*)arg;
-	const float rms_omega  = self->rms_omega;
-	float rms_signal = 0;
-
-  pthread_mutex_lock (&self->lock);
-	while (self->keep_running) {
-		// wait for signal
-    pthread_cond_wait (&self->signal, &self->lock);
+/* run() -> work(), libtuna_set_log_level() may start a thread */
+typedef struct {
+	uint32_t type;  // WORK_LOG
+	uint32_t level; // LibTunaLogLevel
+} TunaLogMsg;
 
-		if (!self->keep_running) {
+/* pass the engine's diagnostics on to the host */
+static void log_lv2 (void* arg, LibTunaLogLevel level, double time, const char* msg) {
+	Tuna* self = (Tuna*)arg;
+	if (time < 0) {
+		lv2_log_warning (&self->logger, "tuna.lv2: %s\n", msg);
+		return;
+	}
+	switch (level) {
+		case LIBTUNA_LOG_WARN:
+			lv2_log_warning (&self->logger, "tuna.lv2 [%.3fs]: %s\n", time, msg);
+			break;
+		case LIBTUNA_LOG_INFO:
+			lv2_log_note (&self->logger, "tuna.lv2 [%.3fs]: %s\n", time, msg);
+			break;
+		default:
+			lv2_log_trace (&self->logger, "tuna.lv2 [%.3fs]: %s\n", time, msg);
 			break;
-		}
-
-		size_t n_samples = rb_read_space (self->to_fft);
-		do {
-			if (n_samples < 1) {
-				break;
-			}
-			if (n_samples > 8192) {
-				n_samples = 8192;
-			}
-
-			float a_in[8192];
-			rb_read (self->to_fft, a_in, n_samples);
-
-			for (uint32_t n = 0; n < n_samples; ++n) {
-				rms_signal += rms_omega * ((a_in[n] * a_in[n]) - rms_signal) + 1e-20;
-			}
-
-			if (rms_signal > .00000001f) {
-				if (0 == fftx_run (self->fftx, n_samples, a_in)) {
-					// TODO optimize: split RB here, call _fftx_run ()
-					const float fft_peakfreq = fftx_find_note (self->fftx,
-							rms_signal * self->v_fft,
-							self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
-
-					if (fft_peakfreq > 0) {
-						rb_write (self->result, &fft_peakfreq, 1);
-					}
-				}
-			}
-
-			n_samples = rb_read_space (self->to_fft);
-		} while (n_samples > 0);
 	}
-  pthread_mutex_unlock (&self->lock);
-	return NULL;
 }
 
-static void feed_fft (Tuna* self, const float* data, size_t n_samples) {
-	rb_write (self->to_fft, data, n_samples);
 
-  if (pthread_mutex_trylock (&self->lock) == 0) {
-    pthread_cond_signal (&self->signal);
-    pthread_mutex_unlock (&self->lock);
-  }
+/* the level is rounded to TUNA_SPEC_FLOOR + (q - 1) / 2 [dB]; instead of
+ * converting every bin to dB, compare the power to the boundaries */
+static void spec_table (float* thr)
+{
+	thr[0] = 0;
+	thr[1] = .00000000063; // (-92dB)^2
+	for (int q = 2; q < 256; ++q) {
+		thr[q] = powf (10.f, .1f * (TUNA_SPEC_FLOOR + .5f * (q - 1.5f)));
+	}
 }
-#endif
-
 
 static LV2_Handle
 instantiate(
@@ -344,9 +263,14 @@ instantiate(
 		return NULL;
 	}
 
+	LV2_Log_Log* log = NULL;
 	for (int i=0; features[i]; ++i) {
 		if (!strcmp(features[i]->URI, LV2_URID__map)) {
 			self->map = (LV2_URID_Map*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_LOG__log)) {
+			log = (LV2_Log_Log*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+			self->schedule = (LV2_Worker_Schedule*)features[i]->data;
 		}
 #ifdef DISPLAY_INTERFACE
 		else if (!strcmp(features[i]->URI, LV2_INLINEDISPLAY__queue_draw)) {
@@ -354,8 +278,10 @@ instantiate(
 		}
 #endif
 	}
+	lv2_log_logger_init (&self->logger, self->map, log);
+
 	if (!self->map) {
-		fprintf(stderr, "tuna.lv2 error: Host does not support urid:map\n");
+		lv2_log_error (&self->logger, "tuna.lv2 error: Host does not support urid:map\n");
 		free(self);
 		return NULL;
 	}
@@ -367,77 +293,33 @@ instantiate(
 
 	self->rate = rate;
 
-	self->tuna_fc = 0;
-	self->prev_smpl = 0;
-	self->rms_signal = 0;
-	self->rms_postfilter = 0;
-	self->rms_last = -100;
-	self->note_last = -1;
-	self->cent_last = 0;
+	self->mts_note = -1;
+	self->mts_next_note = -1;
+	libtuna_scale_equal (&self->scale);
 #ifdef __ARMEL__
 	self->freq_last = 0;
+	self->cent_last = 0;
+	self->rms_last = -100;
 #endif
 	self->initialize = true;
 	self->spectr_active = false;
+	self->zoom_active = false;
+	spec_table (self->spec_thr);
 
-	self->rms_omega = 1.0f - expf(-2.0 * M_PI * 15.0 / rate);
-	/* reset DLL */
-	self->dll_initialized = false;
-	self->dll_e0 = self->dll_e2 = 0;
-	self->dll_t1 = self->dll_t0 = 0;
-
-	/* initialize FFT */
-	self->fft_scale_freq = 0;
-	self->fft_note_count = 0;
-	self->fft_initialized = false;
-
-	self->fftx = (struct FFTAnalysis*) calloc(1, sizeof(struct FFTAnalysis));
-	int fft_size;
-	fft_size = MAX(6144, rate / 15);
-
-	/* round up to next power of two */
-	fft_size--;
-	fft_size |= fft_size >> 1;
-	fft_size |= fft_size >> 2;
-	fft_size |= fft_size >> 4;
-	fft_size |= fft_size >> 8;
-	fft_size |= fft_size >> 16;
-	fft_size++;
-	fft_size = MIN(32768, fft_size);
-
-#ifdef __ARMEL__
-	// TODO investigate autocorrelation
-	// https://en.wikipedia.org/wiki/Wiener%E2%80%93Khinchin_theorem
-	// http://miracle.otago.ac.nz/tartini/papers/A_Smarter_Way_to_Find_Pitch.pdf
-	// for "note finding"
-	fft_size = MIN(16384, fft_size);
-#endif
-
-	fftx_init(self->fftx, fft_size, rate, 0);
+	self->engine = libtuna_alloc (rate);
+	if (!self->engine) {
+		free (self);
+		return NULL;
+	}
+	libtuna_set_log_callback (self->engine, log_lv2, self);
 
 	/* map LV2 Atom URIs */
 	map_tuna_uris(self->map, &self->uris);
 	lv2_atom_forge_init(&self->forge, self->map);
 
-#ifdef BACKGROUND_FFT
-	pthread_mutex_init (&self->lock, NULL);
-	pthread_cond_init (&self->signal, NULL);
-
-	self->to_fft = rb_alloc (fft_size * 8);
-	self->result = rb_alloc (32);
-	self->keep_running = true;
-	if (pthread_create (&self->thread, NULL, worker, self)) {
-		pthread_mutex_destroy (&self->lock);
-		pthread_cond_destroy (&self->signal);
-		rb_free (self->to_fft);
-		rb_free (self->result);
-		fftx_free(self->fftx);
-		free (self);
-		return NULL;
-	}
-#endif
 #ifdef DISPLAY_INTERFACE
 	self->aspvf = rate / 25;
+	tb_init (&self->ui_tb);
 #endif
 	return (LV2_Handle)self;
 }
@@ -490,6 +372,48 @@ connect_port_tuna(
 		case TUNA_STROBE:
 			self->p_strobe = (float*)data;
 			break;
+		case TUNA_STAGE:
+			self->p_stage = (float*)data;
+			break;
+		case TUNA_POLY:
+			self->p_poly = (float*)data;
+			break;
+		case TUNA_PARTIALS:
+			self->p_partials = (float*)data;
+			break;
+		case TUNA_CONSTQ:
+			self->p_constq = (float*)data;
+			break;
+		case TUNA_MTS:
+			self->p_mts = (float*)data;
+			break;
+		case TUNA_MTS_INTERVAL:
+			self->p_mts_interval = (float*)data;
+			break;
+		case TUNA_MTS_HYST:
+			self->p_mts_hyst = (float*)data;
+			break;
+		case TUNA_MTS_DUMP:
+			self->p_mts_dump = (float*)data;
+			break;
+		case TUNA_INSTRUMENT:
+			self->p_instrument = (float*)data;
+			break;
+		case TUNA_FMIN:
+			self->p_fmin = (float*)data;
+			break;
+		case TUNA_FMAX:
+			self->p_fmax = (float*)data;
+			break;
+		case TUNA_FFT_SIZE:
+			self->p_fft_size = (float*)data;
+			break;
+		case TUNA_LOG_LEVEL:
+			self->p_log_level = (float*)data;
+			break;
+		case TUNA_TARGET:
+			self->p_target = (float*)data;
+			break;
 		case TUNA_T_RMS:
 			self->p_t_rms = (float*)data;
 			break;
@@ -512,92 +436,731 @@ connect_port_tuna(
 			self->p_t_ovt = (float*)data;
 			break;
 	}
-}
+}
+
+/* upper bound of the size of the message sent by tx_spectrum() */
+#define TUNA_SPEC_MSG_SIZE (256 + TUNA_SPEC_BINS)
+
+/* the quantized level of a bin, the highest q with thr[q] <= power */
+static inline uint8_t spec_quantize (const float* thr, const float power)
+{
+	uint32_t q = 0;
+	for (uint32_t step = 128; step > 0; step >>= 1) {
+		if (thr[q + step] <= power) {
+			q += step;
+		}
+	}
+	return q;
+}
+
+/* send the spectrum up to TUNA_SPEC_FMAX, FFT bins or
+ * constant-Q bins (cq != NULL), the bins that changed */
+static void tx_spectrum(Tuna *self, struct FFTAnalysis *ft, const ConstQ *cq)
+{
+	/* grid, FFT: from bin 1 */
+	uint32_t bins;
+	float f0, df;
+	int32_t bpo;
+	const float* power;
+	if (cq) {
+		for (bins = 0; bins < cq->n_bins && cq->freq[bins] < TUNA_SPEC_FMAX; ++bins) ;
+		f0    = cq->freq[0];
+		df    = 0;
+		bpo   = CQ_BPO;
+		power = cq->power;
+	} else {
+		bins  = MIN(TUNA_SPEC_FMAX / ft->freq_per_bin, ft->data_size - 1) - 1;
+		f0    = ft->freq_per_bin;
+		df    = ft->freq_per_bin;
+		bpo   = 0;
+		power = &ft->power[1];
+	}
+	bins = MIN(bins, TUNA_SPEC_BINS);
+
+	if (bins != self->spec_bins || f0 != self->spec_f0 || df != self->spec_df || bpo != self->spec_bpo) {
+		self->spec_bins = bins;
+		self->spec_f0   = f0;
+		self->spec_df   = df;
+		self->spec_bpo  = bpo;
+		self->spec_cnt  = 0;
+	}
+
+	/* all bins once in a while, in case a message was lost */
+	const bool key = self->spec_cnt == 0;
+	self->spec_cnt = (self->spec_cnt + 1) % TUNA_SPEC_KEY;
+
+	/* quantize, find the changed range */
+	uint8_t q[TUNA_SPEC_BINS];
+	uint32_t start = bins;
+	uint32_t end   = 0;
+	for (uint32_t i = 0; i < bins; ++i) {
+		q[i] = spec_quantize (self->spec_thr, power[i]);
+		if (q[i] != self->spec_last[i]) {
+			start = MIN(start, i);
+			end   = i + 1;
+		}
+	}
+	if (key) {
+		start = 0;
+		end   = bins;
+	}
+	if (start >= end) {
+		start = end = 0;
+	}
+
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 1, self->uris.spectrum);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_f0, 0);
+	lv2_atom_forge_float(&self->forge, f0);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_df, 0);
+	lv2_atom_forge_float(&self->forge, df);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_bpo, 0);
+	lv2_atom_forge_int(&self->forge, bpo);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_bins, 0);
+	lv2_atom_forge_int(&self->forge, bins);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_start, 0);
+	lv2_atom_forge_int(&self->forge, start);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_q, 0);
+	lv2_atom_forge_atom(&self->forge, end - start, self->uris.atom_Chunk);
+	lv2_atom_forge_write(&self->forge, &q[start], end - start);
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+
+	memcpy (self->spec_last, q, bins);
+}
+
+#ifdef TUNA_PROFILE
+/* upper bound of the size of the message sent by tx_profile() */
+#define TUNA_PROF_MSG_SIZE (1024 + TP_LAST * TUNA_PROF_BINS * sizeof (int32_t))
+
+/* send per-stage timing statistics to the UI */
+static void tx_profile(Tuna *self)
+{
+	int32_t prof_count[TP_LAST];
+	float   prof_min[TP_LAST], prof_avg[TP_LAST], prof_max[TP_LAST];
+	int32_t prof_hist[TP_LAST * TUNA_PROF_BINS];
+
+	for (int i = 0; i < TP_LAST; ++i) {
+		const TunaProfStat *ps = &self->engine->prof[i];
+		prof_count[i] = ps->count;
+		prof_min[i] = ps->count > 0 ? ps->min : 0;
+		prof_avg[i] = ps->count > 0 ? ps->sum / (double)ps->count : 0;
+		prof_max[i] = ps->max;
+		for (int b = 0; b < TUNA_PROF_BINS; ++b) {
+			prof_hist[i * TUNA_PROF_BINS + b] = ps->hist[b];
+		}
+	}
+
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 1, self->uris.profile);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_unit, 0);
+	lv2_atom_forge_int(&self->forge, TUNA_PROF_UNIT);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_count, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(int32_t), self->uris.atom_Int, TP_LAST, prof_count);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_min, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, TP_LAST, prof_min);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_avg, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, TP_LAST, prof_avg);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_max, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, TP_LAST, prof_max);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.prof_hist, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(int32_t), self->uris.atom_Int, TP_LAST * TUNA_PROF_BINS, prof_hist);
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+}
+#endif
+
+/* upper bound of the size of the message sent by tx_poly() */
+#define TUNA_POLY_MSG_SIZE (160)
+
+/* send a note of the polyphonic detection */
+static void tx_poly(Tuna *self, const uint32_t voice, const LibTunaNote *n)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 1, self->uris.poly);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.poly_voice, 0);
+	lv2_atom_forge_int(&self->forge, voice);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.poly_freq, 0);
+	lv2_atom_forge_float(&self->forge, n->freq);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.poly_note, 0);
+	lv2_atom_forge_int(&self->forge, n->midinote);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.poly_cent, 0);
+	lv2_atom_forge_float(&self->forge, n->cent);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.poly_level, 0);
+	lv2_atom_forge_float(&self->forge, n->level);
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+/* upper bound of the size of the message sent by tx_partials() */
+#define TUNA_PARTIALS_MSG_SIZE (128 + LIBTUNA_PARTIALS_MAX * sizeof (float))
+
+/* send measured partials and inharmonicity */
+static void tx_partials(Tuna *self, const LibTunaPartials *pr)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 1, self->uris.partials);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.partials_f0, 0);
+	lv2_atom_forge_float(&self->forge, pr->f0);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.partials_B, 0);
+	lv2_atom_forge_float(&self->forge, pr->B);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.partials_freq, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, pr->n_partials, pr->freq);
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+/* upper bound of the size of the message sent by tx_zoom() */
+#define TUNA_ZOOM_MSG_SIZE (256 + 2 * LIBTUNA_ZOOM_BINS * sizeof (float))
+
+/* send the zoomed spectrum: x [cent] relative to fc, y [dB] */
+static void tx_zoom(Tuna *self, const LibTunaZoom *zr)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 1, self->uris.zoom);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.zoom_fc, 0);
+	lv2_atom_forge_float(&self->forge, zr->fc);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.zoom_peak, 0);
+	lv2_atom_forge_float(&self->forge, zr->peak);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_data_x, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, zr->n_bins, zr->cent);
+
+	lv2_atom_forge_property_head(&self->forge, self->uris.spec_data_y, 0);
+	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, zr->n_bins, zr->power);
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+/* upper bound of the size of a sysex message of `len` bytes */
+#define TUNA_MTS_MSG_SIZE(len) (32 + (len))
+#define TUNA_MTS_NOTE_LEN   (12)
+#define TUNA_MTS_BULK_LEN   (408)
+#define TUNA_MTS_OCTAVE_LEN (21)
+
+static void tx_sysex (Tuna *self, const uint8_t* syx, const uint32_t len) {
+	LV2_Atom midiatom;
+	midiatom.type = self->uris.midi_Event;
+	midiatom.size = len;
+	lv2_atom_forge_frame_time (&self->forge, 0);
+	lv2_atom_forge_raw (&self->forge, &midiatom, sizeof(LV2_Atom));
+	lv2_atom_forge_raw (&self->forge, syx, len);
+	lv2_atom_forge_pad (&self->forge, sizeof(LV2_Atom) + midiatom.size);
+}
+
+/* 12-TET semitones of a note on the scale, with a deviation [cent] */
+static double mts_semitone (const Tuna *self, const int note, const float cent) {
+	return self->scale.semitone[note] + cent / 100.;
+}
+
+/* MTS frequency data: semitone and 14 bit fraction [100/16384 cent] */
+static void mts_freq (uint8_t* d, const double semitone) {
+	if (semitone < 0) {
+		d[0] = d[1] = d[2] = 0;
+		return;
+	}
+	const int note = MIN (127, floor (semitone));
+	/* 7f 7f 7f is reserved: no change */
+	uint16_t cc = MIN (note < 127 ? 16383 : 16382, floor (16383. * (semitone - note)));
+	d[0] = note;
+	d[1] = cc >> 7;
+	d[2] = cc & 127;
+}
+
+// http://www.microtonal-synthesis.com/MIDItuning.html
+// http://technogems.blogspot.com/2018/07/using-midi-tuning-specification-mts.html
+
+/* single note tuning change, realtime */
+static void tx_mts_note (Tuna *self, const int note, const float cent) {
+	uint8_t syx[TUNA_MTS_NOTE_LEN];
+
+	syx[0] = 0xf0;
+	syx[1] = 0x7f; // realtime sysex
+	syx[2] = 0x7f; // target-id
+	syx[3] = 0x08; // tuning..
+	syx[4] = 0x02; // ..request
+	syx[5] = 0x00; // tuning program number
+	syx[6] = 0x01; // number of notes to be changed
+
+	syx[7]  = note & 127;
+	mts_freq (&syx[8], mts_semitone (self, note, cent));
+	syx[11] = 0xf7;
+
+	tx_sysex (self, syx, TUNA_MTS_NOTE_LEN);
+}
+
+/* collected tuning of a note relative to the scale, the octave's if it was not measured */
+static float mts_collected (const Tuna *self, const int note) {
+	if (self->mts_have[note]) {
+		return self->mts_scale[note];
+	}
+	if (self->mts_octave_have[note % 12]) {
+		return self->mts_octave[note % 12];
+	}
+	return 0;
+}
+
+/* bulk tuning dump, all 128 notes */
+static void tx_mts_bulk (Tuna *self) {
+	static const char name[16] = "x42 tuna        ";
+	uint8_t syx[TUNA_MTS_BULK_LEN];
+
+	syx[0] = 0xf0;
+	syx[1] = 0x7e; // non-realtime sysex
+	syx[2] = 0x7f; // target-id
+	syx[3] = 0x08; // tuning..
+	syx[4] = 0x01; // ..bulk dump reply
+	syx[5] = 0x00; // tuning program number
+	memcpy (&syx[6], name, 16);
+
+	for (int n = 0; n < 128; ++n) {
+		mts_freq (&syx[22 + 3 * n], mts_semitone (self, n, mts_collected (self, n)));
+	}
+
+	uint8_t chk = 0;
+	for (int i = 1; i < TUNA_MTS_BULK_LEN - 2; ++i) {
+		chk ^= syx[i];
+	}
+	syx[TUNA_MTS_BULK_LEN - 2] = chk & 127;
+	syx[TUNA_MTS_BULK_LEN - 1] = 0xf7;
+
+	tx_sysex (self, syx, TUNA_MTS_BULK_LEN);
+}
+
+/* scale/octave tuning, 1 byte form: +-64 cent per pitch class, realtime */
+static void tx_mts_octave (Tuna *self) {
+	uint8_t syx[TUNA_MTS_OCTAVE_LEN];
+
+	syx[0] = 0xf0;
+	syx[1] = 0x7f; // realtime sysex
+	syx[2] = 0x7f; // target-id
+	syx[3] = 0x08; // tuning..
+	syx[4] = 0x08; // ..scale/octave, 1 byte
+	syx[5] = 0x03; // channel mask: all
+	syx[6] = 0x7f;
+	syx[7] = 0x7f;
+
+	/* relative to 12-TET, pitch classes that were not measured use the scale */
+	for (int pc = 0; pc < 12; ++pc) {
+		const int   note = self->mts_octave_have[pc] ? self->mts_octave_note[pc] : 60 + pc;
+		const float cent = self->mts_octave_have[pc] ? self->mts_octave[pc] : 0;
+		const double dev = 100. * (mts_semitone (self, note, cent) - note);
+		syx[8 + pc] = 64 + MAX (-64, MIN (63, (int)rint (dev)));
+	}
+	syx[20] = 0xf7;
+
+	tx_sysex (self, syx, TUNA_MTS_OCTAVE_LEN);
+}
+
+/* collect the tuning, rate limited single note changes, dumps on request */
+static void mts (Tuna *self, const LibTunaResult* r, const uint32_t n_samples) {
+	const int      mode     = rintf (*self->p_mts);
+	const float    hyst     = MAX (0.f, *self->p_mts_hyst);
+	const uint32_t interval = MAX (0.f, *self->p_mts_interval) * self->rate / 1000.f;
+
+	if (self->mts_time < interval) {
+		self->mts_time += n_samples;
+	}
+
+	if (r->updated && r->midinote >= 0 && r->midinote < 128) {
+		if (r->stage == LIBTUNA_STAGE_TRACK) {
+			self->mts_scale[r->midinote] = r->cent;
+			self->mts_have[r->midinote] = true;
+			self->mts_octave[r->midinote % 12] = r->cent;
+			self->mts_octave_note[r->midinote % 12] = r->midinote;
+			self->mts_octave_have[r->midinote % 12] = true;
+		}
+		/* compare the latest value with the one that was sent */
+		self->mts_next_note = r->midinote;
+		self->mts_next_cent = r->cent;
+		self->mts_pending = r->midinote != self->mts_note || fabsf (r->cent - self->mts_cent) > hyst;
+	}
+
+	if (mode == TUNA_MTS_NOTE && self->mts_pending && self->mts_time >= interval
+			&& self->forge.size - self->forge.offset >= TUNA_MTS_MSG_SIZE (TUNA_MTS_NOTE_LEN)) {
+		tx_mts_note (self, self->mts_next_note, self->mts_next_cent);
+		self->mts_note    = self->mts_next_note;
+		self->mts_cent    = self->mts_next_cent;
+		self->mts_pending = false;
+		self->mts_time    = 0;
+	}
+
+	if (*self->p_mts_dump > 0 && self->mts_dump_last <= 0) {
+		self->mts_dump_req = true;
+	}
+	self->mts_dump_last = *self->p_mts_dump;
+
+	if (!self->mts_dump_req) {
+		return;
+	}
+	if (mode == TUNA_MTS_OCTAVE) {
+		if (self->forge.size - self->forge.offset >= TUNA_MTS_MSG_SIZE (TUNA_MTS_OCTAVE_LEN)) {
+			tx_mts_octave (self);
+			self->mts_dump_req = false;
+		}
+	} else {
+		if (self->forge.size - self->forge.offset >= TUNA_MTS_MSG_SIZE (TUNA_MTS_BULK_LEN)) {
+			tx_mts_bulk (self);
+			self->mts_dump_req = false;
+		}
+	}
+}
+
+/******************************************************************************
+ * Scale, Scala files are parsed by the worker
+ */
+
+/* run() -> work(), only the used part of path is sent */
+typedef struct {
+	uint32_t type;  // WORK_SCALE
+	uint32_t which; // SCALE_SCL, SCALE_KBM
+	char     path[TUNA_PATH_MAX];
+} TunaScaleRequest;
+
+/* work() -> work_response() */
+typedef struct {
+	uint32_t     type; // WORK_SCALE
+	LibTunaScale scale;
+	uint32_t     which;
+	char         path[TUNA_PATH_MAX];
+} TunaScaleResponse;
+
+/* upper bound of the size of the message sent by tx_scale_path() */
+#define TUNA_SCALE_MSG_SIZE (128 + TUNA_PATH_MAX)
+
+/* not realtime safe, "" is the default */
+static int scale_load (LibTunaScale* s, const char* scl, const char* kbm)
+{
+	if (!scl[0] && !kbm[0]) {
+		libtuna_scale_equal (s);
+		return 0;
+	}
+	return libtuna_scale_load (s, scl[0] ? scl : NULL, kbm[0] ? kbm : NULL);
+}
+
+/* patch:Set of a file of the scale */
+static void scale_request (Tuna *self, const LV2_Atom_Object* obj)
+{
+	const LV2_Atom* property = NULL;
+	const LV2_Atom* value = NULL;
+	lv2_atom_object_get(obj, self->uris.patch_property, &property, self->uris.patch_value, &value, NULL);
+	if (!property || property->type != self->uris.atom_URID || !value || value->type != self->uris.atom_Path) {
+		return;
+	}
+	const LV2_URID key = ((const LV2_Atom_URID*)property)->body;
+	if (key != self->uris.scl && key != self->uris.kbm) {
+		return;
+	}
+	if (!self->schedule || value->size >= TUNA_PATH_MAX) {
+		self->scale_notify = true; // the host shows the file in use
+		return;
+	}
+	TunaScaleRequest req;
+	req.type  = WORK_SCALE;
+	req.which = (key == self->uris.scl) ? SCALE_SCL : SCALE_KBM;
+	memcpy (req.path, LV2_ATOM_BODY_CONST (value), value->size);
+	req.path[value->size] = '\0';
+	self->schedule->schedule_work (self->schedule->handle, offsetof (TunaScaleRequest, path) + value->size + 1, &req);
+}
+
+/* send a file of the scale that is in use */
+static void tx_scale_path (Tuna *self, const LV2_URID key, const char* path)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time(&self->forge, 0);
+	x_forge_object(&self->forge, &frame, 0, self->uris.patch_Set);
+
+	lv2_atom_forge_key(&self->forge, self->uris.patch_property);
+	lv2_atom_forge_urid(&self->forge, key);
+
+	lv2_atom_forge_key(&self->forge, self->uris.patch_value);
+	lv2_atom_forge_path(&self->forge, path, strlen (path));
+
+	lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+static LV2_Worker_Status
+work_scale (Tuna* self, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle rh, uint32_t size, const void* data)
+{
+	const TunaScaleRequest* req = (const TunaScaleRequest*)data;
+	if (size <= offsetof (TunaScaleRequest, path) || size > sizeof (TunaScaleRequest) || req->which > SCALE_KBM) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+
+	TunaScaleResponse rsp;
+	rsp.type  = WORK_SCALE;
+	rsp.which = req->which;
+	memcpy (rsp.path, req->path, size - offsetof (TunaScaleRequest, path));
+	rsp.path[size - offsetof (TunaScaleRequest, path) - 1] = '\0';
+
+	const char* scl = (req->which == SCALE_SCL) ? rsp.path : self->work_path[SCALE_SCL];
+	const char* kbm = (req->which == SCALE_KBM) ? rsp.path : self->work_path[SCALE_KBM];
+	if (scale_load (&rsp.scale, scl, kbm)) {
+		lv2_log_error (&self->logger, "tuna.lv2: cannot load scale '%s'\n", rsp.path);
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	strcpy (self->work_path[req->which], rsp.path);
+	respond (rh, offsetof (TunaScaleResponse, path) + strlen (rsp.path) + 1, &rsp);
+	return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+scale_response (Tuna* self, uint32_t size, const void* data)
+{
+	const TunaScaleResponse* rsp = (const TunaScaleResponse*)data;
+	if (size <= offsetof (TunaScaleResponse, path) || size > sizeof (TunaScaleResponse)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	self->scale = rsp->scale;
+	libtuna_set_scale (self->engine, &self->scale);
+	memcpy (self->scale_path[rsp->which], rsp->path, size - offsetof (TunaScaleResponse, path));
+	self->scale_path[rsp->which][TUNA_PATH_MAX - 1] = '\0';
+	self->scale_notify = true;
+	return LV2_WORKER_SUCCESS;
+}
+
+/******************************************************************************
+ * Instrument and range, the analysis is built by the worker
+ */
+
+typedef struct {
+	uint32_t         type; // WORK_ANALYSIS, WORK_FREE
+	LibTunaRange     range;
+	LibTunaAnalysis* analysis;
+} TunaAnalysisMsg;
+
+static inline bool range_equal (const LibTunaRange* a, const LibTunaRange* b)
+{
+	return a->instrument == b->instrument && a->fmin == b->fmin && a->fmax == b->fmax && a->fft_size == b->fft_size;
+}
+
+/* set the range, swap in an analysis that was built, request a new one
+ * if the range needs it. Called by run() before processing.
+ */
+static void analysis_update (Tuna* self, const LibTunaRange* range)
+{
+	LibTuna* tuna = self->engine;
+	libtuna_set_range (tuna, range);
+
+	if (!self->schedule) {
+		return;
+	}
+
+	/* hand the replaced analysis to the worker first, there is only
+	 * one slot for it; until then the next one remains pending */
+	if (self->analysis_prev) {
+		const TunaAnalysisMsg msg = { WORK_FREE, *range, self->analysis_prev };
+		if (LV2_WORKER_SUCCESS != self->schedule->schedule_work (self->schedule->handle, sizeof (msg), &msg)) {
+			return; // try again next cycle
+		}
+		self->analysis_prev = NULL;
+	}
 
-static void tx_spectrum(Tuna *self, struct FFTAnalysis *ft)
-{
-	/* prepare data to transmit */
-	float sp_x[512], sp_y[512];
-	uint32_t p = 0;
-	const uint32_t b = ft->data_size * 3000 / ft->rate;
-	for (uint32_t i = 1; i < b && p < 512; i++) {
-		if (ft->power[i] < .00000000063) { // (-92dB)^2
-			continue;
+	if (self->analysis_next) {
+		LibTunaAnalysis* prev = libtuna_swap_analysis (tuna, self->analysis_next);
+		if (!prev) {
+			return; // try again next cycle
 		}
-		sp_x[p] = fftx_freq_at_bin(ft, i);
-		sp_y[p] = fftx_power_at_bin(ft, i);
-		p++;
+		self->analysis_next = NULL;
+		self->analysis_prev = prev;
+		return; // freed next cycle
 	}
-	if (p == 0) return;
 
-	LV2_Atom_Forge_Frame frame;
-	lv2_atom_forge_frame_time(&self->forge, 0);
-	x_forge_object(&self->forge, &frame, 1, self->uris.spectrum);
+	if (self->analysis_busy || !libtuna_analysis_outdated (tuna)) {
+		return;
+	}
+	if (self->analysis_failed && range_equal (range, &self->analysis_range)) {
+		return;
+	}
 
-	lv2_atom_forge_property_head(&self->forge, self->uris.spec_data_x, 0);
-	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, p, sp_x);
+	const TunaAnalysisMsg msg = { WORK_ANALYSIS, *range, NULL };
+	if (LV2_WORKER_SUCCESS == self->schedule->schedule_work (self->schedule->handle, sizeof (msg), &msg)) {
+		self->analysis_range  = *range;
+		self->analysis_busy   = true;
+		self->analysis_failed = false;
+	}
+}
 
-	lv2_atom_forge_property_head(&self->forge, self->uris.spec_data_y, 0);
-	lv2_atom_forge_vector(&self->forge, sizeof(float), self->uris.atom_Float, p, sp_y);
+static LV2_Worker_Status
+work_analysis (Tuna* self, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle rh, uint32_t size, const void* data)
+{
+	if (size != sizeof (TunaAnalysisMsg)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	TunaAnalysisMsg msg = *(const TunaAnalysisMsg*)data;
+	if (msg.type == WORK_FREE) {
+		libtuna_analysis_free (msg.analysis);
+		return LV2_WORKER_SUCCESS;
+	}
+	msg.analysis = libtuna_analysis_alloc (self->rate, &msg.range);
+	if (!msg.analysis) {
+		lv2_log_error (&self->logger, "tuna.lv2: cannot allocate the analysis\n");
+	}
+	/* respond in any case, run() waits for it */
+	respond (rh, sizeof (msg), &msg);
+	return LV2_WORKER_SUCCESS;
+}
 
-	lv2_atom_forge_pop(&self->forge, &frame);
+static LV2_Worker_Status
+analysis_response (Tuna* self, uint32_t size, const void* data)
+{
+	if (size != sizeof (TunaAnalysisMsg)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	const TunaAnalysisMsg* msg = (const TunaAnalysisMsg*)data;
+	self->analysis_busy   = false;
+	self->analysis_failed = !msg->analysis;
+	self->analysis_next   = msg->analysis;
+	return LV2_WORKER_SUCCESS;
 }
 
-static void mts (Tuna *self, const int note, const float cent) {
-	if ((note < 0 || note > 127) || (note == 0 && cent < 0)) {
-		return;
+static LV2_Worker_Status
+work (LV2_Handle handle, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle rh, uint32_t size, const void* data)
+{
+	Tuna* self = (Tuna*)handle;
+	if (size < sizeof (uint32_t)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	switch (*(const uint32_t*)data) {
+		case WORK_SCALE:
+			return work_scale (self, respond, rh, size, data);
+		case WORK_ANALYSIS:
+		case WORK_FREE:
+			return work_analysis (self, respond, rh, size, data);
+		case WORK_LOG:
+			if (size != sizeof (TunaLogMsg)) {
+				return LV2_WORKER_ERR_UNKNOWN;
+			}
+			libtuna_set_log_level (self->engine, (LibTunaLogLevel)((const TunaLogMsg*)data)->level);
+			return LV2_WORKER_SUCCESS;
+		default:
+			return LV2_WORKER_ERR_UNKNOWN;
 	}
+}
 
-	if (cent < -50.f || cent > 50.f) {
-		return;
+static LV2_Worker_Status
+work_response (LV2_Handle handle, uint32_t size, const void* data)
+{
+	Tuna* self = (Tuna*)handle;
+	if (size < sizeof (uint32_t)) {
+		return LV2_WORKER_ERR_UNKNOWN;
 	}
+	switch (*(const uint32_t*)data) {
+		case WORK_SCALE:
+			return scale_response (self, size, data);
+		case WORK_ANALYSIS:
+			return analysis_response (self, size, data);
+		default:
+			return LV2_WORKER_ERR_UNKNOWN;
+	}
+}
 
-	uint8_t nn = note & 127;
-	uint16_t cc = floorf (163.83 * ((cent >= 0) ? cent : (100.f - cent)));
+static LV2_State_Status
+save (LV2_Handle handle, LV2_State_Store_Function store, LV2_State_Handle sh, uint32_t flags, const LV2_Feature* const* features)
+{
+	Tuna* self = (Tuna*)handle;
+	LV2_State_Map_Path* map_path = NULL;
+	for (int i = 0; features[i]; ++i) {
+		if (!strcmp (features[i]->URI, LV2_STATE__mapPath)) {
+			map_path = (LV2_State_Map_Path*)features[i]->data;
+		}
+	}
 
-	// http://www.microtonal-synthesis.com/MIDItuning.html
-	// http://technogems.blogspot.com/2018/07/using-midi-tuning-specification-mts.html
-	uint8_t syx[12];
+	const LV2_URID key[2] = { self->uris.scl, self->uris.kbm };
+	for (int i = 0; i < 2; ++i) {
+		const char* path = self->scale_path[i];
+		if (!path[0]) {
+			continue;
+		}
+		char* apath = map_path ? map_path->abstract_path (map_path->handle, path) : NULL;
+		if (apath) {
+			path = apath;
+		}
+		store (sh, key[i], path, strlen (path) + 1, self->uris.atom_Path, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+		free (apath);
+	}
+	return LV2_STATE_SUCCESS;
+}
 
-	syx[0] = 0xf0;
-	syx[1] = 0x7f; // realtime sysex
-	syx[2] = 0x7f; // target-id
-	syx[3] = 0x08; // tuning..
-	syx[4] = 0x02; // ..request
-	syx[5] = 0x00; // tuning program number
-	syx[6] = 0x01; // number of notes to be changed
+static LV2_State_Status
+restore (LV2_Handle handle, LV2_State_Retrieve_Function retrieve, LV2_State_Handle sh, uint32_t flags, const LV2_Feature* const* features)
+{
+	Tuna* self = (Tuna*)handle;
+	LV2_State_Map_Path* map_path = NULL;
+	for (int i = 0; features[i]; ++i) {
+		if (!strcmp (features[i]->URI, LV2_STATE__mapPath)) {
+			map_path = (LV2_State_Map_Path*)features[i]->data;
+		}
+	}
 
-	syx[7]  = nn;
-	syx[8]  = (cent >= 0) ? nn : (nn - 1);
-	syx[9]  = cc >> 7;
-	syx[10] = cc & 127;
-	syx[11] = 0xf7;
+	char path[2][TUNA_PATH_MAX];
+	const LV2_URID key[2] = { self->uris.scl, self->uris.kbm };
+	for (int i = 0; i < 2; ++i) {
+		size_t   size;
+		uint32_t type;
+		uint32_t vflags;
+		const char* value = (const char*)retrieve (sh, key[i], &size, &type, &vflags);
+		path[i][0] = '\0';
+		if (!value || type != self->uris.atom_Path || size == 0 || value[size - 1] != '\0') {
+			continue;
+		}
+		char* apath = map_path ? map_path->absolute_path (map_path->handle, value) : NULL;
+		if (apath) {
+			value = apath;
+		}
+		if (strlen (value) < TUNA_PATH_MAX) {
+			strcpy (path[i], value);
+		}
+		free (apath);
+	}
 
-	LV2_Atom midiatom;
-	midiatom.type = self->uris.midi_Event;
-	midiatom.size = 12;
-	lv2_atom_forge_frame_time (&self->forge, 0);
-	lv2_atom_forge_raw (&self->forge, &midiatom, sizeof(LV2_Atom));
-	lv2_atom_forge_raw (&self->forge, syx, 12);
-	lv2_atom_forge_pad (&self->forge, sizeof(LV2_Atom) + midiatom.size);
-}
+	LibTunaScale scale;
+	if (scale_load (&scale, path[SCALE_SCL], path[SCALE_KBM])) {
+		lv2_log_error (&self->logger, "tuna.lv2: cannot load scale '%s' '%s'\n", path[SCALE_SCL], path[SCALE_KBM]);
+		path[SCALE_SCL][0] = path[SCALE_KBM][0] = '\0';
+		libtuna_scale_equal (&scale);
+	}
 
-/* round frequency to the closest note on the given scale.
- * use midi notation 0..127 for note-names
- */
-static float freq_to_scale(Tuna *self, const float freq, int *midinote) {
-	const float tuning = *self->p_tuning;
-	/* calculate corresponding note - use midi notation 0..127 */
-	const int note = rintf(12.f * log2f(freq / tuning) + 69.0);
-	if (midinote) *midinote = note;
-	/* ..and round it back to frequency */
-	return tuning * powf(2.0, (note - 69.f) / 12.f);
+	memcpy (self->work_path, path, sizeof (path));
+	memcpy (self->scale_path, path, sizeof (path));
+	self->scale = scale;
+	libtuna_set_scale (self->engine, &self->scale);
+	self->scale_notify = true;
+	return LV2_STATE_SUCCESS;
 }
 
 static void
 run(LV2_Handle handle, uint32_t n_samples)
 {
 	Tuna* self = (Tuna*)handle;
+	LibTuna* tuna = self->engine;
 
 	/* first time around.
 	 *
@@ -612,79 +1175,15 @@ run(LV2_Handle handle, uint32_t n_samples)
 		*self->p_octave   = 4;
 		*self->p_note     = 9;
 		*self->p_cent     = 0;
+		*self->p_target   = 0;
 		*self->p_error    = -100;
+		*self->p_stage    = 0;
 	}
 
 	const uint32_t capacity = self->notify->atom.size;
 	lv2_atom_forge_set_buffer(&self->forge, (uint8_t*)self->notify, capacity);
 	lv2_atom_forge_sequence_head(&self->forge, &self->frame, 0);
 
-	/* input ports */
-	float const * const a_in = self->a_in;
-	const float  mode   = *self->p_mode;
-#ifdef OUTPUT_POSTFILTER
-	float * const a_out = self->a_out;
-#endif
-
-	/* get thesholds */
-#define GET_THRESHOLD(VAR) \
-	if (*self->p_t_ ## VAR != self->t_ ## VAR) { \
-		self->t_ ## VAR = *self->p_t_ ## VAR; \
-		self->v_ ## VAR = powf(10, .1 * self->t_ ## VAR); \
-	}
-
-	GET_THRESHOLD(rms)
-	GET_THRESHOLD(flt)
-	GET_THRESHOLD(fft)
-	GET_THRESHOLD(ovr)
-	GET_THRESHOLD(fun)
-	GET_THRESHOLD(oct)
-	GET_THRESHOLD(ovt)
-
-	/* localize variables */
-	float prev_smpl = self->prev_smpl;
-	float rms_signal = self->rms_signal;
-	float rms_postfilter = self->rms_postfilter;
-	const float rms_omega  = self->rms_omega;
-	float freq = self->tuna_fc;
-	const float rms_threshold = self->v_rms;
-	const float v_flt = self->v_flt;
-
-	/* initialize local vars */
-	float    detected_freq = 0;
-	uint32_t detected_count = 0;
-	bool fft_ran_this_cycle = false;
-	bool fft_proc_this_cycle = false;
-	bool fft_active = false;
-
-	/* operation mode */
-	if (mode > 0 && mode < 10000) {
-		/* fixed user-specified frequency */
-		freq = mode;
-		fft_proc_this_cycle = true;
-		fft_active = false;
-	} else if (mode <= -1 && mode >= -128) {
-		/* midi-note */
-		freq = (*self->p_tuning) * powf(2.0, floorf(-70 - mode) / 12.f);
-		fft_proc_this_cycle = true;
-		fft_active = false;
-	} else {
-		/* auto-detect  - run FFT */
-		fft_active = true;
-	}
-
-#ifdef BACKGROUND_FFT
-	if (fft_active) {
-		feed_fft (self, a_in, n_samples);
-	} else {
-		rb_read_clear (self->result);
-	}
-#else
-	if (fft_active || self->spectr_active) {
-		fft_ran_this_cycle = 0 == fftx_run(self->fftx, n_samples, a_in);
-	}
-#endif
-
 	/* Process incoming events from GUI */
 	if (self->control) {
 		LV2_Atom_Event* ev = lv2_atom_sequence_begin(&(self->control)->body);
@@ -695,294 +1194,189 @@ run(LV2_Handle handle, uint32_t n_samples)
 				const LV2_Atom_Object* obj = (LV2_Atom_Object*)&ev->body;
 				/* interpret atom-objects: */
 				if (obj->body.otype == self->uris.ui_on) {
-					/* UI was activated */
+					/* UI was activated, or the display changed */
+					const LV2_Atom* zoom = NULL;
+					lv2_atom_object_get(obj, self->uris.ui_zoom, &zoom, NULL);
 					self->spectr_active = true;
+					self->zoom_active = zoom && zoom->type == self->uris.atom_Int && ((const LV2_Atom_Int*)zoom)->body;
+					self->spec_cnt = 0; // send all bins
+
 				} else if (obj->body.otype == self->uris.ui_off) {
 					/* UI was closed */
 					self->spectr_active = false;
+					self->zoom_active = false;
+
+				} else if (obj->body.otype == self->uris.patch_Set) {
+					scale_request (self, obj);
+
+				} else if (obj->body.otype == self->uris.patch_Get) {
+					self->scale_notify = true;
 				}
 			}
 			ev = lv2_atom_sequence_next(ev);
 		}
 	}
 
-	if (fft_ran_this_cycle && self->spectr_active) {
-		tx_spectrum(self, self->fftx);
+	if (self->scale_notify && self->forge.size - self->forge.offset >= 2 * TUNA_SCALE_MSG_SIZE) {
+		tx_scale_path (self, self->uris.scl, self->scale_path[SCALE_SCL]);
+		tx_scale_path (self, self->uris.kbm, self->scale_path[SCALE_KBM]);
+		self->scale_notify = false;
 	}
 
-#ifdef BACKGROUND_FFT
-	fft_ran_this_cycle = rb_read_space (self->result) > 0;
-#endif
-
-	/* process every sample */
-	for (uint32_t n = 0; n < n_samples; ++n) {
+	/* input ports */
+	libtuna_set_mode (tuna, *self->p_mode);
+	libtuna_set_tuning (tuna, *self->p_tuning);
+	libtuna_set_spectrum (tuna, self->spectr_active && !self->zoom_active);
+	libtuna_set_zoom (tuna, self->zoom_active);
+	libtuna_set_polyphony (tuna, MAX(0, rintf(*self->p_poly)));
+	libtuna_set_partials (tuna, MAX(0, rintf(*self->p_partials)));
+	libtuna_set_constq (tuna, *self->p_constq > 0);
+
+	const LibTunaRange range = {
+		(LibTunaInstrument)MAX(0, MIN(LIBTUNA_INSTRUMENT_LAST - 1, rintf(*self->p_instrument))),
+		*self->p_fmin,
+		*self->p_fmax,
+		(uint32_t)MAX(0, MIN(32768, rintf(*self->p_fft_size)))
+	};
+	analysis_update (self, &range);
+
+	const int log_level = MAX(LIBTUNA_LOG_OFF, MIN(LIBTUNA_LOG_DEBUG, rintf(*self->p_log_level)));
+	if (log_level != self->log_level && self->schedule) {
+		const TunaLogMsg msg = { WORK_LOG, (uint32_t)log_level };
+		if (LV2_WORKER_SUCCESS == self->schedule->schedule_work (self->schedule->handle, sizeof (msg), &msg)) {
+			self->log_level = log_level;
+		}
+	}
 
-		/* 1) calculate RMS */
-		rms_signal += rms_omega * ((a_in[n] * a_in[n]) - rms_signal) + 1e-20;
+	libtuna_set_threshold (tuna, LIBTUNA_T_RMS, *self->p_t_rms);
+	libtuna_set_threshold (tuna, LIBTUNA_T_FLT, *self->p_t_flt);
+	libtuna_set_threshold (tuna, LIBTUNA_T_FFT, *self->p_t_fft);
+	libtuna_set_threshold (tuna, LIBTUNA_T_OVR, *self->p_t_ovr);
+	libtuna_set_threshold (tuna, LIBTUNA_T_FUN, *self->p_t_fun);
+	libtuna_set_threshold (tuna, LIBTUNA_T_OCT, *self->p_t_oct);
+	libtuna_set_threshold (tuna, LIBTUNA_T_OVT, *self->p_t_ovt);
 
-		if (rms_signal < rms_threshold) {
-			/* signal below threshold */
-			self->dll_initialized = false;
-			self->fft_initialized = false;
-			self->fft_note_count = 0;
-			prev_smpl = 0;
 #ifdef OUTPUT_POSTFILTER
-			a_out[n] = 0;
+	tuna->a_out = self->a_out;
 #endif
-			continue;
-		}
 
-		/* 2) detect frequency to track
-		 * use FFT to roughly detect the area
-		 */
-
-		/* FFT accumulates data and only returns us some
-		 * valid data once in a while.. */
-		if (fft_ran_this_cycle && !fft_proc_this_cycle) {
-			fft_proc_this_cycle = true;
-			/* get lowest peak frequency */
-#ifdef BACKGROUND_FFT
-			float fft_peakfreq = 0;
-			while (0 == rb_read_one (self->result, &fft_peakfreq)) ;
-#else
-			const float fft_peakfreq = fftx_find_note(self->fftx, rms_signal * self->v_fft, self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
-#endif
-			if (fft_peakfreq < 20) {
-				self->fft_note_count = 0;
-			} else {
-				const float note_freq = freq_to_scale(self, fft_peakfreq, NULL);
+	libtuna_process (tuna, self->a_in, n_samples);
+	const LibTunaResult* r = libtuna_result (tuna);
 
-				/* keep track of fft stability */
-				if (note_freq == self->fft_scale_freq) {
-					self->fft_note_count+=n_samples;
-				} else {
-					self->fft_note_count = 0;
-				}
-				self->fft_scale_freq = note_freq;
-
-				debug_printf("FFT found peak: %fHz -> freq: %fHz (%d)\n", fft_peakfreq, note_freq, self->fft_note_count);
-
-				if (freq != note_freq &&
-						(   (!self->dll_initialized && self->fft_note_count > 768)
-						 || (self->fft_note_count > 1536 && fabsf(freq - note_freq) > MAX(FFT_FREQ_THESHOLD_MIN, freq * FFT_FREQ_THESHOLD_FAC))
-						 || (self->fft_note_count > self->rate / 8)
-						)
-					 ) {
-					info_printf("FFT adjust %fHz -> %fHz (fft:%fHz) cnt:%d\n", freq, note_freq, fft_peakfreq, self->fft_note_count);
-					freq = note_freq;
-				}
-			}
-		}
+	/* spectrum, at most TUNA_SPEC_FPS times a second */
+	self->spec_time += n_samples;
+	if (tuna->fft_ran && self->spectr_active && !self->zoom_active
+			&& self->spec_time >= self->rate / TUNA_SPEC_FPS
+			&& self->forge.size - self->forge.offset >= TUNA_SPEC_MSG_SIZE) {
+		self->spec_time = 0;
+		tx_spectrum(self, tuna->an->fftx, tuna->constq ? tuna->an->cq : NULL);
+	}
 
-		/* refuse to track insanity */
-		if (freq < 20 || freq > 10000 ) {
-			self->dll_initialized = false;
-			prev_smpl = 0;
-#ifdef OUTPUT_POSTFILTER
-			a_out[n] = 0;
-#endif
-			continue;
-		}
+	const LibTunaZoom* zr = libtuna_zoom_result (tuna);
+	if (zr->updated && self->forge.size - self->forge.offset >= TUNA_ZOOM_MSG_SIZE) {
+		tx_zoom(self, zr);
+	}
 
-		/* 2a) re-init detector coefficients with frequency to track */
-		if (freq != self->tuna_fc) {
-			self->tuna_fc = freq;
-			info_printf("set filter: %.2fHz\n", freq);
-			
-			/* calculate DLL coefficients */
-			const double omega = ((self->tuna_fc < 50) ? 6.0 : 4.0) * M_PI * self->tuna_fc / self->rate;
-			self->dll_b = 1.4142135623730950488 * omega; // sqrt(2)
-			self->dll_c = omega * omega;
-			self->dll_initialized = false;
-
-			/* re-initialize filter */
-			bandpass_setup(&self->fb, self->rate, self->tuna_fc
-					, MAX(10, self->tuna_fc * .10)
-					, 4 /*th order butterworth */);
-			self->filter_init = 16;
-		}
-		
-		/* 3) band-pass filter the signal to clean up the
-		 * waveform for counting zero-transitions.
-		 */
-		const float signal = bandpass_process(&self->fb, a_in[n]);
-
-		if (self->filter_init > 0) {
-			self->filter_init--;
-			rms_postfilter = 0;
-#ifdef OUTPUT_POSTFILTER
-			a_out[n] = signal * (16.0 - self->filter_init) / 16.0;
-#endif
+	/* polyphonic notes, when they change. Unused slots are zero,
+	 * this also ends notes when the polyphony is reduced */
+	const LibTunaPolyResult* pr = libtuna_poly_result (tuna);
+	for (uint32_t k = 0; k < LIBTUNA_POLY_MAX; ++k) {
+		const LibTunaNote* n = &pr->note[k];
+		LibTunaNote* l = &self->poly_last[k];
+		if (n->freq == 0 && l->freq == 0) {
 			continue;
 		}
-#ifdef OUTPUT_POSTFILTER
-		a_out[n] = signal;
-#endif
-
-		/* 4) reject signals outside in the band */
-		rms_postfilter += rms_omega * ( (signal * signal) - rms_postfilter) + 1e-20;
-		if (rms_postfilter < rms_signal * v_flt) {
-			debug_printf("signal too low after filter: %f %f\n",
-					10.*fast_log10(2.f *rms_signal),
-					10.*fast_log10(2.f *rms_postfilter));
-			self->dll_initialized = false;
-			prev_smpl = 0;
+		if (n->freq > 0 && l->freq > 0 && n->midinote == l->midinote && fabsf (n->cent - l->cent) <= .05) {
 			continue;
 		}
-
-		/* 5) track phase by counting
-		 * rising-edge zero-transitions
-		 * and a 2nd order phase-locked loop
-		 */
-		if (   (signal >= 0 && prev_smpl < 0)
-#ifdef TWO_EDGES
-				|| (signal <= 0 && prev_smpl > 0)
-#endif
-				) {
-
-			if (!self->dll_initialized) {
-				info_printf("reinit DLL\n");
-				/* re-initialize DLL */
-				self->dll_initialized = true;
-				self->dll_e0 = self->dll_t0 = 0;
-#ifdef TWO_EDGES
-				self->dll_e2 = self->rate / self->tuna_fc / 2.f;
-#else
-				self->dll_e2 = self->rate / self->tuna_fc;
-#endif
-				self->dll_t1 = self->monotonic_cnt + n + self->dll_e2;
-			} else {
-				/* phase 'error' = detected_phase - expected_phase */
-				self->dll_e0 = (self->monotonic_cnt + n) - self->dll_t1;
-
-				/* update DLL, keep track of phase */
-				self->dll_t0 = self->dll_t1;
-				self->dll_t1 += self->dll_b * self->dll_e0 + self->dll_e2;
-				self->dll_e2 += self->dll_c * self->dll_e0;
-
-#ifdef TWO_EDGES
-				const float dfreq0 = self->rate / (self->dll_t1 - self->dll_t0) / 2.f;
-				const float dfreq2 = self->rate / (self->dll_e2) / 2.f;
-#else
-				const float dfreq0 = self->rate / (self->dll_t1 - self->dll_t0);
-				const float dfreq2 = self->rate / (self->dll_e2);
-#endif
-				debug_printf("detected Freq: %.2f flt: %.2f (error: %.2f [samples]) diff:%f)\n",
-						dfreq0, dfreq2, self->dll_e0, (self->dll_t1 - self->dll_t0) - self->dll_e2);
-
-				float dfreq;
-				if (fabs (self->dll_e0 * freq / self->rate) > .02) {
-					dfreq = dfreq0;
-				} else {
-					dfreq = dfreq2;
-				}
-
-#if 1
-				/* calculate average of all detected values in this cycle.
-				 * this is questionable, just use last value.
-				 */
-				detected_freq += dfreq;
-				detected_count++;
-#else
-				detected_freq = dfreq;
-				detected_count= 1;
-#endif
-			}
+		if (self->forge.size - self->forge.offset < TUNA_POLY_MSG_SIZE) {
+			break;
 		}
-		prev_smpl = signal;
+		tx_poly(self, k, n);
+		*l = *n;
 	}
 
-	/* copy back variables */
-	self->prev_smpl = prev_smpl;
-	self->rms_signal = rms_signal;
-	self->rms_postfilter = rms_postfilter;
-
-	if (!self->dll_initialized) {
-		self->monotonic_cnt = 0;
-	} else {
-		self->monotonic_cnt += n_samples;
+	/* partials, rate limited. Once more when the note is released */
+	const LibTunaPartials* pa = libtuna_partials_result (tuna);
+	bool partials_locked = false;
+	for (uint32_t k = 0; k < pa->n_partials; ++k) {
+		partials_locked |= pa->freq[k] > 0;
 	}
-
-	/* post-processing and data-output */
-	if (detected_count > 0) {
-		/* calculate average of detected frequency */
-		int note;
-		const float freq_avg = detected_freq / (float)detected_count;
-		/* ..and the corresponding note on the scale */
-		const float note_freq = freq_to_scale(self, freq_avg, &note);
-
-		debug_printf("detected Freq: %.2f (error: %.2f [samples])\n", freq_avg, self->dll_e0);
-
-		/* calculate cent difference
-		 * One cent is one hundredth part of the semitone in 12-tone equal temperament
-		 */
-		const float cent = 1200.0 * log2(freq_avg / note_freq);
-
-		bool cent_diff = false;
-		bool note_diff = false;
-
-		if (fabsf (self->cent_last - cent) > .05) {
-			cent_diff = true;
-			self->cent_last = cent;
-		}
-		if (self->note_last != note) {
-			note_diff = true;
-			self->note_last = note;
+	self->partials_time += n_samples;
+	if (partials_locked ? (pa->updated && self->partials_time > self->rate / 10) : self->partials_sent) {
+		if (self->forge.size - self->forge.offset >= TUNA_PARTIALS_MSG_SIZE) {
+			tx_partials(self, pa);
+			self->partials_time = 0;
+			self->partials_sent = partials_locked;
 		}
+	}
 
-		if (note_diff || cent_diff) {
-			mts (self, note, cent);
-		}
+	mts (self, r, n_samples);
 
+	/* data-output */
+	if (r->updated) {
 		/* assign output port data */
 #ifdef __ARMEL__
-		if (fabsf (self->freq_last - freq_avg) > .05) {
-			*self->p_freq_out = freq_avg;
-			self->freq_last = freq_avg;
+		if (fabsf (self->freq_last - r->freq) > .05) {
+			*self->p_freq_out = r->freq;
+			self->freq_last = r->freq;
 		} else {
 			*self->p_freq_out = self->freq_last;
 		}
-		if (cent_diff) {
-			*self->p_cent     = cent;
+		if (fabsf (self->cent_last - r->cent) > .05) {
+			*self->p_cent     = r->cent;
+			self->cent_last = r->cent;
 		} else {
 			*self->p_cent     = self->cent_last;
 		}
 #else
-		*self->p_freq_out = freq_avg;
-		*self->p_cent     = cent;
+		*self->p_freq_out = r->freq;
+		*self->p_cent     = r->cent;
 #endif
 
-	  *self->p_octave   = (note/12) -1;
-	  *self->p_note     = note%12;
-	  *self->p_error    = 100.0 * self->dll_e0 * note_freq / self->rate;
-
+	  *self->p_octave   = r->octave;
+	  *self->p_note     = r->note;
+	  *self->p_target   = r->target;
+	  *self->p_error    = r->error;
 	}
-	else if (!self->dll_initialized) {
+	else if (r->stage == LIBTUNA_STAGE_IDLE) {
 		/* no signal detected; or below threshold */
-		*self->p_freq_out = 0;
-	  *self->p_error = 0;
+		*self->p_freq_out = r->freq;
+	  *self->p_error = r->error;
 	}
 	/* else { no change, maybe short cycle } */
 
+#ifdef TUNA_PROFILE
+	/* report about once a second, if there is space left after the spectrum */
+	self->prof_time += n_samples;
+	if (self->prof_time >= self->rate && self->forge.size - self->forge.offset > TUNA_PROF_MSG_SIZE) {
+		self->prof_time = 0;
+		if (self->spectr_active) {
+			tx_profile(self);
+		}
+		for (int i = 0; i < TP_LAST; ++i) {
+			tuna_prof_reset (&tuna->prof[i]);
+		}
+	}
+#endif
+
 	/* close off atom sequence */
 	lv2_atom_forge_pop(&self->forge, &self->frame);
 
-	/* report input level
-	 * NB. 20 *log10f(sqrt(x)) == 10 * log10f(x) */
-	const float rms = (rms_signal > .0000000001f) ? 10. * fast_log10(2 * rms_signal) : -100;
-	//const float rms = (rms_postfilter > .0000000001f) ? 10. * fast_log10(2 * rms_postfilter) : -100;
+	/* report input level */
 #ifdef __ARMEL__
-	if (fabsf (self->rms_last - rms) > 1) {
-		*self->p_rms = rms;
-		self->rms_last = rms;
+	if (fabsf (self->rms_last - r->rms) > 1) {
+		*self->p_rms = r->rms;
+		self->rms_last = r->rms;
 	} else {
 		*self->p_rms = self->rms_last;
 	}
 #else
-	*self->p_rms = rms;
+	*self->p_rms = r->rms;
 #endif
 
-	*self->p_strobe = self->monotonic_cnt / self->rate; // kick UI
+	*self->p_strobe = r->strobe; // kick UI
+	*self->p_stage  = r->stage;
 
 	/* forward audio */
 	if (self->a_in != self->a_out) {
@@ -995,12 +1389,16 @@ run(LV2_Handle handle, uint32_t n_samples)
 		if (self->fps_cnt > self->aspvf) {
 			self->fps_cnt = self->fps_cnt % self->aspvf;
 
-			self->guard1++;
-			self->ui_octave = *self->p_octave;
-			self->ui_note = *self->p_note;
-			self->ui_cent = *self->p_cent;
-			self->ui_strobe_tme = *self->p_strobe;
-			self->guard2++;
+			TunaDisplayState* ds = &self->ui_state[tb_back (&self->ui_tb)];
+			ds->freq       = *self->p_freq_out;
+			ds->octave     = *self->p_octave;
+			ds->note       = *self->p_note;
+			ds->cent       = *self->p_cent;
+			ds->error      = *self->p_error;
+			ds->rms        = *self->p_rms;
+			ds->strobe_tme = *self->p_strobe;
+			ds->stage      = *self->p_stage;
+			tb_publish (&self->ui_tb);
 
 			self->queue_draw->queue_draw (self->queue_draw->handle);
 		}
@@ -1020,21 +1418,179 @@ cleanup(LV2_Handle handle)
 	if (self->font) {
 		pango_font_description_free (self->font);
 	}
+	if (self->glyphs) {
+		cairo_surface_destroy (self->glyphs);
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (self->strobe[i]) {
+			cairo_pattern_destroy (self->strobe[i]);
+		}
+	}
 #endif
-#ifdef BACKGROUND_FFT
-  pthread_mutex_lock (&self->lock);
-	self->keep_running = false;
-	pthread_cond_signal (&self->signal);
-	pthread_mutex_unlock (&self->lock);
-	pthread_join (self->thread, NULL);
-
-	pthread_mutex_destroy (&self->lock);
-	pthread_cond_destroy (&self->signal);
-	rb_free (self->to_fft);
-	rb_free (self->result);
-#endif
 
-	fftx_free(self->fftx);
+	libtuna_analysis_free (self->analysis_next);
+	libtuna_analysis_free (self->analysis_prev);
+	libtuna_free (self->engine);
+	free(handle);
+}
+
+/******************************************************************************
+ * Multi-channel variant, one tracker per input
+ */
+
+typedef struct {
+	/* global control ports */
+	float* p_mode;
+	float* p_tuning;
+	float* p_t[LIBTUNA_T_LAST];
+
+	/* per channel ports */
+	float const* a_in[TUNA_MULTI_CHANNELS];
+	float* p_rms[TUNA_MULTI_CHANNELS];
+	float* p_freq_out[TUNA_MULTI_CHANNELS];
+	float* p_octave[TUNA_MULTI_CHANNELS];
+	float* p_note[TUNA_MULTI_CHANNELS];
+	float* p_cent[TUNA_MULTI_CHANNELS];
+	float* p_error[TUNA_MULTI_CHANNELS];
+	float* p_stage[TUNA_MULTI_CHANNELS];
+
+	LibTunaMulti* engine;
+	bool initialize;
+} TunaMulti;
+
+static LV2_Handle
+instantiate_multi(
+		const LV2_Descriptor*     descriptor,
+		double                    rate,
+		const char*               bundle_path,
+		const LV2_Feature* const* features)
+{
+	TunaMulti* self = (TunaMulti*)calloc(1, sizeof(TunaMulti));
+	if(!self) {
+		return NULL;
+	}
+
+	const LibTunaRange range = { (LibTunaInstrument)TUNA_MULTI_INSTRUMENT, 0, INFINITY, 0 };
+	self->engine = libtuna_multi_alloc (rate, TUNA_MULTI_CHANNELS, &range);
+	if (!self->engine) {
+		free (self);
+		return NULL;
+	}
+	self->initialize = true;
+	return (LV2_Handle)self;
+}
+
+static void
+connect_port_multi(
+		LV2_Handle handle,
+		uint32_t   port,
+		void*      data)
+{
+	TunaMulti* self = (TunaMulti*)handle;
+
+	switch ((PortIndexTunaMulti)port) {
+		case TUNA_M_MODE:
+			self->p_mode = (float*) data;
+			return;
+		case TUNA_M_TUNING:
+			self->p_tuning = (float*) data;
+			return;
+		case TUNA_M_T_RMS:
+		case TUNA_M_T_FLT:
+		case TUNA_M_T_FFT:
+		case TUNA_M_T_OVR:
+		case TUNA_M_T_FUN:
+		case TUNA_M_T_OCT:
+		case TUNA_M_T_OVT:
+			self->p_t[port - TUNA_M_T_RMS] = (float*) data;
+			return;
+		default:
+			break;
+	}
+
+	if (port < TUNA_M_CHANNEL0 || port >= TUNA_M_CHANNEL0 + TUNA_MULTI_CHANNELS * TUNA_MC_LAST) {
+		return;
+	}
+
+	const uint32_t c = (port - TUNA_M_CHANNEL0) / TUNA_MC_LAST;
+	switch ((PortIndexTunaChannel)((port - TUNA_M_CHANNEL0) % TUNA_MC_LAST)) {
+		case TUNA_MC_AIN:
+			self->a_in[c] = (float*) data;
+			break;
+		case TUNA_MC_RMS:
+			self->p_rms[c] = (float*) data;
+			break;
+		case TUNA_MC_FREQ_OUT:
+			self->p_freq_out[c] = (float*) data;
+			break;
+		case TUNA_MC_OCTAVE:
+			self->p_octave[c] = (float*) data;
+			break;
+		case TUNA_MC_NOTE:
+			self->p_note[c] = (float*) data;
+			break;
+		case TUNA_MC_CENT:
+			self->p_cent[c] = (float*) data;
+			break;
+		case TUNA_MC_ERROR:
+			self->p_error[c] = (float*) data;
+			break;
+		case TUNA_MC_STAGE:
+			self->p_stage[c] = (float*) data;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+run_multi(LV2_Handle handle, uint32_t n_samples)
+{
+	TunaMulti* self = (TunaMulti*)handle;
+	LibTunaMulti* tuna = self->engine;
+
+	if (self->initialize) {
+		self->initialize = false;
+		for (uint32_t c = 0; c < TUNA_MULTI_CHANNELS; ++c) {
+			*self->p_freq_out[c] = 0;
+			*self->p_octave[c]   = 4;
+			*self->p_note[c]     = 9;
+			*self->p_cent[c]     = 0;
+			*self->p_error[c]    = -100;
+			*self->p_stage[c]    = 0;
+		}
+	}
+
+	libtuna_multi_set_mode (tuna, *self->p_mode);
+	libtuna_multi_set_tuning (tuna, *self->p_tuning);
+	for (int i = 0; i < LIBTUNA_T_LAST; ++i) {
+		libtuna_multi_set_threshold (tuna, (LibTunaThreshold)i, *self->p_t[i]);
+	}
+
+	libtuna_multi_process (tuna, self->a_in, n_samples);
+
+	for (uint32_t c = 0; c < TUNA_MULTI_CHANNELS; ++c) {
+		const LibTunaResult* r = libtuna_multi_result (tuna, c);
+		if (r->updated) {
+			*self->p_freq_out[c] = r->freq;
+			*self->p_octave[c]   = r->octave;
+			*self->p_note[c]     = r->note;
+			*self->p_cent[c]     = r->cent;
+			*self->p_error[c]    = r->error;
+		} else if (r->stage == LIBTUNA_STAGE_IDLE) {
+			*self->p_freq_out[c] = r->freq;
+			*self->p_error[c]    = r->error;
+		}
+		*self->p_rms[c]   = r->rms;
+		*self->p_stage[c] = r->stage;
+	}
+}
+
+static void
+cleanup_multi(LV2_Handle handle)
+{
+	TunaMulti* self = (TunaMulti*)handle;
+	libtuna_multi_free (self->engine);
 	free(handle);
 }
 
@@ -1054,6 +1610,93 @@ struct license_info license_infos = {
  */
 
 #ifdef DISPLAY_INTERFACE
+/* The text is composed of cached glyphs (the font is monospaced), the
+ * strobe lines are repeating masks, translated by the phase. Glyphs
+ * are rendered when the size changes, not per frame: outlines in the
+ * first row, fills in the second. All outlines are drawn before the
+ * fills, so that an outline does not cover the neighbouring glyph.
+ */
+#define TUNA_GLYPHS  "ABCDEFG#+-0123456789\u00A2"
+#define TUNA_GLYPH_N (21) // the cent sign is 2 bytes
+#define TUNA_GLYPH_P (3)  // padding, for the outline
+
+static int glyph_index (const char* c) {
+	if ((unsigned char)c[0] == 0xc2) {
+		return TUNA_GLYPH_N - 1;
+	}
+	const char* g = strchr (TUNA_GLYPHS, c[0]);
+	return (g && c[0] != '\0') ? g - TUNA_GLYPHS : -1;
+}
+
+static void render_glyphs (Tuna* self) {
+	if (self->glyphs) {
+		cairo_surface_destroy (self->glyphs);
+	}
+	/* measure, any glyph will do */
+	cairo_surface_t* tmp = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+	cairo_t* cr = cairo_create (tmp);
+	PangoLayout* pl = pango_cairo_create_layout (cr);
+	pango_layout_set_font_description (pl, self->font);
+	pango_layout_set_text (pl, "0", -1);
+	pango_layout_get_pixel_size (pl, &self->glyph_adv, &self->glyph_h);
+	g_object_unref (pl);
+	cairo_destroy (cr);
+	cairo_surface_destroy (tmp);
+
+	const int cw = self->glyph_adv + 2 * TUNA_GLYPH_P;
+	const int ch = self->glyph_h + 2 * TUNA_GLYPH_P;
+	self->glyphs = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, TUNA_GLYPH_N * cw, 2 * ch);
+	cr = cairo_create (self->glyphs);
+	pl = pango_cairo_create_layout (cr);
+	pango_layout_set_font_description (pl, self->font);
+	cairo_set_line_width (cr, 2.5);
+
+	const char* g = TUNA_GLYPHS;
+	for (int i = 0; i < TUNA_GLYPH_N; ++i) {
+		const int len = (unsigned char)*g == 0xc2 ? 2 : 1;
+		pango_layout_set_text (pl, g, len);
+		g += len;
+		cairo_move_to (cr, i * cw + TUNA_GLYPH_P, TUNA_GLYPH_P);
+		pango_cairo_layout_path (cr, pl);
+		cairo_set_source_rgba (cr, 0, 0, 0, .5);
+		cairo_stroke (cr);
+		cairo_move_to (cr, i * cw + TUNA_GLYPH_P, ch + TUNA_GLYPH_P);
+		pango_cairo_layout_path (cr, pl);
+		cairo_set_source_rgba (cr, 1, 1, 1, 1);
+		cairo_fill (cr);
+	}
+	g_object_unref (pl);
+	cairo_destroy (cr);
+	cairo_surface_flush (self->glyphs);
+}
+
+/* one period of a dash: on for `len`, off for `len` */
+static cairo_pattern_t* strobe_pattern (int len) {
+	cairo_surface_t* tile = cairo_image_surface_create (CAIRO_FORMAT_A8, 2 * len, 1);
+	cairo_t* cr = cairo_create (tile);
+	cairo_rectangle (cr, 0, 0, len, 1);
+	cairo_set_source_rgba (cr, 0, 0, 0, 1);
+	cairo_fill (cr);
+	cairo_destroy (cr);
+	cairo_pattern_t* p = cairo_pattern_create_for_surface (tile);
+	cairo_pattern_set_extend (p, CAIRO_EXTEND_REPEAT);
+	cairo_surface_destroy (tile);
+	return p;
+}
+
+/* horizontal strobe line of the given width, the dash shifted by `offset` */
+static void strobe_line (cairo_t* cr, cairo_pattern_t* p, float y, float w, float lw, float offset) {
+	const float period = 2.f * lw;
+	cairo_matrix_t m;
+	cairo_matrix_init_translate (&m, fmodf (offset, period), 0);
+	cairo_pattern_set_matrix (p, &m);
+	cairo_save (cr);
+	cairo_rectangle (cr, 0, y - .5 * lw, w, lw);
+	cairo_clip (cr);
+	cairo_mask (cr, p);
+	cairo_restore (cr);
+}
+
 static LV2_Inline_Display_Image_Surface *
 tuna_render (LV2_Handle handle, uint32_t w, uint32_t max_h)
 {
@@ -1077,29 +1720,24 @@ tuna_render (LV2_Handle handle, uint32_t w, uint32_t max_h)
 		}
 		snprintf(txt, 32, "Mono %.0fpx", floor (h * .375));
 		self->font = pango_font_description_from_string (txt);
+		render_glyphs (self);
+	}
+	if (!self->strobe[0]) {
+		self->strobe[0] = strobe_pattern (8);
+		self->strobe[1] = strobe_pattern (16);
 	}
 	cairo_t* cr = cairo_create (self->display);
 	cairo_rectangle (cr, 0, 0, w, h);
 	cairo_set_source_rgba (cr, .2, .2, .2, 1.0);
 	cairo_fill (cr);
 
-	float ui_octave;
-	float ui_note;
-	float ui_cent;
-	float ui_strobe_tme;
-
-	int tries = 0;
-	do {
-		if (tries == 10) {
-			tries = 0;
-			sched_yield ();
-		}
-		ui_octave = self->ui_octave;
-		ui_note = self->ui_note;
-		ui_cent = self->ui_cent;
-		ui_strobe_tme = self->ui_strobe_tme;
-		++tries;
-	} while (self->guard1 != self->guard2);
+	/* latest complete state, does not wait for run() */
+	const TunaDisplayState* ds = &self->ui_state[tb_front (&self->ui_tb)];
+	const float ui_octave = ds->octave;
+	const float ui_note = MAX(0, MIN(11, ds->note));
+	const float ui_cent = ds->cent;
+	const float ui_strobe_tme = ds->strobe_tme;
+	const bool  ui_locked = ds->stage == LIBTUNA_STAGE_TRACK;
 
 	/* strobe setup */
 	cairo_set_source_rgba (cr, .5, .5, .5, .8);
@@ -1119,47 +1757,43 @@ tuna_render (LV2_Handle handle, uint32_t w, uint32_t max_h)
 	}
 
 	/* render strobe */
-	cairo_save(cr);
-	const double dash1[] = {8.0};
-	const double dash2[] = {16.0};
-
-	cairo_set_dash(cr, dash1, 1, self->ui_strobe_phase * -2.);
-	cairo_set_line_width(cr, 8.0);
-	cairo_move_to(cr, 0, h * .75);
-	cairo_line_to(cr, w, h * .75);
-	cairo_stroke (cr);
-
-	cairo_set_dash(cr, dash2, 1, -self->ui_strobe_phase);
-	cairo_set_line_width(cr, 16.0);
-	cairo_move_to(cr, 0, h * .75);
-	cairo_line_to(cr, w, h * .75);
-	cairo_stroke (cr);
-	cairo_restore(cr);
+	strobe_line (cr, self->strobe[0], h * .75, w, 8, self->ui_strobe_phase * -2.);
+	strobe_line (cr, self->strobe[1], h * .75, w, 16, -self->ui_strobe_phase);
 
 	/* render text */
-	int tw, th;
 	if (fabsf (ui_cent) < 100) {
 		snprintf(txt, 32, "%-2s%.0f %+3.0f\u00A2", notename[(int)ui_note], ui_octave, ui_cent);
 	} else {
 		snprintf(txt, 32, "%-2s%.0f", notename[(int)ui_note], ui_octave);
 	}
-	PangoLayout * pl = pango_cairo_create_layout (cr);
-	pango_layout_set_font_description (pl, self->font);
-	pango_layout_set_text (pl, txt, -1);
-	pango_layout_get_pixel_size (pl, &tw, &th);
-	cairo_move_to (cr, 0.5 * (w - tw), 0.25 * h - .5 * th);
-#if 0
-	cairo_set_source_rgba (cr, 1, 1, 1, 1);
-	pango_cairo_show_layout (cr, pl);
-#else
-	pango_cairo_layout_path (cr, pl);
-	cairo_set_line_width(cr, 2.5);
-	cairo_set_source_rgba (cr, 0, 0, 0, .5);
-	cairo_stroke_preserve (cr);
-	cairo_set_source_rgba (cr, 1, 1, 1, 1);
-	cairo_fill (cr);
-#endif
-	g_object_unref(pl);
+	int n_chars = 0;
+	for (const char* c = txt; *c; ++c) {
+		n_chars += ((unsigned char)*c & 0xc0) != 0x80; // UTF-8 lead bytes
+	}
+
+	const int cw = self->glyph_adv + 2 * TUNA_GLYPH_P;
+	const int ch = self->glyph_h + 2 * TUNA_GLYPH_P;
+	const float x0 = rintf (.5f * (w - n_chars * self->glyph_adv)) - TUNA_GLYPH_P;
+	const float y = rintf (.25f * h - .5f * self->glyph_h) - TUNA_GLYPH_P;
+	for (int row = 0; row < 2; ++row) {
+		float x = x0;
+		for (const char* c = txt; *c; ++c) {
+			if (((unsigned char)*c & 0xc0) == 0x80) {
+				continue;
+			}
+			const int g = glyph_index (c);
+			if (g >= 0) {
+				cairo_save (cr);
+				cairo_rectangle (cr, x, y, cw, ch);
+				cairo_clip (cr);
+				cairo_set_source_surface (cr, self->glyphs, x - g * cw, y - row * ch);
+				/* dim while the note is not locked */
+				cairo_paint_with_alpha (cr, ui_locked ? 1 : .6);
+				cairo_restore (cr);
+			}
+			x += self->glyph_adv;
+		}
+	}
 
 	/* finish surface */
 	cairo_destroy (cr);
@@ -1179,6 +1813,14 @@ tuna_render (LV2_Handle handle, uint32_t w, uint32_t max_h)
 const void*
 extension_data(const char* uri)
 {
+	static const LV2_Worker_Interface worker = { work, work_response, NULL };
+	static const LV2_State_Interface  state  = { save, restore };
+	if (!strcmp(uri, LV2_WORKER__interface)) {
+		return &worker;
+	}
+	if (!strcmp(uri, LV2_STATE__interface)) {
+		return &state;
+	}
 #ifdef DISPLAY_INTERFACE
 	static const LV2_Inline_Display_Interface display  = { tuna_render };
 	if (!strcmp(uri, LV2_INLINEDISPLAY__interface)) {
@@ -1211,6 +1853,27 @@ mkdesc_tuna(0, "one")
 mkdesc_tuna(1, "two")
 mkdesc_tuna(2, "mod")
 
+/* no inline display, tuna_render() expects a Tuna instance */
+static const void*
+extension_data_multi(const char* uri)
+{
+#ifdef WITH_SIGNATURE
+	LV2_LICENSE_EXT_C
+#endif
+	return NULL;
+}
+
+static const LV2_Descriptor descriptor3 = {
+	TUNA_URI "multi",
+	instantiate_multi,
+	connect_port_multi,
+	NULL,
+	run_multi,
+	NULL,
+	cleanup_multi,
+	extension_data_multi
+};
+
 #undef LV2_SYMBOL_EXPORT
 #ifdef _WIN32
 #    define LV2_SYMBOL_EXPORT __declspec(dllexport)
@@ -1225,6 +1888,7 @@ lv2_descriptor(uint32_t index)
 		case  0: return &descriptor0;
 		case  1: return &descriptor1;
 		case  2: return &descriptor2;
+		case  3: return &descriptor3;
 		default: return NULL;
 	}
 }
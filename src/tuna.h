@@ -27,14 +27,18 @@
 #include <lv2/atom/atom.h>
 #include <lv2/atom/forge.h>
 #include <lv2/midi/midi.h>
+#include <lv2/patch/patch.h>
 #include <lv2/urid/urid.h>
 #else
 #include <lv2/lv2plug.in/ns/ext/atom/atom.h>
 #include <lv2/lv2plug.in/ns/ext/atom/forge.h>
 #include <lv2/lv2plug.in/ns/ext/urid/urid.h>
 #include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/patch/patch.h>
 #endif
 
+#include "libtuna.h"
+
 #ifdef HAVE_LV2_1_8
 #define x_forge_object lv2_atom_forge_object
 #else
@@ -62,8 +66,128 @@ typedef enum {
 	TUNA_T_FUN,
 	TUNA_T_OCT,
 	TUNA_T_OVT,
+	TUNA_STAGE,
+	TUNA_POLY,
+	TUNA_PARTIALS,
+	TUNA_CONSTQ,
+	TUNA_MTS,
+	TUNA_MTS_INTERVAL,
+	TUNA_MTS_HYST,
+	TUNA_MTS_DUMP,
+	TUNA_INSTRUMENT,
+	TUNA_FMIN,
+	TUNA_FMAX,
+	TUNA_FFT_SIZE,
+	TUNA_LOG_LEVEL,
+	TUNA_TARGET,
 } PortIndexTuna;
 
+/* TUNA_STAGE port values: LibTunaStage */
+
+/* TUNA_POLY: number of notes to detect, 0: off.
+ * Every note is sent as `poly` object on the notify port
+ * when it changes, freq 0: the note ended.
+ */
+
+/* TUNA_PARTIALS: number of partials to analyze, 0: off.
+ * Measured partials and inharmonicity are sent as `partials` object
+ * on the notify port, about 10 times a second while partials are locked,
+ * and once with all frequencies 0 when the note is released.
+ */
+
+/* TUNA_CONSTQ: find notes and send the spectrum on constant-Q bins
+ * (musically spaced) instead of FFT bins, 0: off.
+ */
+
+/* TUNA_MTS: MIDI Tuning Standard output on the notify port.
+ * TUNA_MTS_NOTE sends a single note tuning change when the note
+ * changes, or the cent deviation by more than TUNA_MTS_HYST [cent],
+ * at most once every TUNA_MTS_INTERVAL [ms] (the latest value).
+ * All modes collect the tuning of every note while it is tracked.
+ * A rising edge of TUNA_MTS_DUMP sends it: as scale/octave tuning
+ * (12 notes, +-64 cent) in TUNA_MTS_OCTAVE mode, otherwise as bulk
+ * tuning dump of 128 notes (notes that were not measured use the
+ * octave's tuning). The tuning is relative to the notes of the scale,
+ * messages carry the absolute pitch.
+ */
+typedef enum {
+	TUNA_MTS_NOTE = 0,
+	TUNA_MTS_BULK,
+	TUNA_MTS_OCTAVE,
+} TunaMTSMode;
+
+/* TUNA_INSTRUMENT: LibTunaInstrument, TUNA_FMIN .. TUNA_FMAX [Hz]
+ * limit the range of notes that are detected (see libtuna_set_range()).
+ * TUNA_FFT_SIZE: 0 (auto) or 1024 .. 32768, LibTunaRange::fft_size.
+ * The analysis that is sized for it is built by the worker, without
+ * the worker feature the default analysis is used for any range.
+ */
+
+/* Scale: the properties tuna:scl and tuna:kbm (atom:Path) are set with
+ * patch:Set on the control port, an empty path resets to the default.
+ * Files are parsed by the worker, see libtuna_scale_load(); the paths
+ * in use are sent as patch:Set on the notify port when they change, or
+ * in reply to a patch:Get. They are saved with the plugin's state.
+ */
+#define TUNA_PATH_MAX (1024)
+
+/* multi-channel variant */
+#ifndef TUNA_MULTI_CHANNELS
+#define TUNA_MULTI_CHANNELS (6)
+#endif
+#if TUNA_MULTI_CHANNELS < 1 || TUNA_MULTI_CHANNELS > LIBTUNA_MULTI_MAX
+#error "TUNA_MULTI_CHANNELS must be in 1..LIBTUNA_MULTI_MAX"
+#endif
+#ifndef TUNA_MULTI_INSTRUMENT
+#define TUNA_MULTI_INSTRUMENT (0) // LibTunaInstrument, generic
+#endif
+
+typedef enum {
+	TUNA_M_MODE = 0,
+	TUNA_M_TUNING,
+	TUNA_M_T_RMS,
+	TUNA_M_T_FLT,
+	TUNA_M_T_FFT,
+	TUNA_M_T_OVR,
+	TUNA_M_T_FUN,
+	TUNA_M_T_OCT,
+	TUNA_M_T_OVT,
+	TUNA_M_CHANNEL0, // first port of channel 0
+} PortIndexTunaMulti;
+
+/* ports of every channel,
+ * index: TUNA_M_CHANNEL0 + channel * TUNA_MC_LAST + PortIndexTunaChannel
+ */
+typedef enum {
+	TUNA_MC_AIN = 0,
+	TUNA_MC_RMS,
+	TUNA_MC_FREQ_OUT,
+	TUNA_MC_OCTAVE,
+	TUNA_MC_NOTE,
+	TUNA_MC_CENT,
+	TUNA_MC_ERROR,
+	TUNA_MC_STAGE,
+	TUNA_MC_LAST
+} PortIndexTunaChannel;
+
+/* spectrum message: bins on a fixed grid, linear (FFT) or logarithmic
+ * (constant-Q), up to TUNA_SPEC_FMAX. The level of every bin is
+ * quantized to one byte, 0: below TUNA_SPEC_FLOOR, else
+ * TUNA_SPEC_FLOOR + (q - 1) / 2 [dB].
+ * Only the range of bins that changed since the previous message is sent,
+ * all bins every TUNA_SPEC_KEY frames. Every frame is sent, with an empty
+ * range if nothing changed (the waterfall advances by one row per frame).
+ */
+#define TUNA_SPEC_BINS  (1024)  // max. grid size
+#define TUNA_SPEC_FMAX  (3000)  // [Hz]
+#define TUNA_SPEC_FLOOR (-92.f) // [dB]
+#define TUNA_SPEC_FPS   (25)    // max. frames per second
+#define TUNA_SPEC_KEY   (25)    // [frames]
+
+static inline float
+tuna_spec_dB (const uint8_t q) {
+	return TUNA_SPEC_FLOOR + .5f * (q - 1);
+}
 
 typedef struct {
 	LV2_URID atom_Blank;
@@ -71,14 +195,52 @@ typedef struct {
 	LV2_URID atom_Vector;
 	LV2_URID atom_Float;
 	LV2_URID atom_Int;
+	LV2_URID atom_Chunk;
 	LV2_URID atom_eventTransfer;
 	LV2_URID midi_Event;
+	LV2_URID atom_Path;
+	LV2_URID atom_URID;
+	LV2_URID patch_Get;
+	LV2_URID patch_Set;
+	LV2_URID patch_property;
+	LV2_URID patch_value;
+	LV2_URID scl;
+	LV2_URID kbm;
 
 	LV2_URID spectrum;
+	LV2_URID spec_f0;
+	LV2_URID spec_df;
+	LV2_URID spec_bpo;
+	LV2_URID spec_bins;
+	LV2_URID spec_start;
+	LV2_URID spec_q;
 	LV2_URID spec_data_x;
 	LV2_URID spec_data_y;
 	LV2_URID ui_on;
 	LV2_URID ui_off;
+	LV2_URID poly;
+	LV2_URID poly_voice;
+	LV2_URID poly_freq;
+	LV2_URID poly_note;
+	LV2_URID poly_cent;
+	LV2_URID poly_level;
+	LV2_URID partials;
+	LV2_URID partials_f0;
+	LV2_URID partials_B;
+	LV2_URID partials_freq;
+	LV2_URID zoom;
+	LV2_URID zoom_fc;
+	LV2_URID zoom_peak;
+	LV2_URID ui_zoom;
+#ifdef TUNA_PROFILE
+	LV2_URID profile;
+	LV2_URID prof_unit;
+	LV2_URID prof_count;
+	LV2_URID prof_min;
+	LV2_URID prof_avg;
+	LV2_URID prof_max;
+	LV2_URID prof_hist;
+#endif
 } TunaLV2URIs;
 
 static inline void
@@ -88,14 +250,52 @@ map_tuna_uris(LV2_URID_Map* map, TunaLV2URIs* uris) {
 	uris->atom_Vector        = map->map(map->handle, LV2_ATOM__Vector);
 	uris->atom_Float         = map->map(map->handle, LV2_ATOM__Float);
 	uris->atom_Int           = map->map(map->handle, LV2_ATOM__Int);
+	uris->atom_Chunk         = map->map(map->handle, LV2_ATOM__Chunk);
 	uris->atom_eventTransfer = map->map(map->handle, LV2_ATOM__eventTransfer);
 	uris->midi_Event         = map->map(map->handle, LV2_MIDI__MidiEvent);
+	uris->atom_Path          = map->map(map->handle, LV2_ATOM__Path);
+	uris->atom_URID          = map->map(map->handle, LV2_ATOM__URID);
+	uris->patch_Get          = map->map(map->handle, LV2_PATCH__Get);
+	uris->patch_Set          = map->map(map->handle, LV2_PATCH__Set);
+	uris->patch_property     = map->map(map->handle, LV2_PATCH__property);
+	uris->patch_value        = map->map(map->handle, LV2_PATCH__value);
+	uris->scl                = map->map(map->handle, TUNA_URI "scl");
+	uris->kbm                = map->map(map->handle, TUNA_URI "kbm");
 
 	uris->spectrum           = map->map(map->handle, TUNA_URI "#_spectrum");
+	uris->spec_f0            = map->map(map->handle, TUNA_URI "#_spec_f0");
+	uris->spec_df            = map->map(map->handle, TUNA_URI "#_spec_df");
+	uris->spec_bpo           = map->map(map->handle, TUNA_URI "#_spec_bpo");
+	uris->spec_bins          = map->map(map->handle, TUNA_URI "#_spec_bins");
+	uris->spec_start         = map->map(map->handle, TUNA_URI "#_spec_start");
+	uris->spec_q             = map->map(map->handle, TUNA_URI "#_spec_q");
 	uris->spec_data_x        = map->map(map->handle, TUNA_URI "#_data_x");
 	uris->spec_data_y        = map->map(map->handle, TUNA_URI "#_data_y");
 	uris->ui_on              = map->map(map->handle, TUNA_URI "#_ui_on");
 	uris->ui_off             = map->map(map->handle, TUNA_URI "#_ui_off");
+	uris->poly               = map->map(map->handle, TUNA_URI "#_poly");
+	uris->poly_voice         = map->map(map->handle, TUNA_URI "#_poly_voice");
+	uris->poly_freq          = map->map(map->handle, TUNA_URI "#_poly_freq");
+	uris->poly_note          = map->map(map->handle, TUNA_URI "#_poly_note");
+	uris->poly_cent          = map->map(map->handle, TUNA_URI "#_poly_cent");
+	uris->poly_level         = map->map(map->handle, TUNA_URI "#_poly_level");
+	uris->partials           = map->map(map->handle, TUNA_URI "#_partials");
+	uris->partials_f0        = map->map(map->handle, TUNA_URI "#_partials_f0");
+	uris->partials_B         = map->map(map->handle, TUNA_URI "#_partials_B");
+	uris->partials_freq      = map->map(map->handle, TUNA_URI "#_partials_freq");
+	uris->zoom               = map->map(map->handle, TUNA_URI "#_zoom");
+	uris->zoom_fc            = map->map(map->handle, TUNA_URI "#_zoom_fc");
+	uris->zoom_peak          = map->map(map->handle, TUNA_URI "#_zoom_peak");
+	uris->ui_zoom            = map->map(map->handle, TUNA_URI "#_ui_zoom");
+#ifdef TUNA_PROFILE
+	uris->profile            = map->map(map->handle, TUNA_URI "#_profile");
+	uris->prof_unit          = map->map(map->handle, TUNA_URI "#_prof_unit");
+	uris->prof_count         = map->map(map->handle, TUNA_URI "#_prof_count");
+	uris->prof_min           = map->map(map->handle, TUNA_URI "#_prof_min");
+	uris->prof_avg           = map->map(map->handle, TUNA_URI "#_prof_avg");
+	uris->prof_max           = map->map(map->handle, TUNA_URI "#_prof_max");
+	uris->prof_hist          = map->map(map->handle, TUNA_URI "#_prof_hist");
+#endif
 }
 
 #endif
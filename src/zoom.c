@@ -0,0 +1,293 @@
+/* libtuna -- zoomed spectrum around the note
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* High resolution spectrum of +-100 cent around the filter's center
+ * frequency (tuna_fc). Included by libtuna.c.
+ *
+ * Instead of a large FFT of the complete band, the signal is shifted down:
+ *  1) band-pass around fc (anti-aliasing)
+ *  2) mix with a complex oscillator at fc: fc is at 0Hz
+ *  3) average and decimate to fc / ZOOM_DECIM, which is complex
+ *     and covers +-fc / (2 * ZOOM_DECIM), about +-200 cent
+ *  4) Hann window and a small, zero-padded complex FFT
+ *
+ * The resolution does not depend on the sample-rate but on the length of
+ * the window: ZOOM_WINDOW * ZOOM_DECIM periods of the note (1.2 sec at
+ * 440Hz). Zero-padding interpolates the spectrum to about 0.4 cent per
+ * bin, the strongest peak is interpolated further.
+ */
+
+#define ZOOM_SPAN   (100)  // [cent] analyzed range around fc
+#define ZOOM_DECIM  (4)    // decimated rate: fc / 4
+#define ZOOM_BAND   (.75)  // anti-aliasing band-pass, relative to the decimated rate
+#define ZOOM_ORDER  (4)
+#define ZOOM_WINDOW (128)  // [decimated samples]
+#define ZOOM_FFT    (1024) // zero-padded FFT size
+#define ZOOM_HOP    (16)   // [decimated samples] between analyses
+
+struct TunaZoom {
+	bool   enabled;
+	double rate;
+	float  fc;       // [Hz] oscillator frequency
+
+	/* anti-aliasing, mixer and decimation */
+	struct FilterBank fb;
+	uint32_t decim;  // samples per decimated sample
+	uint32_t cnt;
+	double   osc_re, osc_im;
+	double   rot_re, rot_im;
+	double   acc_re, acc_im;
+
+	/* decimated signal, complex */
+	float    buf[ZOOM_WINDOW][2];
+	uint32_t wr;
+	uint32_t fill;    // decimated samples since reset
+	uint32_t pending; // decimated samples since the last analysis
+
+	/* FFT */
+	float          window[ZOOM_WINDOW];
+	fftwf_complex* fft_in;
+	fftwf_complex* fft_out;
+	fftwf_plan     fftplan;
+	int            k_lo; // FFT bin of result.cent[0], may be negative
+
+	LibTunaZoom result;
+};
+
+static TunaZoom* zoom_alloc (double rate) {
+	TunaZoom* zm = (TunaZoom*)calloc(1, sizeof(TunaZoom));
+	if (!zm) {
+		return NULL;
+	}
+	zm->rate = rate;
+	zm->fft_in  = (fftwf_complex*)fftwf_malloc (sizeof (fftwf_complex) * ZOOM_FFT);
+	zm->fft_out = (fftwf_complex*)fftwf_malloc (sizeof (fftwf_complex) * ZOOM_FFT);
+	if (!zm->fft_in || !zm->fft_out) {
+		fftwf_free (zm->fft_in);
+		fftwf_free (zm->fft_out);
+		free (zm);
+		return NULL;
+	}
+
+	pthread_mutex_lock (&fftw_planner_lock);
+	zm->fftplan = fftwf_plan_dft_1d (ZOOM_FFT, zm->fft_in, zm->fft_out, FFTW_FORWARD, FFTW_MEASURE);
+	pthread_mutex_unlock (&fftw_planner_lock);
+
+	/* planning may overwrite the input, zero-padding is never written to */
+	memset (zm->fft_in, 0, sizeof (fftwf_complex) * ZOOM_FFT);
+
+	/* Hann, normalized to 0dBFS for a full-scale sine (like fft.c) */
+	double sum = 0;
+	for (uint32_t i = 0; i < ZOOM_WINDOW; ++i) {
+		zm->window[i] = .5 - .5 * cos (2. * M_PI * i / (ZOOM_WINDOW - 1.));
+		sum += zm->window[i];
+	}
+	for (uint32_t i = 0; i < ZOOM_WINDOW; ++i) {
+		zm->window[i] *= 2. / sum;
+	}
+	return zm;
+}
+
+static void zoom_free (TunaZoom* zm) {
+	if (!zm) {
+		return;
+	}
+	pthread_mutex_lock (&fftw_planner_lock);
+	fftwf_destroy_plan (zm->fftplan);
+	pthread_mutex_unlock (&fftw_planner_lock);
+	fftwf_free (zm->fft_in);
+	fftwf_free (zm->fft_out);
+	free (zm);
+}
+
+/* center the analysis on fc, discard previous data */
+static void zoom_retune (TunaZoom* zm, const float fc) {
+	LibTunaZoom* zr = &zm->result;
+
+	zm->fc      = fc;
+	zm->wr      = 0;
+	zm->fill    = 0;
+	zm->pending = 0;
+	zm->cnt     = 0;
+	zm->acc_re  = zm->acc_im = 0;
+	zm->osc_re  = 1;
+	zm->osc_im  = 0;
+
+	zr->fc      = fc;
+	zr->n_bins  = 0;
+	zr->peak    = 0;
+	zr->level   = -INFINITY;
+	zr->updated = true;
+
+	if (fc <= 0 || fc >= .45 * zm->rate) {
+		zr->fc = 0;
+		return;
+	}
+
+	zm->decim = MAX(1, floor (zm->rate * ZOOM_DECIM / fc));
+	const double fs_d = zm->rate / zm->decim;
+	const double df   = fs_d / ZOOM_FFT;
+
+	bandpass_setup (&zm->fb, zm->rate, fc, ZOOM_BAND * fs_d, ZOOM_ORDER);
+	zm->rot_re = cos (2. * M_PI * fc / zm->rate);
+	zm->rot_im = sin (2. * M_PI * fc / zm->rate);
+
+	/* bins inside +-ZOOM_SPAN */
+	int k_lo = ceil (fc * (pow (2., -ZOOM_SPAN / 1200.) - 1.) / df);
+	int k_hi = floor (fc * (pow (2., ZOOM_SPAN / 1200.) - 1.) / df);
+	k_lo = MAX(k_lo, -ZOOM_FFT / 2 + 1);
+	k_hi = MIN(k_hi, ZOOM_FFT / 2 - 1);
+	k_hi = MIN(k_hi, k_lo + LIBTUNA_ZOOM_BINS - 1);
+
+	zm->k_lo = k_lo;
+	for (int k = k_lo; k <= k_hi; ++k) {
+		zr->cent[k - k_lo]  = 1200. * log2 (1. + k * df / fc);
+		zr->power[k - k_lo] = -INFINITY;
+	}
+	zr->n_bins = k_hi - k_lo + 1;
+}
+
+/* window and analyze the last ZOOM_WINDOW decimated samples */
+static void zoom_analyze (TunaZoom* zm) {
+	LibTunaZoom* zr = &zm->result;
+
+	for (uint32_t i = 0; i < ZOOM_WINDOW; ++i) {
+		const uint32_t p = (zm->wr + i) % ZOOM_WINDOW;
+		zm->fft_in[i][0] = zm->buf[p][0] * zm->window[i];
+		zm->fft_in[i][1] = zm->buf[p][1] * zm->window[i];
+	}
+	fftwf_execute (zm->fftplan);
+
+	uint32_t pk = 0;
+	for (uint32_t b = 0; b < zr->n_bins; ++b) {
+		const uint32_t k = (zm->k_lo + (int)b + ZOOM_FFT) % ZOOM_FFT;
+		const float re = zm->fft_out[k][0];
+		const float im = zm->fft_out[k][1];
+		zr->power[b] = fftx_power_to_dB (re * re + im * im);
+		if (zr->power[b] > zr->power[pk]) {
+			pk = b;
+		}
+	}
+
+	/* parabolic interpolation of the peak (on a log-scale, exact for a
+	 * gaussian, close for the main lobe of a Hann window) */
+	zr->level = zr->power[pk];
+	zr->peak  = zr->cent[pk];
+	if (pk > 0 && pk + 1 < zr->n_bins && isfinite (zr->power[pk - 1]) && isfinite (zr->power[pk + 1])) {
+		const float a = zr->power[pk - 1];
+		const float b = zr->power[pk];
+		const float c = zr->power[pk + 1];
+		const float d = a - 2.f * b + c;
+		if (d < 0) {
+			const float p = .5f * (a - c) / d;
+			const double df = zm->rate / zm->decim / ZOOM_FFT;
+			zr->peak  = 1200. * log2 (1. + (zm->k_lo + (int)pk + p) * df / zm->fc);
+			zr->level = b - .25f * (a - c) * p;
+		}
+	}
+	zr->updated = true;
+}
+
+/* called by libtuna_process(), after the note was analyzed */
+static void tuna_zoom (LibTuna *self, const float* a_in, const uint32_t n_samples) {
+	TunaZoom* zm = self->zoom;
+	zm->result.updated = false;
+
+	if (!zm->enabled) {
+		return;
+	}
+
+	if (self->tuna_fc != zm->fc) {
+		zoom_retune (zm, self->tuna_fc);
+	}
+	if (zm->result.n_bins == 0) {
+		/* no note, or out of range */
+		return;
+	}
+
+	const uint32_t decim = zm->decim;
+	const double rot_re = zm->rot_re;
+	const double rot_im = zm->rot_im;
+	double osc_re = zm->osc_re;
+	double osc_im = zm->osc_im;
+	double acc_re = zm->acc_re;
+	double acc_im = zm->acc_im;
+	uint32_t cnt  = zm->cnt;
+
+	for (uint32_t n = 0; n < n_samples; ++n) {
+		const double y = bandpass_process (&zm->fb, a_in[n]);
+		acc_re += y * osc_re;
+		acc_im -= y * osc_im;
+
+		const double re = osc_re * rot_re - osc_im * rot_im;
+		osc_im = osc_re * rot_im + osc_im * rot_re;
+		osc_re = re;
+
+		if (++cnt < decim) {
+			continue;
+		}
+		zm->buf[zm->wr][0] = acc_re / decim;
+		zm->buf[zm->wr][1] = acc_im / decim;
+		zm->wr = (zm->wr + 1) % ZOOM_WINDOW;
+		++zm->fill;
+		++zm->pending;
+
+		/* keep the oscillator on the unit circle */
+		const double g = 1.0 / sqrt (osc_re * osc_re + osc_im * osc_im);
+		osc_re *= g;
+		osc_im *= g;
+		acc_re = acc_im = 0;
+		cnt = 0;
+	}
+
+	zm->osc_re = osc_re;
+	zm->osc_im = osc_im;
+	zm->acc_re = acc_re;
+	zm->acc_im = acc_im;
+	zm->cnt    = cnt;
+
+	/* at most one analysis per cycle */
+	if (zm->fill >= ZOOM_WINDOW && zm->pending >= ZOOM_HOP) {
+		zm->pending = 0;
+		zoom_analyze (zm);
+	}
+}
+
+/******************************************************************************
+ * public API, zoomed spectrum
+ */
+
+LIBTUNA_API
+void
+libtuna_set_zoom (LibTuna* self, bool enable)
+{
+	TunaZoom* zm = self->zoom;
+	if (zm->enabled == enable) {
+		return;
+	}
+	zm->enabled = enable;
+	zoom_retune (zm, 0);
+}
+
+LIBTUNA_API
+const LibTunaZoom*
+libtuna_zoom_result (const LibTuna* self)
+{
+	return &self->zoom->result;
+}
@@ -0,0 +1,572 @@
+/* tuna.lv2 offline pitch analysis
+ *
+ * Copyright (C) 2013 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Analyze audio files (anything libsndfile reads) using the tuner's DSP,
+ * as fast as the CPU permits. Files are processed concurrently, one
+ * plugin instance per file. For every file a CSV time-series is written:
+ *
+ *   time,freq,note,name,cent,rms
+ *
+ * time [sec] end of the analysis interval, freq [Hz], MIDI note-number,
+ * note-name, cent deviation and signal level [dBFS]. Columns other
+ * than time and rms are empty if no pitch is detected.
+ *
+ * With --lookahead, notes are not taken from the realtime tracker as-is
+ * but decided with some delay, using the FFT's note candidates of
+ * later frames as well (see "lookahead smoothing" below).
+ */
+#include "../src/tuna.c"
+#include "../bench/host.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sndfile.h>
+
+typedef struct {
+	char** files;
+	int    n_files;
+	int    next_file;    // atomic, index of next file to process
+	int    n_failed;     // atomic
+	uint64_t audio_ms;   // atomic, total duration of processed audio
+	double interval;     // [sec] between output rows
+	float  tuning;
+	int    channel;      // -1: mix down
+	double lookahead;    // [sec], 0: off
+	const char* outdir;
+	bool   quiet;
+} Analyzer;
+
+/* instantiate() uses the shared URID map, which is not thread-safe */
+static pthread_mutex_t instantiate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char notename[12][3] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+
+/* analysis result of one interval */
+typedef struct {
+	double time;
+	float  freq;     // tracker output, 0: none
+	float  cent;
+	float  rms;
+	float  fft_freq; // lowest peak of the FFT, 0: none
+} Frame;
+
+static void
+write_row (FILE* out, const Frame* f, int note, float tuning)
+{
+	if (note < 0) {
+		fprintf (out, "%.4f,,,,,%.1f\n", f->time, f->rms);
+		return;
+	}
+
+	float freq = 0;
+	float cent = 0;
+	if (f->freq > 0 && lrintf (12.f * log2f (f->freq / tuning)) + 69 == note) {
+		/* tracker agrees, use its precise value */
+		freq = f->freq;
+		cent = f->cent;
+	} else if (f->fft_freq > 0) {
+		/* octave of the FFT peak that matches */
+		const int n_fft = lrintf (12.f * log2f (f->fft_freq / tuning)) + 69;
+		if ((note - n_fft) % 12 == 0) {
+			freq = f->fft_freq * powf (2.f, (note - n_fft) / 12);
+			cent = 1200.f * log2f (freq / (tuning * powf (2.f, (note - 69.f) / 12.f)));
+		}
+	}
+
+	if (freq > 0) {
+		fprintf (out, "%.4f,%.3f,%d,%s%d,%.2f,%.1f\n",
+				f->time, freq, note, notename[note % 12], note / 12 - 1, cent, f->rms);
+	} else {
+		fprintf (out, "%.4f,,%d,%s%d,,%.1f\n",
+				f->time, note, notename[note % 12], note / 12 - 1, f->rms);
+	}
+}
+
+/******************************************************************************
+ * lookahead smoothing
+ *
+ * Fixed-lag Viterbi decoding. Candidates for every frame are: no note,
+ * the tracker's note, the FFT's note and the octaves around it.
+ * Each is rated by how well it matches the frame's evidence, changing
+ * notes costs extra, octave jumps even more. A frame is decided once
+ * `lag` later frames are known. CPU cost is linear in the file length,
+ * memory is bounded by the lag.
+ */
+
+#define SM_CAND (5)
+
+/* evidence, per frame */
+#define SM_VOICED     (2.f)  // no note, but tracker or FFT detected one
+#define SM_MISSING    (1.f)  // note, but tracker or FFT did not detect one
+#define SM_TRK_OTHER  (1.5f) // tracker reports a different note
+#define SM_FFT_OTHER  (2.f)  // FFT reports a different note
+#define SM_FFT_OCTAVE (1.5f) // FFT reports the note an octave off
+/* transitions */
+#define SM_ONSET      (2.f)  // no note <> note
+#define SM_CHANGE     (4.f)  // note change
+#define SM_OCTAVE     (8.f)  // note change by octave(s)
+
+typedef struct {
+	Frame f;
+	int   n_cand;
+	int   note[SM_CAND]; // -1: no note
+	float cost[SM_CAND]; // accumulated
+	int   from[SM_CAND]; // best predecessor
+	int   choice;
+} SmFrame;
+
+typedef struct {
+	SmFrame* ring;
+	uint32_t size;    // lag + 1
+	uint64_t n;       // frames pushed
+	uint64_t emitted; // frames written
+	float    tuning;
+	FILE*    out;
+} Smoother;
+
+static int
+sm_note (const Smoother* sm, float freq)
+{
+	return freq > 0 ? lrintf (12.f * log2f (freq / sm->tuning)) + 69 : -1;
+}
+
+static void
+sm_add_candidate (SmFrame* sf, int note)
+{
+	if (note < -1 || note > 127) {
+		return;
+	}
+	for (int i = 0; i < sf->n_cand; ++i) {
+		if (sf->note[i] == note) {
+			return;
+		}
+	}
+	assert (sf->n_cand < SM_CAND);
+	sf->note[sf->n_cand++] = note;
+}
+
+static float
+sm_evidence (int note, int n_trk, int n_fft)
+{
+	if (note < 0) {
+		return (n_trk >= 0 ? SM_VOICED : 0) + (n_fft >= 0 ? SM_VOICED : 0);
+	}
+	float c = 0;
+	if (n_trk < 0) {
+		c += SM_MISSING;
+	} else if (n_trk != note) {
+		c += SM_TRK_OTHER;
+	}
+	if (n_fft < 0) {
+		c += SM_MISSING;
+	} else if (n_fft != note) {
+		c += (abs (n_fft - note) % 12 == 0) ? SM_FFT_OCTAVE : SM_FFT_OTHER;
+	}
+	return c;
+}
+
+static float
+sm_transition (int from, int to)
+{
+	if (from == to) {
+		return 0;
+	}
+	if (from < 0 || to < 0) {
+		return SM_ONSET;
+	}
+	return (abs (from - to) % 12 == 0) ? SM_OCTAVE : SM_CHANGE;
+}
+
+static void
+sm_init (Smoother* sm, uint32_t lag, float tuning, FILE* out)
+{
+	sm->size    = lag + 1;
+	sm->ring    = (SmFrame*)calloc (sm->size, sizeof (SmFrame));
+	sm->n       = 0;
+	sm->emitted = 0;
+	sm->tuning  = tuning;
+	sm->out     = out;
+}
+
+/* trace back from the best candidate of the latest frame */
+static void
+sm_backtrack (Smoother* sm, uint64_t until)
+{
+	const SmFrame* last = &sm->ring[(sm->n - 1) % sm->size];
+	int k = 0;
+	for (int i = 1; i < last->n_cand; ++i) {
+		if (last->cost[i] < last->cost[k]) {
+			k = i;
+		}
+	}
+	for (uint64_t t = sm->n; t-- > until;) {
+		SmFrame* sf = &sm->ring[t % sm->size];
+		sf->choice = k;
+		k = sf->from[k];
+	}
+}
+
+static void
+sm_emit (Smoother* sm)
+{
+	const SmFrame* sf = &sm->ring[sm->emitted % sm->size];
+	write_row (sm->out, &sf->f, sf->note[sf->choice], sm->tuning);
+	++sm->emitted;
+}
+
+static void
+sm_push (Smoother* sm, const Frame* f)
+{
+	SmFrame* sf = &sm->ring[sm->n % sm->size];
+	const int n_trk = sm_note (sm, f->freq);
+	const int n_fft = sm_note (sm, f->fft_freq);
+
+	sf->f = *f;
+	sf->n_cand = 0;
+	sm_add_candidate (sf, -1);
+	sm_add_candidate (sf, n_trk);
+	if (n_fft >= 0) {
+		sm_add_candidate (sf, n_fft);
+		sm_add_candidate (sf, n_fft - 12);
+		sm_add_candidate (sf, n_fft + 12);
+	}
+
+	const SmFrame* prev = sm->n > 0 ? &sm->ring[(sm->n - 1) % sm->size] : NULL;
+	float c_min = HUGE_VALF;
+	for (int j = 0; j < sf->n_cand; ++j) {
+		float best = 0;
+		int   from = -1;
+		if (prev) {
+			best = HUGE_VALF;
+			for (int i = 0; i < prev->n_cand; ++i) {
+				const float c = prev->cost[i] + sm_transition (prev->note[i], sf->note[j]);
+				if (c < best) {
+					best = c;
+					from = i;
+				}
+			}
+		}
+		sf->cost[j] = best + sm_evidence (sf->note[j], n_trk, n_fft);
+		sf->from[j] = from;
+		c_min = MIN (c_min, sf->cost[j]);
+	}
+	/* keep numbers small */
+	for (int j = 0; j < sf->n_cand; ++j) {
+		sf->cost[j] -= c_min;
+	}
+	++sm->n;
+
+	/* the oldest frame can be decided */
+	if (sm->n == sm->emitted + sm->size) {
+		sm_backtrack (sm, sm->emitted);
+		sm_emit (sm);
+	}
+}
+
+static void
+sm_flush (Smoother* sm)
+{
+	if (sm->n > sm->emitted) {
+		sm_backtrack (sm, sm->emitted);
+	}
+	while (sm->emitted < sm->n) {
+		sm_emit (sm);
+	}
+	free (sm->ring);
+	sm->ring = NULL;
+}
+
+/******************************************************************************
+ * file analysis
+ */
+
+/* output file name: outdir + basename, or next to the input file */
+static char*
+csv_path (Analyzer* a, const char* path)
+{
+	const char* base = strrchr (path, '/');
+	base = (base && a->outdir) ? base + 1 : path;
+	const char* dot = strrchr (base, '.');
+	const size_t blen = (dot && dot > base && !strchr (dot, '/')) ? (size_t)(dot - base) : strlen (base);
+	const size_t dlen = a->outdir ? strlen (a->outdir) + 1 : 0;
+
+	char* rv = (char*)malloc (dlen + blen + 5);
+	if (a->outdir) {
+		sprintf (rv, "%s/", a->outdir);
+	}
+	memcpy (&rv[dlen], base, blen);
+	strcpy (&rv[dlen + blen], ".csv");
+	return rv;
+}
+
+static int
+analyze_file (Analyzer* a, const char* path)
+{
+	SF_INFO nfo;
+	memset (&nfo, 0, sizeof (nfo));
+	SNDFILE* sf = sf_open (path, SFM_READ, &nfo);
+	if (!sf) {
+		fprintf (stderr, "%s: %s\n", path, sf_strerror (NULL));
+		return -1;
+	}
+	if (a->channel >= nfo.channels) {
+		fprintf (stderr, "%s: channel %d does not exist\n", path, a->channel + 1);
+		sf_close (sf);
+		return -1;
+	}
+
+	const uint32_t hop = MIN (HOST_MAX_BLOCK, MAX (16, rint (a->interval * nfo.samplerate)));
+	char* out_path = csv_path (a, path);
+	FILE* out = fopen (out_path, "w");
+	if (!out) {
+		fprintf (stderr, "%s: cannot open '%s' for writing\n", path, out_path);
+		free (out_path);
+		sf_close (sf);
+		return -1;
+	}
+
+	TunaHost h;
+	pthread_mutex_lock (&instantiate_lock);
+	const bool ok = host_open (&h, nfo.samplerate);
+	pthread_mutex_unlock (&instantiate_lock);
+	if (!ok) {
+		fclose (out);
+		free (out_path);
+		sf_close (sf);
+		return -1;
+	}
+	h.ports[TUNA_MODE]   = 0; // auto-detect
+	h.ports[TUNA_TUNING] = a->tuning;
+
+	float* buf  = (float*)malloc (hop * nfo.channels * sizeof (float));
+	float* mono = (float*)malloc (hop * sizeof (float));
+	uint64_t pos = 0;
+	sf_count_t n;
+
+	LibTuna* self = ((Tuna*)h.handle)->engine;
+	Smoother sm;
+	memset (&sm, 0, sizeof (sm));
+	if (a->lookahead > 0) {
+		sm_init (&sm, ceil (a->lookahead * nfo.samplerate / hop), a->tuning, out);
+	}
+
+	fprintf (out, "time,freq,note,name,cent,rms\n");
+
+	while ((n = sf_readf_float (sf, buf, hop)) > 0) {
+		for (sf_count_t i = 0; i < n; ++i) {
+			if (a->channel >= 0) {
+				mono[i] = buf[i * nfo.channels + a->channel];
+			} else {
+				float s = 0;
+				for (int c = 0; c < nfo.channels; ++c) {
+					s += buf[i * nfo.channels + c];
+				}
+				mono[i] = s / nfo.channels;
+			}
+		}
+
+		host_run (&h, mono, n);
+		pos += n;
+
+		Frame f;
+		f.time     = pos / (double)nfo.samplerate;
+		f.freq     = h.ports[TUNA_FREQ_OUT];
+		f.cent     = h.ports[TUNA_CENT];
+		f.rms      = h.ports[TUNA_RMS];
+		f.fft_freq = 0;
+
+		if (a->lookahead <= 0) {
+			write_row (out, &f, f.freq > 0 ? (h.ports[TUNA_OCTAVE] + 1) * 12 + h.ports[TUNA_NOTE] : -1, a->tuning);
+			continue;
+		}
+
+		/* the FFT was updated in this cycle (no fps limit, n <= window-size),
+		 * query it the same way as run() does */
+		if (self->rms_signal >= self->v_rms) {
+			f.fft_freq = fftx_find_note (self->an->fftx, &self->range, self->rms_signal * self->v_fft,
+					self->v_ovr, self->v_fun, self->v_oct, self->v_ovt);
+			if (f.fft_freq < 20) {
+				f.fft_freq = 0;
+			}
+		}
+		sm_push (&sm, &f);
+	}
+
+	if (a->lookahead > 0) {
+		sm_flush (&sm);
+	}
+
+	host_close (&h);
+	free (buf);
+	free (mono);
+	sf_close (sf);
+
+	const int rv = ferror (out) ? -1 : 0;
+	if (fclose (out) || rv) {
+		fprintf (stderr, "%s: error writing '%s'\n", path, out_path);
+		free (out_path);
+		return -1;
+	}
+
+	__atomic_add_fetch (&a->audio_ms, (uint64_t)(1000. * pos / nfo.samplerate), __ATOMIC_RELAXED);
+	if (!a->quiet) {
+		fprintf (stderr, "%s -> %s (%.1f sec)\n", path, out_path, pos / (double)nfo.samplerate);
+	}
+	free (out_path);
+	return 0;
+}
+
+static void*
+analyze_worker (void* arg)
+{
+	Analyzer* a = (Analyzer*)arg;
+	int i;
+	while ((i = __atomic_fetch_add (&a->next_file, 1, __ATOMIC_RELAXED)) < a->n_files) {
+		if (analyze_file (a, a->files[i])) {
+			__atomic_add_fetch (&a->n_failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+static void
+usage (int status)
+{
+	printf ("tuna-analyze - offline pitch analysis.\n\n"
+			"Usage: tuna-analyze [ OPTIONS ] <file>+\n\n"
+			"Options:\n"
+			"  -c, --channel <num>   analyze given channel (default: mix down)\n"
+			"  -h, --help            display this help and exit\n"
+			"  -i, --interval <ms>   time between output rows (default: 10)\n"
+			"  -j, --jobs <num>      number of files to process in parallel\n"
+			"                        (default: number of CPU cores)\n"
+			"  -l, --lookahead <ms>  decide notes with given delay, using later\n"
+			"                        frames to resolve note-changes and octaves\n"
+			"                        (default: 0, off; e.g. 300)\n"
+			"  -o, --outdir <dir>    write CSV files to given directory\n"
+			"                        (default: next to the input file)\n"
+			"  -q, --quiet           only print errors\n"
+			"  -t, --tuning <Hz>     reference pitch of A4 (default: 440)\n"
+			"\n");
+	exit (status);
+}
+
+int
+main (int argc, char** argv)
+{
+	static const struct option long_options[] = {
+		{ "channel",  required_argument, 0, 'c' },
+		{ "help",     no_argument,       0, 'h' },
+		{ "interval", required_argument, 0, 'i' },
+		{ "jobs",     required_argument, 0, 'j' },
+		{ "lookahead", required_argument, 0, 'l' },
+		{ "outdir",   required_argument, 0, 'o' },
+		{ "quiet",    no_argument,       0, 'q' },
+		{ "tuning",   required_argument, 0, 't' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	Analyzer a;
+	memset (&a, 0, sizeof (a));
+	a.interval = .01;
+	a.tuning   = 440;
+	a.channel  = -1;
+
+	long n_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+
+	int c;
+	while ((c = getopt_long (argc, argv, "c:hi:j:l:o:qt:", long_options, NULL)) != -1) {
+		switch (c) {
+			case 'c':
+				a.channel = atoi (optarg) - 1;
+				break;
+			case 'h':
+				usage (EXIT_SUCCESS);
+				break;
+			case 'i':
+				a.interval = atof (optarg) / 1000.;
+				break;
+			case 'j':
+				n_jobs = atoi (optarg);
+				break;
+			case 'l':
+				a.lookahead = atof (optarg) / 1000.;
+				break;
+			case 'o':
+				a.outdir = optarg;
+				break;
+			case 'q':
+				a.quiet = true;
+				break;
+			case 't':
+				a.tuning = atof (optarg);
+				break;
+			default:
+				usage (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		usage (EXIT_FAILURE);
+	}
+	if (a.interval <= 0 || a.tuning < 220 || a.tuning > 880 || a.channel < -1 || a.lookahead < 0) {
+		fprintf (stderr, "tuna-analyze: invalid option value\n");
+		return EXIT_FAILURE;
+	}
+#ifdef BACKGROUND_FFT
+	if (a.lookahead > 0) {
+		fprintf (stderr, "tuna-analyze: --lookahead is not available with a background FFT\n");
+		return EXIT_FAILURE;
+	}
+#endif
+
+	a.files   = &argv[optind];
+	a.n_files = argc - optind;
+	n_jobs = MAX (1, MIN (n_jobs, a.n_files));
+
+	const double t0 = now ();
+
+	pthread_t* threads = (pthread_t*)calloc (n_jobs, sizeof (pthread_t));
+	int n_threads = 0;
+	for (long i = 0; i < n_jobs; ++i) {
+		if (pthread_create (&threads[n_threads], NULL, analyze_worker, &a)) {
+			break;
+		}
+		++n_threads;
+	}
+	if (n_threads == 0) {
+		/* process in this thread */
+		analyze_worker (&a);
+	}
+	for (int i = 0; i < n_threads; ++i) {
+		pthread_join (threads[i], NULL);
+	}
+	free (threads);
+
+	const double t = now () - t0;
+	if (!a.quiet) {
+		fprintf (stderr, "%d files, %d failed, %.1f min audio in %.1f sec using %d threads (%.1f files/min)\n",
+				a.n_files, a.n_failed, a.audio_ms / 60000., t, MAX (1, n_threads),
+				60. * a.n_files / t);
+	}
+
+	uri_free ();
+	return a.n_failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}